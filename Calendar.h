@@ -0,0 +1,111 @@
+/*
+ * Calendar.h
+ *
+ * Conversion between unix time and calendar time, given as an array of month, day, year, hours, minutes and
+ * seconds (the timeIn array of the sketch). Years 2000 to 2099 (the years the clock chip can hold) are worked
+ * out from a table of the days before each month, without loops. The last day found is remembered, so a time on
+ * the same day as the one before it - the usual case, since reads and log lines are seconds or minutes apart -
+ * needs only a subtraction and the split into hours, minutes and seconds. Other years use the general formulas
+ * of the old getUnix2() and convertUnix(); the old convertUnix() kept the day of the 400-year era in 16 bits,
+ * which gave wrong dates from 1970 to February 2000. This file is plain C so the same code is used by
+ * tools/etagbin.c, and tools/caltest.c checks it against the C library for every minute of 32-bit unix time.
+ */
+
+#ifndef CALENDAR_H_
+#define CALENDAR_H_
+
+#include <stdint.h>
+
+#define CAL_2000 946684800ul             // unix time at the start of 2000
+#define CAL_2100 4102444800ul            // unix time at the start of 2100
+const uint16_t calMonthDays[13] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365};  // days before each month (not a leap year)
+
+uint32_t calDayStart = 0;                // unix time at the start of the remembered day
+uint16_t calDate[3] = {1, 1, 1970};      // month, day and year of the remembered day
+
+// Days from the start of 1970 to a date, for any year (the formula of the old getUnix2())
+int32_t calDaysSlow(uint16_t year, uint8_t month, uint8_t day) {
+  int8_t my = (month >= 3) ? 1 : 0;
+  uint16_t y = year + my - 1970;
+  uint16_t dm = 0;
+  for (int i = 0; i < month - 1; i++) dm += (i<7)?((i==1)?28:((i&1)?30:31)):((i&1)?31:30);
+  return day-1+dm+((y+1)>>2)-((y+69)/100)+((y+369)/100/4)+365*(y-my);
+}
+
+/*
+ * Unix time of a date and time. The year is the full year (2000, not 0). Days, hours, minutes and seconds past the
+ * end of their range are carried over the same way as before (February 30th is March 1st or 2nd).
+ */
+uint32_t calUnix(uint16_t year, uint8_t month, uint8_t day, uint8_t hh, uint8_t mm, uint8_t ss) {
+  uint32_t t;
+  if((day == calDate[1]) && (month == calDate[0]) && (year == calDate[2])) {
+    t = calDayStart;                                 // same day as last time
+  } else if((year >= 2000) && (year <= 2099) && (month >= 1) && (month <= 12)) {
+    uint8_t y = year - 2000;
+    int32_t d = y * 365 + (y + 3) / 4 + calMonthDays[month - 1] + day - 1;   // (y + 3) / 4 leap days before this year (2000 is one)
+    if((month > 2) && !(y & 3)) {d++;}              // after February 29th
+    t = CAL_2000 + d * 86400ul;
+  } else {
+    t = calDaysSlow(year, month, day) * 86400ul;
+  }
+  return t + (hh * 60ul + mm) * 60ul + ss;
+}
+
+// Day of the year of a date (1 = January 1st, up to 366), for the years 1901 to 2099
+uint16_t calYearDay(uint16_t year, uint8_t month, uint8_t day) {
+  return calMonthDays[month - 1] + day + (((month > 2) && !(year & 3)) ? 1 : 0);
+}
+
+// Find and remember the day that unix time t falls on
+void calNewDay(uint32_t t) {
+  uint32_t days = t / 86400ul;
+  calDayStart = days * 86400ul;
+  if((t >= CAL_2000) && (t < CAL_2100)) {
+    uint16_t d = days - CAL_2000 / 86400ul;         // days since the start of 2000
+    uint8_t y = (d / 1461) * 4;                      // 4-year groups of 1461 days, each starting with a leap year
+    uint16_t doy = d % 1461;                         // day of the year (0 = January 1st)
+    uint8_t leap = 1;
+    if(doy >= 366) {                                 // second to fourth year of the group
+      y += (doy - 1) / 365;
+      doy = (doy - 1) % 365;
+      leap = 0;
+    }
+    uint8_t m = doy >> 5;                            // the month is this one or the next one
+    if(doy >= calMonthDays[m + 1] + ((m >= 1) ? leap : 0)) {m++;}
+    calDate[0] = m + 1;
+    calDate[1] = doy - calMonthDays[m] - ((m >= 2) ? leap : 0) + 1;
+    calDate[2] = y + 2000;
+  } else {                                           // other years: the formula of the old convertUnix()
+    uint32_t z = days + 719468;
+    uint8_t era = z / 146097ul;
+    uint32_t doe = z - era * 146097ul;
+    uint16_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint16_t y = yoe + era * 400;
+    uint16_t doy = doe - (yoe * 365 + yoe / 4 - yoe / 100);
+    uint16_t mp = (doy * 5 + 2) / 153;
+    calDate[1] = doy - (mp * 153 + 2) / 5 + 1;
+    uint8_t month = mp + (mp < 10 ? 3 : -9);
+    calDate[0] = month;
+    calDate[2] = y + (month <= 2);
+  }
+}
+
+// Calendar time of unix time t into tm (month, day, year, hours, minutes, seconds)
+void calTime(uint32_t t, unsigned int *tm) {
+  uint32_t s = t - calDayStart;                     // seconds into the remembered day
+  if((s >= 86400ul) || (t < calDayStart)) {          // a different day (an earlier day can wrap round to s < 86400)
+    calNewDay(t);
+    s = t - calDayStart;
+  }
+  uint8_t hh = s / 3600u;
+  uint16_t ms = s - hh * 3600u;                      // seconds into the hour
+  uint8_t mm = ms / 60u;
+  tm[0] = calDate[0];
+  tm[1] = calDate[1];
+  tm[2] = calDate[2];
+  tm[3] = hh;
+  tm[4] = mm;
+  tm[5] = ms - mm * 60u;
+}
+
+#endif
@@ -29,6 +29,10 @@
   Don't use the original RV3129 library - it has a bug and the repository owner
   seems to have no interest in fixing it.   
 
+  The SD card is used through the SdFat library (version 2, by Bill Greiman - install it with the library
+  manager), which reads exFAT cards and writes faster than the standard SD library. Set USE_SDFAT to 0 to
+  build with the standard SD library instead (FAT16/FAT32 cards only), for example to compare them.
+
   FLASH MEMORY STRUCTURE:
   Adesto® AT45DB321E
   34,603,008 bits of memory are organized as 8,192 pages of 528 bytes each.
@@ -46,14 +50,48 @@
     byte 3 - (0x403) Set to 0xAA once the memory address counter is intialized. (important mainly for the very first initialization process with a completely blank Flash memory)
     bytes 4-7 - (0x404-0x407) next four bytes are for the reader ID charaters
     byte 13 = Logging mode - log to SD in real time or just use Flash
+    byte 14 = SD card file format - 'T' for text files (default), 'B' for binary files (see openBin())
+    byte 15 = 'R' once page 7 holds the settings copy rather than log lines (see moveOldLog())
+    bytes 16-63 - sleep schedule: up to 6 sleep windows of 8 bytes - sleep hour and minute, wake hour and minute,
+      first and last day of the year (2 bytes each, least significant byte first). An unused window starts with 0xFF.
+    bytes 64-513 - memory pointer journal: 18-byte entries of memLoc, logLoc, expLoc, logExp and a CRC (see writePage0())
   
-  Pages 1-7 are reserved for logging information (start times, wake/sleep cycles, etc).
+  Pages 1-6 are reserved for logging information (start times, wake/sleep cycles, etc), written as a ring (see logEvent()).
       log events are coded as follows:
        1 - "Logging_started"
        2 - "Going_to_sleep "
        3 - "Wake_from_sleep" 
+  Page 7 holds a copy of page 0 bytes 0-63 while page 0 is rewritten (see writePage0() and moveOldLog()).
   Pages 8 and on are for RFID data. First address for data storage is page 8
 
+  RFID data ring. Pages 8 and on are a ring of blocks of 8 pages. Each block starts with an 8-byte header: 0xA5, a
+  4-byte sequence number (least significant byte first) and 3 unused bytes. The block ahead of the one being written
+  is erased first, so the oldest data are reused.
+
+  Compressed pages. In a block whose header starts with 0xA6, each page (after the block header in the first page)
+  begins with a 52-byte page header (all numbers least significant byte first):
+    byte 0 - 0xC2
+    bytes 1-4 - page sequence number: block sequence number * pages per block (8) + page number in the block
+    bytes 5-8 - base time: unix time of the first record in the page
+    bytes 9-51 are left blank (0xFF) until the page is full (sealed), then filled in:
+    bytes 9-12 - unix time of the last record in the page
+    bytes 13-14 - number of records in the page
+    byte 15 - tag types in the page: bit 0 set if there are EM4100 reads, bit 1 set if there are ISO11784/5 reads
+    byte 16 - antennas used in the page: bit n set if there are reads from antenna n
+    bytes 17-48 - Bloom filter of the tags in the page: 256 bits, 3 bits set for each tag (see bloomBits())
+    bytes 49-50 - CRC (crc16k) of the record bytes followed by header bytes 1-48
+    byte 51 - seal mark: 0x00, written after the rest of the header is complete
+  Records follow the page header. Each record is:
+    first byte - tag number in bits 3-6 and the antenna number in bits 0-2 (bit 7 is always 0). Tags are
+      numbered 0-14 in the order they first appear in the page (the page's tag dictionary). Tag number 15
+      means a new tag: its type (0x00 for EM4100, 0x80 for ISO11784/5) and ID bytes (same order as in the
+      old-style lines) follow, and it is added to the dictionary if there is room.
+    temperature byte - ISO tags only
+    time - seconds since the previous record in the page (since the base time for the first record) as a
+      variable length number: 7 bits per byte, least significant first, the top bit is set when another byte follows.
+  The last byte of a record never has the top bit set, so it is never 0xFF. Records are expanded back into the
+  old-style line format when they are read.
+
   New memory access system (Mar 2023). Memory location (global variable memLoc) counts up from zero. First memory location for RFID 
   is 4224 (page 8 byte 0) or whatever is specified in global variable datStart. Translation of memLoc to flash address as well as crossing page boundaries 
   is done in readFlash() and writeFlash() functions. These functions must recieve arrays, but can deal with
@@ -69,6 +107,9 @@
   the timestamp to make the most significant byte last in the sequence. 
   So, it goes unixTime.b1, unixTime.b2, unixTime.b3, unixTime.b4.
 
+  Flash chips. The chip is identified by its JEDEC ID (flashInit()) and the layout above is scaled to it. Add a line
+  to chips[] for another part (and to the emulator in tools/host/host.cpp).
+
 Nov 8, 2019 - Added Memory address lookup - address pointer no longer used. 
 Nov 10, 2019 - Added dual logging modes. 
 Nov 10, 2019 - Fixed bug in sleepTimer function that stopped the clock.
@@ -88,22 +129,61 @@ Mar 2023  - simplified Flash memory writing - one write command and one read com
 Sept 2023 - New scheme for transferring data to SD. The last line in the SD data
             are compared with lines in the flash to avoid wiring duplicated data. 
 
- TO DO: Build in clock error detection??
- 
+Oct 2026  - Faster startup: memLoc and logLoc come from a pointer journal in page 0 and a binary search over pages.
+          - RFID data and log lines are kept in rings of flash blocks and pages; the oldest are erased ahead of writing.
+          - Compressed RFID data: each page has a base time and a tag dictionary, so about 3 times more reads fit.
+          - Page headers for compressed data with time range, record count, tag types, antennas and CRC.
+          - Menu option Q: show or save reads by time range, tag, tag type and antenna.
+          - Bloom filter of tags in each page header; menu option T shows every read of one tag.
+          - Data transfers skip damaged data and resynchronize after it.
+          - Power-loss-safe appends: each record, page seal and block header has a mark written last.
+          - The settings in page 0 are copied to page 7 while page 0 is rewritten.
+          - Faster flash erasing: sector and block erases, busy polling and erasing ahead while idle.
+          - Flash chip table (chips[]): AT45DB321E, AT45DB641E, W25Q64 and W25Q128.
+          - SD card sync starts where the last one stopped (expLoc and logExp, kept in flash and on the card).
+          - Binary SD card files (menu option F), converted to text with tools/etagbin.c.
+          - Data transfers write whole 512-byte SD card blocks from a buffer.
+          - Logging mode S writes RFID lines to the SD card in batches instead of one at a time.
+          - SdFat library (USE_SDFAT): exFAT cards, preallocated files and multi-block writes.
+          - Text lines are made and read by TextCodec.h instead of sprintf(), String and char2hex().
+          - Unix time conversions by Calendar.h; fixes dates printed for 1970 to Feb 2000.
+          - Software clock in RAM, resynced to the clock chip; clock errors are logged.
+          - No String variables or heap use while logging; the menu shows the heap use.
+          - Large buffers share a static scratch arena; fixed array overruns in appendMemLog() and appendMemRFID().
+          - The wait between reading attempts grows from pauseTime to pauseMax while no tags are read.
+          - Sleep schedule in page 0 (menu option S): up to 6 sleep windows, each for every day or some days of the year.
+          - Power report (menu option P): time in each state, event counts and a battery life estimate. Its main
+            totals are logged once a day (log codes 17-21).
+          - Waits while awake idle the CPU until the next interrupt instead of spinning in delay().
+          - loop() runs a small task list, so read attempts keep their cadence while other work runs between them
+            and while the menu waits for input (menu actions such as exports still stop reading until they end).
+
 */
 
 
 // ***********INITIALIZE INCLUDE FILES AND I/O PINS*******************
 #include "RV3129.h"          // include library for the real time clock - must be installed in libraries folder
 #include <Wire.h>            // include the standard wire library - used for I2C communication with the clock
-#include <SD.h>              // include the standard SD card library
 #include <SPI.h>             // include standard SPI library
+#ifndef USE_SDFAT
+#define USE_SDFAT 1          // 1 = SdFat library (exFAT cards, preallocated files, multi-block writes), 0 = standard SD library
+#endif
+#if USE_SDFAT
+#include <SdFat.h>           // SdFat library by Bill Greiman (version 2) - must be installed in libraries folder
+#else
+#include <SD.h>              // include the standard SD card library
+#endif
+#include "IdleHal.h"          // stopping the CPU until the next interrupt (idle waits)
 #include "Manchester.h"
+#include "TextCodec.h"         // text form of the RFID and log lines (SD card files and serial output)
+#include "Calendar.h"          // conversion between unix time and date and time
+#include <malloc.h>            // mallinfo() for the heap report in the menu
+#include <unistd.h>            // sbrk() for the free RAM report in the menu
 
 
 #define serial SerialUSB       // Designate the USB connection as the primary serial comm port - note lowercase "serial"
-#define SD_FAT_TYPE         3  // Type 3 Reads all card formats
-#define SPI_SPEED          SD_SCK_MHZ(4) .  //Finds fastest speed.
+#define SD_FAT_TYPE         3  // Type 3 Reads all card formats (FAT16, FAT32 and exFAT)
+#define SPI_SPEED          SD_SCK_MHZ(12)  // SD card clock with SdFat - 12 MHz is the fastest SPI clock of the SAMD21
 //#define DEMOD_OUT_1      41  // (PB22) this is the target pin for the raw RFID data from RF circuit 1
 //#define DEMOD_OUT_2      42  // (PB23) this is the target pin for the raw RFID data from RF circuit 2
 //#define SHD_PINA         48  // (PB16) Setting this pin high activates RFID circuit 1
@@ -115,19 +195,131 @@ Sept 2023 - New scheme for transferring data to SD. The last line in the SD data
 #define INT1               47  // (PA20) Clock interrupt for alarms and timers on the RTC
 #define MOTR               2   // used for sleep function (need to investigate this). 
 RV3129 rtc;   //Initialize an instance for the RV3129 real time clock library.
+#if USE_SDFAT
+#if (SD_FAT_TYPE != 3) || (SDFAT_FILE_TYPE != 3)
+#error "Set SDFAT_FILE_TYPE to 3 in SdFatConfig.h - File must be FsFile to read exFAT cards"
+#endif
+SdFs SD;      //SD card (named like the standard library's SD object, so the same code works with either library)
+#endif
 
 // ************************* initialize variables******************************                      
 
+//Flash memory chips that can be used. The storage code works on the geometry of the chip found at startup:
+//pages of pgSize bytes, blocks of blkPgs pages (the erase unit used for the RFID data ring) and sectors of secPgs pages.
+struct flashChip {
+  const char *name;
+  uint8_t id[3];               //JEDEC ID (manufacturer and 2 device bytes, opcode 0x9F)
+  uint16_t pgSize;             //bytes per page (at most 528)
+  uint8_t pgShift;             //bits for the byte address in a DataFlash address (0 = linear addresses)
+  uint32_t nPgs;               //number of pages
+  uint8_t blkPgs;              //pages per block erase
+  uint16_t secPgs;             //pages per sector erase
+  bool nor;                    //SPI NOR flash: write enable needed, no read-modify-write or page erase, busy = status bit 0
+  uint8_t blkOp;               //block erase opcode
+  uint8_t secOp;               //sector erase opcode
+};
+const flashChip chips[] = {
+  {"AT45DB321E", {0x1F, 0x27, 0x01}, 528, 10, 8192, 8, 128, 0, 0x50, 0x7C},
+  {"AT45DB641E", {0x1F, 0x28, 0x00}, 264, 9, 32768, 8, 256, 0, 0x50, 0x7C},
+  {"W25Q64", {0xEF, 0x40, 0x17}, 256, 0, 32768, 16, 256, 1, 0x20, 0xD8},
+  {"W25Q128", {0xEF, 0x40, 0x18}, 256, 0, 65536, 16, 256, 1, 0x20, 0xD8}
+};
+const flashChip *chip = &chips[0];   //chip in use (set in flashInit())
+uint16_t pgSize = 528;         //bytes per page
+
 uint32_t datStart = 4224;      //initial RFID tag memory address
-uint32_t logStart = 528;       //initial log memory address
+bool flashBusy = 0;            //set while the flash chip may still be programming or erasing (flashOn() waits for it)
+bool idleErase = 1;            //erase the next block of the ring while idle (0 = as soon as a block is started)
+bool eraseDue = 0;             //set when the next block of the ring is waiting to be erased
+uint32_t logStart = 528;       //initial log memory address (page 1, or block 1 on NOR flash so page 0 has a block to itself)
+uint16_t logUnit = 528;        //log lines are stored in a ring of these erase units (a page, or a block on NOR flash)
+uint32_t logLast = 3688;       //last location a log line can start at - the next one goes at logStart again
+uint32_t cpyLoc = 3696;        //copy of the page 0 settings while page 0 is rewritten (page 7, or block 5 on NOR flash)
+const uint8_t cpyMark = 0x5C;  //last byte of a settings copy that has not been used up yet (see writePage0())
+const uint8_t ringByte = 15;   //page 0 byte set to ringMark once log lines left in page 7 by earlier firmware are moved
+const char ringMark = 'R';
+
+const uint16_t jrnStart = 64;  //first byte of the memory pointer journal in page 0
+const uint8_t jrnSlot = 18;    //bytes per journal entry: memLoc (4), logLoc (4), expLoc (4), logExp (4), CRC (2)
+const uint8_t jrnMax = 25;     //most journal entries kept in page 0
+uint8_t jrnSlots = 25;         //number of journal entries that fit in page 0
+uint8_t jrnNext = 0;           //next blank journal slot
+
+uint16_t blkSize = 4224;       //bytes per block (blkPgs pages) - RFID data are stored in a ring of blocks
+uint8_t blkPgs = 8;            //pages per block
+const uint8_t blkHdr = 8;      //bytes at the start of each block for the block header (format byte and sequence number)
+const uint8_t blkMark1 = 0xA5; //block header format byte: block holds old-style data lines
+const uint8_t blkMark2 = 0xA6; //block header format byte: block holds compressed pages
+uint16_t firstBlk = 1;         //first block of the RFID data ring (same as datStart)
+uint16_t lastBlk = 1023;       //last block of the RFID data ring (the end of the chip)
+bool ringMem = 1;              //set to 0 when the flash holds old-style RFID data (no block headers)
+uint16_t curBlk = firstBlk;    //block currently being written
+uint32_t blkSeq = 0;           //sequence number of the current block
+uint32_t expLoc;               //RFID data up to this memory location have been written to the SD card
+uint32_t logExp;               //log data up to this memory location have been written to the SD card
+bool overwriting = 0;          //set when unsaved data are being overwritten (so it is only logged once)
+
+const uint8_t pgMark = 0xC2;   //first byte of each page header in the compressed format
+const uint8_t pgHdr = 52;      //bytes in each page header (see the notes at the top)
+const uint8_t dictLen = 15;    //number of tags in the dictionary of each page
+bool pgOpen = 0;               //set when records can be added to the page holding memLoc
+uint32_t pgTime;               //time of the last record written to the current page
+uint8_t pgDictN;               //number of tags in the dictionary of the current page
+uint16_t pgCount;              //number of records in the current page
+uint8_t pgMix;                 //tag types in the current page (bit 0 = EM4100, bit 1 = ISO11784/5)
+uint8_t pgAnt;                 //antennas used in the current page (bit n = antenna n)
+uint16_t pgCRC;                //CRC of the records in the current page
+char pgBloom[32];              //Bloom filter of the tags in the current page
+char pgDict[15][7];            //dictionary of the current page (tag type and ID)
+char rdPage[528];              //page buffer for reading compressed data
+const uint16_t scratchSize = 2 * 528;   //scratch arena: two DataFlash pages (see scratchTake())
+char scratch[scratchSize] __attribute__((aligned(4)));
+uint16_t scratchTop = 0;       //bytes of the scratch arena in use
+uint16_t scratchHigh = 0;      //most bytes of the scratch arena ever in use (shown in the menu)
+const uint16_t logBatch = 1050;  //bytes of log data read from flash at a time during transfers (210 lines, from the scratch arena)
+uint32_t rdPg = 0xFFFFFFFF;    //page held in rdPage
+uint32_t rdNext;               //location of the record after the last one decoded from rdPage
+uint16_t rdDict[15];           //locations of the dictionary tags in rdPage
+uint8_t rdDictN;               //number of tags in the dictionary of rdPage (up to rdNext)
+uint32_t rdTime;               //time of the last record decoded from rdPage
+uint8_t rdState;               //result of checkPage() for rdPage
+
+uint32_t qStart = 0;           //query settings for queryRFID(): first time...
+uint32_t qEnd = 0xFFFFFFFF;    //...last time
+char qTag[7];                  //...tag (tag type and ID, as in the page dictionaries)
+bool qTagSet = 0;              //...set when only one tag is wanted
+uint8_t qType = 3;             //...tag types (bit 0 = EM4100, bit 1 = ISO11784/5)
+uint8_t qAnt = 0;              //...antenna (0 = all antennas)
 
 uint8_t ISO = 0;               //set to 1 to read ISO11874/5 tags, 0 = EM4100 tags
 
 char deviceID[5] = "RFID";            // User defined name of the device                 
-String deviceIDstr;                   // String verion of device name.
 //char fName[13];                       // Used for writing to SD card
-String dataFile;                      // Stores text file name for SD card writing.
-String logFile;                       // Stores text file name for SD card writing.
+char dataFile[13];                    // Stores text file name for SD card writing (8.3 name, e.g. RF01DATA.TXT).
+char logFile[13];                     // Stores text file name for SD card writing.
+char queryFile[13];                   // Stores text file name for query results.
+bool binFmt = 0;                      // SD card data and log files are binary (.BIN) instead of text (.TXT)
+File *sdOut;                          // File being written by the buffered SD card writer (see sdBegin())
+const uint8_t sdBufBlocks = USE_SDFAT ? 16 : 1;   // SD card blocks (512 bytes) in sdBuf - SdFat writes them with one multi-block command
+char sdBuf[512 * sdBufBlocks];        // Buffer for SD card blocks
+uint16_t sdBufN;                      // Bytes in sdBuf
+uint16_t sdBufEnd;                    // sdBuf is written when it holds this many bytes (the first time just up to a block boundary of the file)
+uint32_t sdBlocks;                    // Blocks written since sdBegin()
+const uint16_t sdSyncBlocks = 64;     // Flush the SD card file every 64 blocks (32 KB) during a transfer (0 = only at the end)
+bool sdTrunc = 0;                     // Set when the file being written was preallocated (see sdReserve())
+bool sdErr = 0;                       // Set when the file of a transfer did not open or a write to it failed (see sdEnd())
+const uint8_t binBad = 0xFF;          // lastBinRecord(): the file is not a binary file that can be added to
+char syncFile[13];                    // SD card file recording how far the data and log files are up to date (see syncSD()).
+const uint16_t syncSlot = 512;        // Bytes for each of the two records of the sync file (each in its own card block)
+uint32_t syncCount = 0;               // Number of the newest record of the sync file
+char sdQueue[1024];                   // RFID lines waiting to be written to the SD card in logging mode S (see queueSDLine())
+uint16_t sdQueueN = 0;                // Bytes in sdQueue
+uint8_t sdQueueLines = 0;             // Lines in sdQueue
+uint32_t sdQueueTime;                 // Unix time of the first line in sdQueue
+uint32_t sdQueueFrom;                 // memLoc before the first line in sdQueue...
+uint32_t sdQueueTo;                   // ...and after the last one
+const uint8_t sdBatchLines = 20;      // Write the queued lines to the SD card once there are this many (1 = write each read at once)...
+const uint16_t sdBatchSecs = 60;      // ...or once the oldest is this many seconds old (and always before sleeping or the menu)
 
 union             //Make a union structure for dealing with unix time conversion
 {
@@ -169,21 +361,74 @@ unsigned int lastLogAddr = 520;        // last byte address used for writing RFI
 uint8_t RFcircuit = 1;                 // Used to determine which RFID circuit is active. 1 = primary circuit, 2 = secondary circuit.
 uint8_t pastCircuit = 0xFF;            // Used for repeat reads
 
-String currentDate;                   // USed to get the current date in mm/dd/yyyy format (we're weird in the US)
-String currentTime;                   // Used to get the time
-String currentDateTime;               // Full date and time string
-String timeString;                    // String for storing the whole date/time line of data
 unsigned int timeIn[12];              // Used for incoming serial data during clock setting
-String logMessage;
+uint32_t clockUnix = 0;               // Software clock: unix time, kept in RAM and reset from the clock chip by syncClock()
+uint32_t clockMillis = 0;             // millis() value at clockUnix (moved back by the length of each sleep timer period)
+uint8_t clockFrac = 0;                // 1/32 ms of sleep timer periods not yet added to the software clock
+uint8_t clockHold = 0;                // Seconds the software clock stands still to let a clock chip that is a little behind catch up
+uint32_t clockSyncAt = 0;             // Software clock time of the last resync with the clock chip
+uint16_t clockErrors = 0;             // Number of clock errors found since startup
+bool clockBad = 0;                    // The last resync found a clock error
 char logMess[16]; 
 byte menu;                            // Keeps track of whether the menu is active.
 
+// Power accounting (see energyReport()): time spent in each state and counts of events since startup
+const uint8_t stRFCheck = 0;          // RF circuit on, checking for a tag (the first checkTime ms of a read attempt)
+const uint8_t stRFRead = 1;           // RF circuit on, reading a tag
+const uint8_t stFlashWait = 2;        // waiting for the flash chip to finish programming or erasing
+const uint8_t stSDOn = 3;             // SD card powered
+const uint8_t stUSBDelay = 4;         // delay between read attempts while USB is kept working
+const uint8_t stSleep = 5;            // low power sleep (lpSleep())
+const uint8_t stAwake = 6;            // anything else while awake
+const uint8_t stStates = 7;
+const char *const stNames[stStates] = {"RF presence check", "RF read", "Flash wait", "SD card on", "USB delay", "Sleep", "Other awake"};
+const uint32_t stMicroAmps[stStates] = {30000, 30000, 9000, 25000, 6000, 100, 6000};   // Board current in each state (typical figures - measure your board for better battery life estimates)
+uint64_t stTime[stStates];            // Microseconds in each state (stAwake is worked out in energyReport())
+uint64_t idleTime = 0;                // Microseconds spent in cpuIdle() waits
+const uint32_t idleMicroAmps = 2500;  // Current saved while the CPU is stopped in cpuIdle() (idleTime, any awake state)
+const uint8_t evWake = 0;             // wakeups from low power sleep
+const uint8_t evAttempt = 1;          // read attempts
+const uint8_t evRead = 2;             // tags read
+const uint8_t evStored = 3;           // reads stored (not repeats)
+const uint8_t evProgram = 4;          // flash page program operations
+const uint8_t evErase = 5;            // flash erase operations
+const uint8_t evSDStart = 6;          // SD card starts
+const uint8_t evEvents = 7;
+const char *const evNames[evEvents] = {"Wakeups", "Read attempts", "Tags read", "Reads stored", "Flash programs", "Flash erases", "SD card starts"};
+uint32_t evCount[evEvents];
+uint64_t awakeUs = 0;                 // Microseconds awake (millis() does not run during low power sleep)
+uint32_t awakeMillis = 0;             // millis() when awakeUs was last brought up to date
+uint32_t energyLogAt = 0;             // Software clock time of the last power report
+uint32_t sdOnAt = 0;                  // millis() when the SD card was powered (0 = off)
+
+// Tasks run by loop() (see runTasks()), highest priority first
+const uint8_t tkRF = 0;               // read attempt, storing the tag (every checkTime + the pause between attempts)
+const uint8_t tkStore = 1;            // erase the ring block ahead while no tag is present
+const uint8_t tkSD = 2;               // write the queued lines to the SD card (logging mode S) while no tag is present
+const uint8_t tkSerial = 3;           // 'm' from the serial port opens the menu (while USB is kept working)
+const uint8_t tkClock = 4;            // sleep schedule and power report
+const uint8_t tkTasks = 5;
+const char *const tkNames[tkTasks] = {"RF polling", "Storage", "SD sync", "Serial commands", "Clock"};
+const uint16_t tkPeriod[tkTasks] = {0, 0, 0, 0, 1000};        // ms between runs (0 = every pass; the RF task keeps its own)
+const uint16_t tkBudget[tkTasks] = {0, 10, 250, 10, 250};     // ms a background run may take: it only starts if this fits before the next read attempt
+const uint8_t tkEarly = 16;           // A task this close to its due time (ms) runs now (half a period of the 32 hertz sleep timer)
+const uint16_t tkMaxHold = 2000;      // A task held back this long (ms) because its budget does not fit runs anyway (short pauses)
+uint32_t tkDue[tkTasks];              // taskClock() when each task is next due
+uint32_t tkHeld[tkTasks];             // taskClock() when the budget first held each task back (0 = not held back)
+bool tagNear = 0;                     // The last read attempt read a tag
+bool menuOpen = 0;                    // The menu is open: its input waits run the other tasks (not the serial and clock tasks)
+uint32_t tkRuns[tkTasks];             // Runs of each task that did some work...
+uint32_t tkOverruns[tkTasks];         // ...and those that ended after the next read attempt was due
+uint64_t tkLateSum[tkTasks];          // Total (ms) and...
+uint32_t tkLateMax[tkTasks];          // ...longest time a task waited past its due time
+uint32_t tkRunMax[tkTasks];           // Longest run (ms awake)
+
 // Global variable for tag codes
 
-char RFIDstring[10];                  // Stores the TagID as a character array (10 character string)
+char RFIDstring[15];                  // Stores the TagID as a character array (10 character string, 14 for ISO tags)
 char ISOstring[14];                   // Country code, period, and 10 characters ("003.03B3AB35D9")
 uint16_t RFIDtagUser = 0;             // Stores the first (most significant) byte of a tag ID (user number)
-unsigned long RFIDtagNumber = 0;      // Stores bytes 1 through 4 of a tag ID (user number)
+uint32_t RFIDtagNumber = 0;           // Stores bytes 1 through 4 of a tag ID (user number)
 uint8_t RFIDtagArray[6];              // Stores the five or 6 (ISO) individual bytes of a tag ID.
 uint16_t IDCRC;                        // CRC calculated to determine repeat reads
 uint16_t pastCRC;                      // used to determine repeat reads
@@ -200,17 +445,28 @@ char flashData[12];
 const byte checkTime = 30;                          // How long in milliseconds to check to see if a tag is present (Tag is only partially read during this time -- This is just a quick way of detirmining if a tag is present or not
 const unsigned int pollTime1 = 200;                 // How long in milliseconds to try to read a tag if a tag was initially detected (applies to both RF circuits, but that can be changed)
 const unsigned int delayTime = 1;                   // Minimim time in seconds between recording the same tag twice in a row (only applies to data logging--other operations are unaffected)
-const unsigned long pauseTime = 500;                // CRITICAL - This determines how long in milliseconds to wait between reading attempts. Make this wait time as long as you can and still maintain functionality (more pauseTime = more power saved)
+const unsigned long pauseTime = 500;                // CRITICAL - This determines how long in milliseconds to wait between reading attempts after a tag is read. Make this wait time as long as you can and still maintain functionality (more pauseTime = more power saved)
+const unsigned long pauseMax = 4000;                // Longest wait in milliseconds between reading attempts when no tags are around (set to pauseTime for a fixed wait)
+const byte pauseSteps = 240;                        // Read attempts with no tag (on both circuits) before the wait is doubled, up to pauseMax (240 attempts at 500 ms: 2 minutes)
 uint16_t pauseCountDown = pauseTime / 31.25;        // Calculate pauseTime for 32 hertz timer
-byte pauseRemainder = ((100*pauseTime)%3125)/100;   // Calculate a delay if the pause period must be accurate
-//byte pauseRemainder = 0 ;                         // ...or set it to zero if accuracy does not matter
-
-const byte slpH = 99;                            // When to go to sleep at night - hour
-const byte slpM = 00;                            // When to go to sleep at night - minute
-const byte wakH = 99;                            // When to wake up in the morning - hour
-const byte wakM = 00;                            // When to wake up in the morning - minute
-const unsigned int slpTime = slpH * 100 + slpM;  // Combined hours and minutes for sleep time
-const unsigned int wakTime = wakH * 100 + wakM;  // Combined hours and minutes for wake time
+const uint16_t pauseMaxCount = pauseMax / 31.25;    // Calculate pauseMax for 32 hertz timer
+uint16_t pauseNow = pauseCountDown;                 // Current wait between reading attempts (32 hertz timer periods, see nextPause())
+byte pauseQuiet = 0;                                // Read attempts with no tag at the current wait
+const uint16_t clockSyncSecs = 600;                 // Resync the software clock with the clock chip after this many seconds
+const byte clockMaxDrift = 2;                       // Largest difference (seconds) between the software clock and the clock chip that is not a clock error
+const uint32_t energyLogSecs = 86400;               // Write a power report this often (log codes 16-21, and the report in the POWR.TXT file in logging mode S)
+const uint16_t batteryMAh = 6000;                   // Battery capacity for the battery life estimate in the power report
+
+// Sleep schedule: times when the reader sleeps (at night, for example), set with menu option S and kept in page 0
+// of the flash memory (see sleepWindowAt())
+struct sleepWindow {
+  uint8_t slpH, slpM;                            // When to go to sleep - hour and minute (slpH = 0xFF for an unused window)
+  uint8_t wakH, wakM;                            // When to wake up - hour and minute (the next day if earlier than the sleep time)
+  uint16_t dayFirst, dayLast;                    // Days of the year (1-366) on which the window starts (dayFirst > dayLast wraps around the new year)
+};
+const byte schStart = 16;                        // first byte of the sleep schedule in page 0
+const byte schMax = 6;                           // number of sleep windows in the schedule
+sleepWindow sched[schMax];                       // the sleep schedule (read from flash at startup)
 
 /* The reader will output Serial data for a certain number of read cycles;
    then it will start using a low power sleep mode during the pauseTime between read attempts.
@@ -251,40 +507,61 @@ void setup() {  // setup code goes here, it is run once before anything else
   serial.println(); serial.println(); serial.println();
 
   //Check flash memory and initialize if needed
+  flashInit();                //Find out which flash chip is fitted and set up the memory layout for it
+  restorePage0();             //Put the settings back if the power failed while page 0 was being rewritten
+  moveOldLog();               //Make room for the settings copy on a board that logged into page 7
   readFlash(3, cArray1, 1);   //Read a particular byte from the flash memory; 
   if (cArray1[0] != 0xAA) {  //if the byte is 0xFF then the flash memory needs to be initialized         
     serial.println("Initializing Flash Memory..."); //Message
     cArray1[0] = 0xAA;
-    writeFlash(3, cArray1, 1);               //Write a different byte to this memory location
+    writePage0(3, cArray1, 1);               //Write a different byte to this memory location
   }
 
   readFlash(4, deviceID, 4); //Get and display the device ID
   if (deviceID[1] == 0xFF) {  //If this byte is empty set a default deviceID
     serial.println("Setting default device ID - Please update this!!!");
     deviceID[0] = 'R'; deviceID[1] = 'F'; deviceID[2] = '0'; deviceID[3] = '1';
-    writeFlash(4, deviceID, 4);  //write to flash memory without updating flash address
+    writePage0(4, deviceID, 4);  //write to flash memory without updating flash address
   }
   //serial.print("Device ID: "); serial.println(String(deviceID));             //Display device ID
 
-  memLoc = getMemLoc(datStart, 4324848);            //Last page address is 8191, beginning of last page is 528 * 8191 = 4324848
-  serial.print("Current RFID memory location: ");
-  serial.println(memLoc, DEC);
-  logLoc = getMemLoc(logStart, datStart-528);       //Page Range for log lines 
+  uint32_t jrnMem = 0;                              //Memory locations from the journal in page 0 (if there are any)
+  uint32_t jrnLog = logStart;
+  uint32_t jrnExp = 0;
+  uint32_t jrnLogExp = logStart;
+  bool jrnOK = loadMemLoc(&jrnMem, &jrnLog, &jrnExp, &jrnLogExp);
+  logLoc = getLogLoc(jrnLog);                       //End of the log lines in their ring
   serial.print("Current log memory location: ");
   serial.println(logLoc, DEC);
+  expLoc = jrnExp;
+  logExp = (jrnOK && logHolds(jrnLogExp)) ? jrnLogExp : logFirst();
+  readFlash(datStart, cArray1, 1);                  //Check for old-style RFID data (the first block of the ring starts with a block mark or is erased,
+  ringMem = (cArray1[0] == blkMark1) || (cArray1[0] == blkMark2) || (cArray1[0] == 0xFF);   //so anything else - even a damaged first line - is old-style data)
+  if(ringMem) {
+    memLoc = getRingLoc(jrnMem);                    //Find the newest block in the ring and the end of data in it
+    resumePage();                                   //Get ready to add records to the last page
+    eraseDue = 1;                                   //The block ahead may not have been erased before the restart
+  } else {
+    serial.println("Old-style memory layout - transfer data and erase flash (option E) to start using the ring layout");
+    memLoc = getMemLoc(datStart, (chip->nPgs - 1) * pgSize, (jrnMem > datStart) ? jrnMem : datStart);  //Up to the beginning of the last page
+  }
+  if(!jrnOK) {expLoc = firstDataLoc();}             //Without a journal assume that nothing has been written to the SD card
+  serial.print("Current RFID memory location: ");
+  serial.println(memLoc, DEC);
   
   readFlash(0x0D, cArray1, 1);  //get the logmode
   logMode = cArray1[0];         // define logmode variable
   if(logMode != 'S' && logMode != 'F') { //If log mode is not established then do so
     serial.println("Setting log mode to Flash mode");
     cArray1[0] = 'F';
-    writeFlash(0x0D, cArray1, 1);    
+    writePage0(0x0D, cArray1, 1);    
     logMode = 'F';
   }
+  readFlash(0x0E, cArray1, 1);  //get the SD card file format
+  binFmt = (cArray1[0] == 'B');
+  readFlash(schStart, (char*)sched, sizeof(sched));   //get the sleep schedule (unused windows are blank flash)
 
-  deviceIDstr = String(deviceID);
-  logFile = String(deviceIDstr +  "LOG.TXT");
-  dataFile = String(deviceIDstr + "DATA.TXT");
+  setFileNames();
 
 
   // Initialize SD card
@@ -297,8 +574,7 @@ void setup() {  // setup code goes here, it is run once before anything else
       testFile.close();
       SD.remove("test1234.txt");               // delete the dummy file                      
       SDstop();                                // may not be needed.
-      appendMemRFID();
-      appendMemLog();  
+      syncSD();                                // bring the SD card files up to date
   } else {     
       serial.println("No SD card detected.");       // error message
       if(logMode == 'S') {;
@@ -317,11 +593,14 @@ void setup() {  // setup code goes here, it is run once before anything else
   } else {
     if(rtc.is12Hour()==true) {rtc.set24Hour();}   //Make sure we are in 24 hour mode??
   }
+  syncClock(1);                                   // start the software clock
 
   doMenu(); 
+  energyLogAt = clockNow();                       // first power report after energyLogSecs
    
   RFcircuit = 1;
   blinkLED(LED_RFID, 3,100);
+  for(uint8_t i = 0; i < tkTasks; i++) {tkDue[i] = taskClock();}   // all tasks are due now
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -329,91 +608,142 @@ void setup() {  // setup code goes here, it is run once before anything else
 ////////////////////////////////////////////////////////////////////////////////
 
 void loop() { // Main code is here, it loops forever:
+  runTasks();                        // Run the tasks that are due, highest priority first
+  pauseTasks();                      // Sleep (or idle while USB is kept working) until the next read attempt
+}
 
-///////Check Sleep//////////////Check Sleep///////////
-//Check to see if it is time to execute nightime sleep mode.
+//////Tasks//////////////Tasks//////////
+//Each task runs to completion. After a task has done some work the list is checked again from the top, so a read
+//attempt that comes due is never left waiting behind the lower priority tasks, and a background task only starts
+//if its tkBudget fits before the next read attempt (or it has waited tkMaxHold for that, so a pauseTime shorter
+//than a budget does not stop it). Read attempts keep their cadence: each one is due checkTime
+//plus the pause after the one before, however long the background work in between took. The reader only wakes
+//for read attempts, so background tasks that come due during a sleep run after the next attempt.
+//While the menu waits for the user to type, the tasks keep running from inputWait(), so read attempts go on; the
+//menu's own actions (an export, a query, erasing the flash memory) still run to completion and stop reading.
+
+//Time for the task list (ms): millis() plus the time spent in low power sleep, when millis() stops
+uint32_t taskClock() {
+  return millis() + (uint32_t)(stTime[stSleep] / 1000);
+}
 
-  rtc.updateTime();                                            // Get an update from the real time clock
-  
-  if(Debug) serial.println(showTime());                        // Show the current time 
-  int curTimeHHMM = rtc.getHours() * 100 + rtc.getMinutes();   // Combine hours and minutes into one variable                     
-  if (curTimeHHMM == slpTime) {                                // Check to see if it is sleep time
-     //String SlpStr =  showTime() + " Go_to_sleep";             // if it's time to sleep make a log message
-     if(Debug) {
-        serial.println("Going to sleep at ");                                // print log message
-        serial.println(showTime());
-     }
-     unixTime.unixLong = getUnix();
-     //serial.println(unixTime.unixLong, DEC);
-     char lg[5] = {12, unixTime.b1, unixTime.b2, unixTime.b3, unixTime.b4};
-     logLoc = writeFlash(logLoc, lg, 5);
-     if(SDOK == 1 && logMode == 'S') {writeSDLine(logFile, 12, lg);}           // save log message if SD writes are enabled
-     sleepAlarm();                                             // sleep using clock alarm for wakeup
-     rtc.updateTime();                                         // get time from clock
-     //SlpStr =  "Wake up from sleep mode at " + showTime();     // log message
-     unixTime.unixLong = getUnix();
-     //serial.println(unixTime.unixLong, DEC);
-     lg[0]=13; lg[1]=unixTime.b1; lg[2]=unixTime.b2; lg[3]=unixTime.b3; lg[4]=unixTime.b4;
-     logLoc = writeFlash(logLoc, lg, 5);
-     if(SDOK == 1 && logMode == 'S') {writeSDLine(logFile, 13, lg);}           // save log message if SD writes are enabled
+void runTasks() {
+  uint32_t start = taskClock();
+  for(uint8_t i = 1; i < tkTasks; i++) {
+    if(tkPeriod[i] == 0) {tkDue[i] = start;}        // tasks run every pass are due when the pass starts
+  }
+  uint8_t i = 0;
+  while(i < tkTasks) {
+    uint32_t now = taskClock();
+    int32_t late = now - tkDue[i];
+    if(late + tkEarly < 0) {         // not due yet
+      i++;
+      continue;
+    }
+    if((i != tkRF) && ((int32_t)(tkDue[tkRF] - now) < (int32_t)tkBudget[i])) {   // would hold up the next read attempt...
+      if(tkHeld[i] == 0) {tkHeld[i] = now | 1;}
+      if(now - tkHeld[i] < tkMaxHold) {
+        i++;
+        continue;
+      }
+    }
+    tkHeld[i] = 0;                   // ...unless it has been held back for tkMaxHold
+    uint32_t due = tkDue[i];
+    uint32_t ms = millis();
+    tkDue[i] = now + tkPeriod[i];
+    if(!runTask(i, due)) {           // nothing to do
+      i++;
+      continue;
+    }
+    ms = millis() - ms;
+    if(late < 0) {late = 0;}
+    tkRuns[i]++;
+    tkLateSum[i] += late;
+    if((uint32_t)late > tkLateMax[i]) {tkLateMax[i] = late;}
+    if(ms > tkRunMax[i]) {tkRunMax[i] = ms;}
+    if((int32_t)(taskClock() - tkDue[tkRF]) > tkEarly) {tkOverruns[i]++;}   // the next read attempt is late
+    i = 0;
+  }
+}
+
+//Run one task; returns 0 if it had nothing to do
+bool runTask(uint8_t i, uint32_t due) {
+  if(menuOpen && ((i == tkSerial) || (i == tkClock))) {return 0;}   // these wait until the menu is closed
+  switch(i) {
+    case tkRF: return rfTask(due);
+    case tkStore: return storeTask();
+    case tkSD: return sdTask();
+    case tkSerial: return serialTask();
+    case tkClock: return clockTask();
   }
+  return 0;
+}
+
+//Wait for the next read attempt: the low power sleep timer (to the nearest 32 hertz period) or, while USB is
+//kept working, an idle delay
+void pauseTasks() {
+  int32_t wait = tkDue[tkRF] - taskClock();
+  if(wait <= tkEarly) {return;}
+  if(cycleCount < stopCycleCount) {
+    idleDelay(wait);                 // Idle the CPU for the delay and keep USB communication working
+    stTime[stUSBDelay] += wait * 1000ul;
+  } else {
+    sleepTimer((wait * 32 + 500) / 1000, 0);
+  }
+}
 
 //////Read Tags//////////////Read Tags//////////
 //Try to read tags - if a tag is read and it is not a recent repeat, write the data to the SD card and the backup memory.
-
+bool rfTask(uint32_t due) {
   bool readSuc = 0; 
-  uint32_t oldMem;
-  String SDsaveString; 
+  uint32_t oldMem = memLoc;
+  uint32_t rfStart = micros();
   if(ISO==1) { readSuc = ISOFastRead(RFcircuit, checkTime, pollTime1); } 
   if(ISO==0) { readSuc = FastRead(RFcircuit, checkTime, pollTime1); }
-
+  uint32_t rfUs = micros() - rfStart;                 // RF circuit on time: presence check, then reading if a tag was found
+  uint32_t chkUs = (rfUs < checkTime * 1000ul) ? rfUs : checkTime * 1000ul;
+  stTime[stRFCheck] += chkUs;
+  stTime[stRFRead] += rfUs - chkUs;
+  evCount[evAttempt]++;
+  if(readSuc) {evCount[evRead]++;}
+  tagNear = readSuc;
   if (readSuc == 1) {
-    rtc.updateTime(); 
     if(ISO==0) {
       processTag(RFIDtagArray, RFIDstring, RFIDtagUser, &RFIDtagNumber);            // Parse tag data into string and hexidecimal formats
-      sprintf(cArray1, "%02X%02X%02X%02X%02X, %d, %02d/%02d/%04d %02d:%02d:%02d",
-        RFIDtagArray[0], RFIDtagArray[1], RFIDtagArray[2], RFIDtagArray[3], RFIDtagArray[4],  
-        RFcircuit, rtc.getMonth(), rtc.getDate(), rtc.getYear()+2000,
-        rtc.getHours(), rtc.getMinutes(), rtc.getSeconds());
-      cArray1[34] = '\0';
     }                 
     if(ISO==1) {
       processISOTag(RFIDtagArray, RFIDstring, &countryCode, &tagTemp, &RFIDtagNumber);
-      countryCode = (RFIDtagArray[5]<<2) + (RFIDtagArray[4]>>6);
-      sprintf(cArray1, "%03X.%02X%02X%02X%02X%02X, %03d, %d, %02d/%02d/%04d %02d:%02d:%02d",
-                 countryCode, (RFIDtagArray[4] & 0b00111111), RFIDtagArray[3], RFIDtagArray[2], RFIDtagArray[1], RFIDtagArray[0], 
-                 tagTemp, RFcircuit, rtc.getMonth(), rtc.getDate(), rtc.getYear()+2000,
-                 rtc.getHours(), rtc.getMinutes(), rtc.getSeconds());
-      cArray1[43] = '\0';
     }
     currRFID = (RFIDtagArray[0]<<24) + (RFIDtagArray[1]<<16) + (RFIDtagArray[2]<<8) + (RFIDtagArray[3]);   //Put RFID code and Circuit into two variable to identify repeats
     currRFID2 = (RFIDtagArray[4]<<8 + RFcircuit);                                                          //Put RFID code and Circuit into two variable to identify repeats
-    unixTime.unixLong = getUnix();                      //Update unix time value to identify repeat reads and employ delay time.
+    unixTime.unixLong = clockNow();                     //Update unix time value to identify repeat reads and employ delay time.
     if((currRFID != pastRFID) | (currRFID2 != pastRFID2) | (unixTime.unixLong-unixPast >= delayTime)) {                      // See if the tag read is a recent repeat
-      oldMem = memLoc;
+      uint32_t preMem = memLoc;           // end of the data before this read
+      evCount[evStored]++;
       if(ISO==0) {
           flashData[0]=RFcircuit; 
           flashData[1]=RFIDtagArray[0]; flashData[2]=RFIDtagArray[1]; flashData[3]=RFIDtagArray[2]; flashData[4]=RFIDtagArray[3]; flashData[5]=RFIDtagArray[4];      // Create an array representing an entire line of data
           flashData[6]=unixTime.b1; flashData[7]=unixTime.b2; flashData[8]=unixTime.b3; flashData[9]=unixTime.b4;
-          memLoc = writeFlash(memLoc, flashData, 10);   //write array  
+          oldMem = storeLine(flashData, 10);   //write array  
       }
       if(ISO==1) {
           flashData[0]=RFcircuit + 0b10000000; //Flag very first bit to denote ISO code 
           flashData[1]=RFIDtagArray[0]; flashData[2]=RFIDtagArray[1]; flashData[3]=RFIDtagArray[2]; flashData[4]=RFIDtagArray[3]; flashData[5]=RFIDtagArray[4]; flashData[6]=RFIDtagArray[5];     // Create an array representing an entire line of data
           flashData[7]=tagTemp;
           flashData[8]=unixTime.b1; flashData[9]=unixTime.b2; flashData[10]=unixTime.b3; flashData[11]=unixTime.b4;
-          memLoc = writeFlash(memLoc, flashData, 12);   //write array  
+          oldMem = storeLine(flashData, 12);   //write array  
       }
+      convertUnix(unixTime.unixLong);
+      formatTagLine(flashData, timeIn, cArray1);   //text version of the line
       if(SDOK == 1 & logMode == 'S') {
-         if(Debug) {serial.println("Storing on SD card and flash memory.");}
-         writeSDLine(dataFile, 0, cArray1);
+         if(Debug) {serial.println("Storing in flash memory and queueing for SD card.");}
+         queueSDLine(binFmt ? flashData : cArray1, preMem);
       }
 
      pastRFID = currRFID;            //First of three things to identify repeat reads
      pastRFID2 = currRFID2;          //Second of three things to identify repeat reads
      unixPast = unixTime.unixLong;   //Third  of three things to identify repeat reads 
      if(Debug) {
-        //serial.print(SDsaveString); 
         serial.print(cArray1);
         serial.print(" logged to flash address "); 
         serial.println(oldMem);
@@ -424,25 +754,77 @@ void loop() { // Main code is here, it loops forever:
     blinkLED(LED_RFID, 2,5);
  }
 
-//////////Pause//////////////////Pause//////////
-//After each read attempt execute a pause using either a simple delay or low power sleep mode.
-
-  if(cycleCount < stopCycleCount){   // Pause between read attempts with delay or a sleep timer 
-    if(serial.available()) {
-      byte C1 = serial.read();                          // read input from the user
-      if(C1 == 'm') {                                     // Do nothing with character that are not numbers or letter (ignore line returns and such)
-      doMenu();
-    }
-    }
-    delay(pauseTime);                // Use a simple delay and keep USB communication working
-    cycleCount++ ;                   // Advance the counter                         
-  }else{
-    sleepTimer(pauseCountDown, pauseRemainder);
+//Next attempt: checkTime plus the pause after this one (a delay while USB is kept working, or a low power sleep
+//that grows while no tags are around), unless a whole period has been lost
+  uint32_t period;
+  if(cycleCount < stopCycleCount) {
+    period = checkTime + pauseTime;
+    cycleCount++ ;                   // Advance the counter
+  } else {
+    period = (checkTime * 32ul + nextPause(readSuc) * 1000ul) / 32;   // Longer sleeps while no tags are around
   }
+  uint32_t now = taskClock();
+  tkDue[tkRF] = ((int32_t)(now - due) < (int32_t)period) ? due + period : now + period;
 
 //Alternate between circuits (comment out to stay on one cicuit).
    RFcircuit == 1 ? RFcircuit = 2 : RFcircuit = 1; //if-else statement to alternate between RFID circuits
+  return 1;
+}
+
+//No tag present - erase the next block of the ring if it is due (the chip erases while the reader pauses)
+bool storeTask() {
+  if(tagNear || !eraseDue) {return 0;}
+  eraseAhead();
+  return 1;
+}
+
+//Write the queued lines to the SD card once there are sdBatchLines of them or the oldest is sdBatchSecs old
+bool sdTask() {
+  if(tagNear || (sdQueueLines == 0) ||
+     ((sdQueueLines < sdBatchLines) && (clockNow() - sdQueueTime < sdBatchSecs))) {return 0;}
+  flushSDQueue();
+  return 1;
+}
 
+//Open the menu when 'm' is received (only while USB is kept working)
+bool serialTask() {
+  if((cycleCount >= stopCycleCount) || !serial.available()) {return 0;}
+  byte C1 = serial.read();                          // read input from the user
+  if(C1 == 'm') {                                   // Do nothing with other characters
+    flushSDQueue();
+    menuOpen = 1;
+    doMenu();
+    menuOpen = 0;
+  }
+  return 1;
+}
+
+///////Check Sleep//////////////Check Sleep///////////
+//Check to see if it is time to execute nightime sleep mode, and if the power report is due.
+bool clockTask() {
+  convertUnix(clockNow());                                     // Time from the software clock (no I2C unless a resync is due)
+  
+  if(Debug) {showTimeArray(cArray2); serial.println(cArray2);} // Show the current time 
+  int8_t slpWin = sleepWindowAt(timeIn);                       // Check to see if it is sleep time (any time inside a sleep window, so a missed minute does not matter)
+  if (slpWin >= 0) {
+     //String SlpStr =  showTime() + " Go_to_sleep";             // if it's time to sleep make a log message
+     if(Debug) {
+        serial.println("Going to sleep at ");                                // print log message
+        showTimeArray(cArray2); serial.println(cArray2);
+     }
+     logEvent(12);                                             // save log message (flash and SD if SD writes are enabled)
+     uint32_t slpStart = clockNow();
+     sleepAlarm(sched[slpWin].wakH, sched[slpWin].wakM);       // sleep using clock alarm for wakeup
+     syncClock(1);                                             // get time from clock (the software clock did not run during the night)
+     stTime[stSleep] += (clockNow() - slpStart) * 1000000ull;
+     //SlpStr =  "Wake up from sleep mode at " + showTime();     // log message
+     logEvent(13);                                             // save log message (flash and SD if SD writes are enabled)
+     nextPause(1);                                             // start the day with short waits between reading attempts
+     for(uint8_t i = 0; i < tkTasks; i++) {tkDue[i] = taskClock();}   // start the day with every task due
+  }
+
+  if(clockNow() - energyLogAt >= energyLogSecs) {energyLog();}   // Power report (log and SD card)
+  return 1;
 }
 
   
@@ -458,9 +840,9 @@ void blinkLED(uint8_t ledPin, uint8_t repeats, uint16_t duration) { //Flash an L
   pinMode(ledPin, OUTPUT);             // make pin an output
   for (int i = 0; i < repeats; i++) {  // loop to flash LED x number of times
     digitalWrite(ledPin, LOW);         // turn the LED on (LOW turns it on)
-    delay(duration);                   // pause again
+    idleDelay(duration);               // pause again
     digitalWrite(ledPin, HIGH);        // turn the LED off (HIGH turns it off)
-    delay(duration);                   // pause for a while
+    idleDelay(duration);               // pause for a while
   }                                    // end loop
 }                                      // End function
 
@@ -471,14 +853,17 @@ void blinkLED(uint8_t ledPin, uint8_t repeats, uint16_t duration) { //Flash an L
     byte menu = 1;
     while (menu == 1) {
       serial.println();
-      rtc.updateTime();
-      serial.println(showTime());          
-      serial.println("Device ID: " + String(deviceID)); //Display device ID
+      showTimeArray(cArray2);
+      serial.println(cArray2);          
+      serial.print("Device ID: "); serial.println(deviceID); //Display device ID
+      if(clockErrors) {serial.print("Clock errors: "); serial.println(clockErrors);}
+      showRAM();
       if(logMode == 'S') {serial.println("Logging mode: S (Data saved to SD card and Flash Mem)");}
       if(logMode == 'F') {
         serial.println("Logging mode: F (Data saved to flash mem only; no SD card logging)");
         //SDOK = 0;     //Turns off SD logging
       }
+      showSchedule();
       serial.println();
   
       // Ask the user for instruction and display the options
@@ -487,14 +872,18 @@ void blinkLED(uint8_t ledPin, uint8_t repeats, uint16_t duration) { //Flash an L
       serial.println("  B = Display backup memory and log history");
   //    serial.println("  D = Display logging history");
       serial.println("  E = Erase (reset) flash memory");
+      serial.println("  F = Change SD card file format (text or binary)");
       serial.println("  I = Set device ID");
       serial.println("  M = Change logging mode");
+      serial.println("  P = Power report: time in each state, events and battery life estimate");
+      serial.println("  Q = Query: display or save reads by time, tag or antenna");
+      serial.println("  S = Sleep schedule: show, add or delete sleep windows");
+      serial.println("  T = Tag lookup: display every read of one tag");
       serial.println("  W = Write ALL flash data to SD card (includes duplicates)");
   
       //Get input from user or wait for timeout
       char incomingByte = getInputByte(15000); 
-      String printThis = String("Value recieved: ") + incomingByte;
-      serial.println(printThis);
+      serial.print("Value recieved: "); serial.println(incomingByte);
       //serial.println(incomingByte, DEC);
       if(incomingByte < 47) {    //Ignore punctuation and line returns and such.
         incomingByte = 'X';
@@ -521,8 +910,8 @@ void blinkLED(uint8_t ledPin, uint8_t repeats, uint16_t duration) { //Flash an L
               break;   //  break out of this option, menu variable still equals 1 so the menu will display again
           }
         case 'B': {
-            extractMemRFID(1, datStart);
-            extractMemLog(1, logStart);
+            extractMemRFID(1, firstDataLoc());
+            extractMemLog(1, logFirst());
             break;       //  break out of this option, menu variable still equals 1 so the menu will display again
           }
   //      case 'D': {
@@ -534,13 +923,13 @@ void blinkLED(uint8_t ledPin, uint8_t repeats, uint16_t duration) { //Flash an L
             logMode = cArray1[0];
             if(logMode != 'S') {
               cArray1[0] = 'S';
-              writeFlash(0x0D, cArray1, 1);
+              writePage0(0x0D, cArray1, 1);
               serial.println("Logging mode S");
               serial.println("Data saved immediately SD card and Flash Mem");
               if(SDOK == 0) {SDOK = 1;}
             } else {
               cArray1[0] = 'F';
-              writeFlash(0x0D, cArray1, 1);
+              writePage0(0x0D, cArray1, 1);
               serial.println("Logging mode F");
               serial.println("Data saved to Flash Mem only (no SD card needed)");
               SDOK = 0;
@@ -551,10 +940,49 @@ void blinkLED(uint8_t ledPin, uint8_t repeats, uint16_t duration) { //Flash an L
             serial.println(logMode);
             break;       //  break out of this option, menu variable still equals 1 so the menu will display again
           }  
+          case 'F': {
+            binFmt = !binFmt;
+            cArray1[0] = binFmt ? 'B' : 'T';
+            writePage0(0x0E, cArray1, 1);
+            setFileNames();
+            if(binFmt) {
+              serial.println("SD card files: binary (DATA.BIN and LOG.BIN - convert with tools/etagbin.c)");
+            } else {
+              serial.println("SD card files: text (DATA.TXT and LOG.TXT)");
+            }
+            break;       //  break out of this option, menu variable still equals 1 so the menu will display again
+          }
+          case 'P': {
+            energyReport(serial);
+            taskReport(serial);
+            break;       //  break out of this option, menu variable still equals 1 so the menu will display again
+          }
+          case 'Q': {
+            queryMenu();
+            break;       //  break out of this option, menu variable still equals 1 so the menu will display again
+          }
+          case 'S': {
+            scheduleMenu();
+            break;       //  break out of this option, menu variable still equals 1 so the menu will display again
+          }
+          case 'T': {
+            serial.println("Tag ID: enter 10 characters for EM4100 or 13 for ISO11784/5 tags");
+            if(inputTag(getInputString(20000))) {
+              qStart = 0;         //all times, tag types and antennas
+              qEnd = 0xFFFFFFFF;
+              qType = 3;
+              qAnt = 0;
+              queryRFID(1);
+            } else {
+              serial.println("Tag ID not recognized");
+            }
+            break;       //  break out of this option, menu variable still equals 1 so the menu will display again
+          }
           case 'W': {
             if (SDOK == 1) {
-              extractMemRFID(3, datStart); //write RFID data to SD card
-              extractMemLog(3, logStart);  //write Log data to SD (always do this second so the file names match up).
+              extractMemRFID(3, firstDataLoc()); //write RFID data to SD card
+              extractMemLog(3, logFirst());  //write Log data to SD (always do this second so the file names match up).
+              SDstop();
             } else {
               serial.println("SD card missing");
             }
@@ -562,25 +990,176 @@ void blinkLED(uint8_t ledPin, uint8_t repeats, uint16_t duration) { //Flash an L
           }  
         } //end of switch
     } //end of while(menu = 1)
-    rtc.updateTime();
-    unixTime.unixLong = getUnix();
-    char logInfo[5] = {11, unixTime.b1, unixTime.b2, unixTime.b3, unixTime.b4};
+    syncClock(1);                            //the clock may have been set
     serial.print("writing start info to log at "); serial.println(logLoc);
-    logLoc = writeFlash(logLoc, logInfo, 5);
-    if(SDOK == 1 && logMode== 'S') {
-      serial.println("Writing start up to SD log file");
-      writeSDLine(logFile, 11, logInfo);     //log to SD card file
+    logEvent(11);                            //log to flash (and SD card file in mode S)
+}
+
+
+//Scratch arena: the large buffers of the flash and SD card transfers (page buffers, the pointer journal, batches of
+//log data) are taken from one static array instead of the stack, so their RAM is counted in the build and is
+//the same every time. Buffers are given back in the reverse order they were taken; a function gives its buffer
+//back before calling anything that takes one it does not need at the same time. The largest need is a log batch
+//(logBatch), or the journal, the settings copy and a NOR page buffer while saveMemLoc() rewrites the journal.
+char *scratchTake(uint16_t n) {
+  n = (n + 3) & ~3;                      //keep buffers word-aligned
+  if(scratchTop + n > scratchSize) {     //a programming error - stop here rather than overwrite RAM
+    serial.println("Scratch arena too small");
+    while(1) {
+      digitalWrite(LED_RFID, LOW); delay(100);
+      digitalWrite(LED_RFID, HIGH); delay(100);
+    }
+  }
+  char *p = scratch + scratchTop;
+  scratchTop = scratchTop + n;
+  if(scratchTop > scratchHigh) {scratchHigh = scratchTop;}
+  return p;
+}
+
+void scratchGive(char *p) {              //give back a buffer and everything taken after it
+  scratchTop = p - scratch;
+}
+
+//RAM budget: static data of the build (globals, including the SD card buffer and queue, the page buffer and the
+//scratch arena), the heap (bytes in use and the size of its arena - malloc() does not give memory back to the
+//rest of RAM) and the free RAM between the heap and the stack. The logging code does not use the heap, so it
+//stays flat (tools/host/memtest.cpp runs a simulated month of logging and checks this).
+extern char __data_start__[], __bss_end__[];   //start and end of the static data (from the linker script)
+void showRAM() {
+  char here;                             //(a stack address)
+#if defined(ARDUINO_ARCH_SAMD)
+  struct mallinfo mi = mallinfo();
+#else
+  struct mallinfo2 mi = mallinfo2();     //(a host build: mallinfo() is deprecated in glibc)
+#endif
+  serial.print("RAM: "); serial.print(__bss_end__ - __data_start__); serial.print(" bytes static (SD buffer ");
+  serial.print(sizeof(sdBuf)); serial.print(", SD queue "); serial.print(sizeof(sdQueue));
+  serial.print(", scratch arena "); serial.print(scratchSize); serial.print(", most used "); serial.print(scratchHigh);
+  serial.println(")");
+  serial.print("Heap: "); serial.print(mi.uordblks); serial.print(" bytes in use, arena ");
+  serial.print(mi.arena); serial.print(" bytes; free RAM "); serial.print(&here - (char*)sbrk(0)); serial.println(" bytes");
+}
+
+
+//Charge used since startup (microamp milliseconds) with the currents in stMicroAmps, less the CPU current while
+//idling. Brings awakeUs and the time of the "Other awake" state up to date first.
+uint64_t energyUsed() {
+  uint32_t ms = millis();
+  awakeUs += (ms - awakeMillis) * 1000ull;
+  awakeMillis = ms;
+  uint64_t busy = 0;                     //awake time accounted for by the other states
+  for(uint8_t i = 0; i < stStates; i++) {
+    if((i != stSleep) && (i != stAwake)) {busy += stTime[i];}
+  }
+  stTime[stAwake] = (awakeUs > busy) ? awakeUs - busy : 0;
+  uint64_t uAms = 0;
+  for(uint8_t i = 0; i < stStates; i++) {uAms += stTime[i] / 1000 * stMicroAmps[i];}
+  uint64_t saved = idleTime / 1000 * idleMicroAmps;
+  return (uAms > saved) ? uAms - saved : 0;
+}
+
+//Power report: time in each state since startup, the charge used with the currents in stMicroAmps, the average
+//current and the battery life it gives, and the event counts. Written to serial (menu option P) or a file.
+void energyReport(Print &out) {
+  uint64_t uAms = energyUsed();          //charge used (microamp milliseconds)
+  uint64_t total = awakeUs + stTime[stSleep];
+  for(uint8_t i = 0; i < stStates; i++) {
+    out.print(stNames[i]); out.print(": "); printSecs(out, stTime[i]); out.print(" s, ");
+    out.print(stMicroAmps[i]); out.print(" uA; ");
+  }
+  out.println();
+  out.print("CPU idle: "); printSecs(out, idleTime); out.print(" s, -"); out.print(idleMicroAmps); out.println(" uA");
+  for(uint8_t i = 0; i < evEvents; i++) {
+    out.print(evNames[i]); out.print(": "); out.print(evCount[i]); out.print("; ");
+  }
+  out.println();
+  uint32_t avg = (total >= 1000) ? uAms / (total / 1000) : 0;   //average current (microamps)
+  out.print("Total "); out.print((uint32_t)(total / 1000000)); out.print(" s, "); out.print((uint32_t)(uAms / 3600000000ull));
+  out.print(" mAh used, average "); out.print(avg); out.print(" uA");
+  if(avg > 0) {
+    out.print(" - battery life about "); out.print(batteryMAh * 1000ul / 24 / avg); out.print(" days ("); out.print(batteryMAh); out.print(" mAh)");
+  }
+  out.println();
+}
+
+//Print a time in microseconds as seconds with 3 decimals (milliseconds in 32 bits would wrap after 49.7 days)
+void printSecs(Print &out, uint64_t us) {
+  uint32_t ms = (us / 1000) % 1000;
+  out.print((uint32_t)(us / 1000000)); out.print('.');
+  if(ms < 100) {out.print('0');}
+  if(ms < 10) {out.print('0');}
+  out.print(ms);
+}
+
+//Task report: for each task the runs that did some work, the overruns (runs that ended after the next read attempt
+//was due), the average and longest wait past the due time and the longest run (see runTasks())
+void taskReport(Print &out) {
+  for(uint8_t i = 0; i < tkTasks; i++) {
+    out.print(tkNames[i]); out.print(": "); out.print(tkRuns[i]); out.print(" runs, ");
+    out.print(tkOverruns[i]); out.print(" overruns, late ");
+    out.print(tkRuns[i] ? (uint32_t)(tkLateSum[i] / tkRuns[i]) : 0); out.print(" ms average, ");
+    out.print(tkLateMax[i]); out.print(" ms most, longest run "); out.print(tkRunMax[i]); out.println(" ms");
+  }
+}
+
+//Periodic power report: a log line (code 16) followed by the main totals since startup as log lines of their own
+//(codes 17-21, each figure in place of the time), so they are kept in flash in both logging modes. In logging
+//mode S the full report also goes to the POWR.TXT file.
+void energyLog() {
+  energyLogAt = clockNow();
+  uint32_t v[5] = {(uint32_t)(energyUsed() / 3600000000ull), (uint32_t)(stTime[stSleep] / 1000000), (uint32_t)(awakeUs / 1000000),
+                   evCount[evStored], evCount[evProgram]};   //(before the log lines add flash programs of their own)
+  logEvent(16);
+  for(uint8_t i = 0; i < 5; i++) {logRecord(17 + i, v[i]);}
+  if(SDOK == 1 && logMode == 'S') {
+    char fName[13];
+    makeFileName(fName, "POWR.TXT");
+    SDstart();
+    File f = SD.open(fName, FILE_WRITE);
+    if(f) {
+      showTimeArray(cArray2);
+      f.println(cArray2);
+      energyReport(f);
+      taskReport(f);
+      f.close();
     }
+    SDstop();
+  }
+}
+
+//Idle waits: stop the CPU until the next interrupt (halIdle()), which is at most 1 ms away with SysTick on, and add
+//the time to idleTime. Waits built on it take the same time as delay() but the CPU is not running a busy loop while
+//the RFID front end or the USB host is what we are waiting for.
+void cpuIdle() {
+  uint32_t u0 = micros();
+  halIdle();
+  idleTime += (uint32_t)(micros() - u0);
+}
+
+//Wait for input from the user: while the menu is open, run the tasks that are due (read attempts keep their
+//cadence), then sleep until the next interrupt
+void inputWait() {
+  if(menuOpen) {runTasks();}
+  cpuIdle();
+}
+
+//Like delay(ms), sleeping in cpuIdle() between interrupts
+void idleDelay(uint32_t ms) {
+  uint32_t t0 = millis();
+  while (millis() - t0 < ms) {
+    cpuIdle();
+  }
 }
 
 
 //Recieve a byte (charaacter) of data from the user- this times out if nothing is entered
 char getInputByte(uint32_t timeOut) {                 // Get a single character
   char readChar = '?';                                // Variable for reading in character
-  uint32_t sDel = 0;                                  // Counter for timing how long to wait for input
+  uint32_t t0 = millis();                             // Start of the wait for input
+  uint32_t sDel = 0;                                  // How long we have waited (ms)
   while (serial.available() == 0 && sDel < timeOut) { // Wait for a user response
-    delay(1);                                         // Delay 1 ms
-    sDel++;                                           // Add to the delay count
+    inputWait();                                      // Run the due tasks, then sleep until the next interrupt
+    sDel = millis() - t0;                             // Time waited so far
   }
   while (serial.available()) {                        // If there is a response then perform the corresponding operation
     byte R1 = serial.read();                          // read input from the user
@@ -593,14 +1172,15 @@ char getInputByte(uint32_t timeOut) {                 // Get a single character
 
 //Recieve a character array of data from the user- this times out if nothing is entered
 byte getInputString(uint32_t timeOut) {               // Get a character array from the user and put in global array variale. Return the number of bytes read in
-  uint32_t sDel = 0;                                  // Counter for timing how long to wait for input
+  uint32_t t0 = millis();                             // Start of the wait for input
+  uint32_t sDel = 0;                                  // How long we have waited (ms)
   byte charCnt = 0;
   while (serial.available() == 0 && sDel < timeOut) { // Wait for a user response
-    delay(1);                                         // Delay 1 ms
-    sDel++;                                           // Add to the delay count
+    inputWait();                                      // Run the due tasks, then sleep until the next interrupt
+    sDel = millis() - t0;                             // Time waited so far
   }
   if (serial.available()) {                           // If there is a response then read in the data
-    delay(40);                                        // long delay to let all the data sink into the buffer
+    idleDelay(40);                                    // long delay to let all the data sink into the buffer
     while (serial.available()) {
       byte R1 = serial.read();                          // read the entry from the user
       if(R1 > 47) {
@@ -623,17 +1203,75 @@ byte getInputString(uint32_t timeOut) {               // Get a character array f
 
 //CLOCK FUNCTIONS///////////
 
-//Get date and time strings and cobine into one string
-String showTime() { //Get date and time strings and cobine into one string
-  currentDateTime = String(rtc.stringDateUSA()) + " " + String(rtc.stringTime()); 
-  return currentDateTime;
+//Date and time of the software clock as "MM/DD/YYYY hh:mm:ss" (TA needs 20 characters)
+void showTimeArray(char *TA) {
+   convertUnix(clockNow());
+   *putDateTime(TA, timeIn) = '\0';
 }
 
-void showTimeArray(char *TA) {
-   sprintf(TA, "%02d/%02d/%04d %02d:%02d:%02d",
-       rtc.getMonth(), rtc.getDate(), rtc.getYear()+2000,
-       rtc.getHours(), rtc.getMinutes(), rtc.getSeconds() );
-   TA[19] = '\0';
+//Software clock: advance clockUnix by the whole seconds counted by millis() since clockMillis
+uint32_t clockTick() {
+  uint32_t ms = millis() - clockMillis;
+  if(ms >= 1000) {
+    uint32_t s = ms / 1000;
+    clockMillis += s * 1000;
+    uint8_t h = (s < clockHold) ? s : clockHold;   //(seconds held back are not added)
+    clockHold -= h;
+    clockUnix += s - h;
+  }
+  return clockUnix;
+}
+
+//Current unix time from the software clock, resyncing with the clock chip every clockSyncSecs seconds
+uint32_t clockNow() {
+  if(clockTick() - clockSyncAt >= clockSyncSecs) {syncClock(0);}
+  return clockUnix;
+}
+
+//Add a sleep timer period (pCount ticks of the 32 hertz timer) to the software clock - millis() stops during sleep
+void clockSleep(uint16_t pCount) {
+  uint32_t t = pCount * 1000ul + clockFrac;  // 1/32 ms
+  clockMillis -= t >> 5;                     // moving the millis() reference back adds the time
+  clockFrac = t & 31;
+}
+
+//Reset the software clock from the clock chip and check the chip: a failed read, an impossible date or time, or
+//(unless setTime is 1, after setting the clock or sleeping through the night) a time more than clockMaxDrift
+//seconds away from the software clock is a clock error. The chip's time is used if it could be read and is not
+//more than clockMaxDrift behind the software clock; otherwise the software clock keeps running. A chip a little
+//behind is caught up by holding the software clock for those seconds (clockHold) rather than setting it back, so
+//the times stored never go backwards. The first error of a run of them is logged ("Clock_error____").
+bool syncClock(bool setTime) {
+  bool ok = rtc.updateTime() && (rtc.getMonth() >= 1) && (rtc.getMonth() <= 12) && (rtc.getDate() >= 1) &&
+            (rtc.getDate() <= 31) && (rtc.getHours() < 24) && (rtc.getMinutes() < 60) && (rtc.getSeconds() < 60);
+  uint32_t t = ok ? getUnix() : 0;
+  uint32_t s = clockTick();
+  int32_t drift = t - s;
+  bool use = ok && (setTime || (drift >= -clockMaxDrift));   //a chip that fell behind (stopped, or reset after a power loss) is not used
+  if(ok && !setTime && ((drift > clockMaxDrift) || (drift < -clockMaxDrift))) {ok = 0;}
+  clockHold = 0;
+  if(use && !setTime && (drift < 0)) {
+    clockHold = -drift;                   //chip a little behind: hold the software clock instead of going back, so times never go backwards
+  } else if(use && (t != s)) {
+    clockUnix = t;
+    clockMillis = millis();
+    clockFrac = 0;
+  }
+  clockSyncAt = clockUnix;
+  if(!ok) {
+    clockErrors++;
+    if(Debug) {
+      serial.print("Clock error");
+      if(t) {serial.print(", chip - software clock (s): "); serial.print(drift);}
+      serial.println();
+    }
+    if(!clockBad) {
+      clockBad = 1;
+      logEvent(15);
+    }
+  }
+  clockBad = !ok;
+  return ok;
 }
 
 
@@ -652,13 +1290,14 @@ void inputTime() {                               // Function to set the clock
     if (rtc.setTime(ss, mm, hh, da, mo, yr + 2000, 1) == false) {     // attempt to set clock with input values
       serial.println("Something went wrong setting the time");        // error message
     }
+    syncClock(1);                                                     // start the software clock from the new time
   } else {
     serial.println("Time entry error");           // error message if string is the wrong lenth
   }
 }
 
 // sleep and wake up using the alarm  on the real time clock 
-void sleepAlarm(){                            // sleep and wake up using the alarm  on the real time clock 
+void sleepAlarm(byte wakH, byte wakM){        // sleep and wake up using the alarm  on the real time clock 
    rtc.setAlarm(0, wakM, wakH, 1, 1, 1, 19);  // set alarm: sec, min, hr, date, mo, wkday, yr (only min and hr matter)
    rtc.writeRegister(0x02, 0);                // write a zero to the flags register to clear all flags.
    rtc.enableDisableAlarm(B00000111);         // Enable daily alarm - responds to hour, minute, and second (set last three enable bits)
@@ -668,6 +1307,113 @@ void sleepAlarm(){                            // sleep and wake up using the ala
    rtc.writeRegister(0x02, 0);                // clear clock flags to turn off alarm.
 }
 
+//Check the sleep schedule: returns the sleep window that time tm (month, day, year, hours, minutes, seconds) is in,
+//or -1. A window runs from its sleep time up to its wake time, on the days of the year it starts on; a window
+//that goes past midnight is checked against the day before for the times after midnight.
+int8_t sleepWindowAt(unsigned int *tm) {
+  uint16_t mins = tm[3] * 60 + tm[4];
+  uint16_t today = calYearDay(tm[2], tm[0], tm[1]);
+  uint16_t yesterday = (today > 1) ? today - 1 : calYearDay(tm[2] - 1, 12, 31);
+  for(uint8_t w = 0; w < schMax; w++) {
+    sleepWindow *sw = &sched[w];
+    if(sw->slpH > 23) {continue;}                   //unused window
+    uint16_t sMin = sw->slpH * 60 + sw->slpM;
+    uint16_t wMin = sw->wakH * 60 + sw->wakM;
+    if(sMin < wMin) {
+      if((mins >= sMin) && (mins < wMin) && schedDay(sw, today)) {return w;}
+    } else {
+      if((mins >= sMin) && schedDay(sw, today)) {return w;}
+      if((mins < wMin) && schedDay(sw, yesterday)) {return w;}
+    }
+  }
+  return -1;
+}
+
+bool schedDay(sleepWindow *sw, uint16_t day) {   //Does a sleep window start on this day of the year?
+  if(sw->dayFirst <= sw->dayLast) {return (day >= sw->dayFirst) && (day <= sw->dayLast);}
+  return (day >= sw->dayFirst) || (day <= sw->dayLast);
+}
+
+//Show the sleep schedule
+void showSchedule() {
+  bool any = 0;
+  for(uint8_t w = 0; w < schMax; w++) {
+    sleepWindow *sw = &sched[w];
+    if(sw->slpH > 23) {continue;}
+    char *p = cArray2;
+    p = putDec2(p, sw->slpH); *p++ = ':'; p = putDec2(p, sw->slpM);
+    memcpy(p, " to ", 4); p += 4;
+    p = putDec2(p, sw->wakH); *p++ = ':'; p = putDec2(p, sw->wakM);
+    *p = '\0';
+    serial.print("Sleep window "); serial.print(w + 1); serial.print(": "); serial.print(cArray2);
+    if((sw->dayFirst == 1) && (sw->dayLast == 366)) {
+      serial.println(", every day");
+    } else {
+      serial.print(", days "); serial.print(sw->dayFirst); serial.print(" to "); serial.println(sw->dayLast);
+    }
+    any = 1;
+  }
+  if(!any) {serial.println("No sleep windows - the reader does not sleep");}
+}
+
+//Menu option S: add or delete a sleep window. The schedule is written to page 0 of the flash memory.
+void scheduleMenu() {
+  showSchedule();
+  serial.println("Add a window: enter the sleep and wake times as hhmmhhmm, and the first and last day of the year");
+  serial.println("  as dddddd for a window used only part of the year (e.g. 21300545 or 21300545121273)");
+  serial.println("Delete a window: enter D and the window number (e.g. D2). Just press Enter to keep the schedule");
+  byte n = getInputString(30000);
+  if((n == 2) && (cArray1[0] == 'D') && (cArray1[1] > '0') && (cArray1[1] <= '0' + schMax)) {
+    sched[cArray1[1] - '1'].slpH = 0xFF;
+  } else if((n == 8) || (n == 14)) {
+    for(uint8_t i = 0; i < n; i++) {
+      if((cArray1[i] < '0') || (cArray1[i] > '9')) {
+        serial.println("Sleep window not valid");
+        return;
+      }
+    }
+    sleepWindow sw;
+    sw.slpH = getDec2(cArray1); sw.slpM = getDec2(cArray1 + 2);
+    sw.wakH = getDec2(cArray1 + 4); sw.wakM = getDec2(cArray1 + 6);
+    sw.dayFirst = 1; sw.dayLast = 366;
+    if(n == 14) {
+      sw.dayFirst = (cArray1[8] - '0') * 100 + getDec2(cArray1 + 9);
+      sw.dayLast = (cArray1[11] - '0') * 100 + getDec2(cArray1 + 12);
+    }
+    uint8_t w = 0;
+    while((w < schMax) && (sched[w].slpH <= 23)) {w++;}   //first unused window
+    if((sw.slpH > 23) || (sw.wakH > 23) || (sw.slpM > 59) || (sw.wakM > 59) || ((sw.slpH == sw.wakH) && (sw.slpM == sw.wakM)) ||
+       (sw.dayFirst < 1) || (sw.dayFirst > 366) || (sw.dayLast < 1) || (sw.dayLast > 366)) {
+      serial.println("Sleep window not valid");
+      return;
+    }
+    if(w == schMax) {
+      serial.println("Sleep schedule full - delete a window first");
+      return;
+    }
+    sched[w] = sw;
+  } else {
+    if(n > 0) {serial.println("Entry not recognized");}
+    return;
+  }
+  writePage0(schStart, (char*)sched, sizeof(sched));
+  showSchedule();
+}
+
+//Sleep before the next read attempt (32 hertz timer periods). The sleep goes back to pauseTime when a tag is read,
+//so birds arriving and leaving are caught, and is doubled after every pauseSteps read attempts with no tag, up to
+//pauseMax, so an empty reader at night wakes far less often.
+uint16_t nextPause(bool readSuc) {
+  if(readSuc) {
+    pauseNow = pauseCountDown;
+    pauseQuiet = 0;
+  } else if(++pauseQuiet >= pauseSteps) {
+    pauseQuiet = 0;
+    pauseNow = (pauseNow * 2 < pauseMaxCount) ? pauseNow * 2 : pauseMaxCount;
+  }
+  return pauseNow;
+}
+
 // Sleep and wake up using a 32-hertz timer on the real time clock 
 void sleepTimer(uint16_t pCount, byte pRemainder){ // Sleep and wake up using a 32-hertz timer on the real time clock 
    rtc.writeRegister(0x02, 0);       // write a zero to the flags register to clear all flags.
@@ -675,51 +1421,25 @@ void sleepTimer(uint16_t pCount, byte pRemainder){ // Sleep and wake up using a
    rtc.enableTimerINT(1);            // enable the clock interrupt output
    rtc.setCTRL1Register(B10011011);  // set control register to enable a 32 Hertz timer.
    lpSleep();                        // call sleep funciton (you lose USB communicaiton here)
+   clockSleep(pCount);               // the software clock counts the sleep (millis() stopped)
+   stTime[stSleep] += pCount * 31250ul;
    //blinkLED(LED_RFID, 1, 30);     // blink indicator - processor reawakened
-   delay(pRemainder);                // additional delay for accuracy
+   idleDelay(pRemainder);            // additional delay for accuracy
    rtc.enableTimerINT(0);            // disable the clock interrupt output
    rtc.writeRegister(0x02, 0);       // write a zero to clear all interrupt flags.
 }
     
-uint32_t getUnix() {
-    int8_t my = (rtc.getMonth() >= 3) ? 1 : 0;
-    uint16_t y = (rtc.getYear()+2000) + my - 1970;
-    uint16_t dm = 0;
-    for (int i = 0; i < rtc.getMonth() - 1; i++) dm += (i<7)?((i==1)?28:((i&1)?30:31)):((i&1)?31:30);
-    return (((rtc.getDate()-1+dm+((y+1)>>2)-((y+69)/100)+((y+369)/100/4)+365*(y-my))*24ul+rtc.getHours())*60ul+rtc.getMinutes())*60ul+rtc.getSeconds();
-}
-
-uint32_t getUnix2(byte yr, byte mo, byte da, byte hh, byte mm, byte ss) {
-    int8_t my = (mo >= 3) ? 1 : 0;
-    uint16_t y = (yr+2000) + my - 1970;
-    uint16_t dm = 0;
-    for (int i = 0; i < mo - 1; i++) dm += (i<7)?((i==1)?28:((i&1)?30:31)):((i&1)?31:30);
-    return (((da-1+dm+((y+1)>>2)-((y+69)/100)+((y+369)/100/4)+365*(y-my))*24ul+hh)*60ul+mm)*60ul+ss;
-}
-
- void convertUnix(uint32_t t) { //Takes a unix number and stores various time values to timeIn[12]
-        t += 0 * 3600ul;
-        timeIn[5] = t % 60ul;   //Seconds stored in timeIn[5]
-        t /= 60ul;
-        timeIn[4] = t % 60ul;  //Minutes stored to timeIn[4]
-        t /= 60ul;
-        timeIn[3] = t % 24ul;  //Hours stored to timeIn[3]
-        t /= 24ul;
-        byte dayOfWeek = (t + 4) % 7;
-        if (!dayOfWeek) dayOfWeek = 7;
-        uint32_t z = t + 719468;
-        uint8_t era = z / 146097ul;
-        uint16_t doe = z - era * 146097ul;
-        uint16_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
-        uint16_t y = yoe + era * 400;
-        uint16_t doy = doe - (yoe * 365 + yoe / 4 - yoe / 100);
-        uint16_t mp = (doy * 5 + 2) / 153;
-        timeIn[1] = doy - (mp * 153 + 2) / 5 + 1;  //Day stored to timeIn[1]
-        uint8_t month = mp + (mp < 10 ? 3 : -9);            
-        timeIn[0] = month;  //Month stored to timeIn[0]
-        y += (month <= 2);
-        timeIn[2] = y; //Year stored to timeIn[2]
-    }
+uint32_t getUnix() {   // unix time from the clock registers last read by rtc.updateTime()
+    return calUnix(rtc.getYear() + 2000, rtc.getMonth(), rtc.getDate(), rtc.getHours(), rtc.getMinutes(), rtc.getSeconds());
+}
+
+uint32_t getUnix2(byte yr, byte mo, byte da, byte hh, byte mm, byte ss) {   // unix time of a date and time (yr = years after 2000)
+    return calUnix(yr + 2000, mo, da, hh, mm, ss);
+}
+
+void convertUnix(uint32_t t) { //Takes a unix number and stores month, day, year, hours, minutes and seconds to timeIn[0] to timeIn[5]
+    calTime(t, timeIn);
+}
 
 
 
@@ -728,6 +1448,10 @@ uint32_t getUnix2(byte yr, byte mo, byte da, byte hh, byte mm, byte ss) {
 
 //Enable the flash chip
 void flashOn(void) {              // Enable the flash chip
+  if(flashBusy) {                 // finish the last program or erase first
+    flashBusy = 0;
+    flashWait(3000);
+  }
   pinMode(FlashCS, OUTPUT);       // Chip select pin for Flash memory set to output
   digitalWrite(SDselect, HIGH);   // make sure the SD card select is off
   digitalWrite(FlashCS, LOW);     // activate Flash memory
@@ -742,75 +1466,144 @@ void flashOff(void) {           // Disable the flash chip
 }
 
 uint32_t writeFlash(unsigned long fLoc, char *cArr, uint16_t nchar) {  //write bytes in array; must send array, but can read single byte if nchar=1.
-  uint16_t addr = fLoc%528;                //calculate byte address
-  uint32_t wAddr = ((fLoc/528)<<10) + addr;  //calculate full flash address 
+  if(chip->nor) {return writeNOR(fLoc, cArr, nchar);}
+  uint16_t addr = fLoc%pgSize;             //calculate byte address
+  uint32_t wAddr = pageAddr(fLoc);        //calculate full flash address 
   flashOn();                               // activate flash chip
   SPI.transfer(0x58);                  // opcode for read modify write
   SPI.transfer((wAddr >> 16) & 0xFF);  // first of three address bytes
   SPI.transfer((wAddr >> 8) & 0xFF);   // second address byte
   SPI.transfer(wAddr & 0xFF);          // third address byte
-  if(nchar + addr <= 527) {            // If a page overflow will not happen write all the bytes
+  if(nchar + addr <= pgSize - 1) {     // If a page overflow will not happen write all the bytes
     for (int n = 0; n < nchar; n++) {  // loop through the bytes
       //serial.println(cArr[n], DEC);
       SPI.transfer(cArr[n]);           // write the byte
     }
   }
-  if(nchar + addr > 527) {                    // If a page overflow will happen write as many bytes as possible
+  if(nchar + addr > pgSize - 1) {             // If a page overflow will happen write as many bytes as possible
      //serial.println("page cross write");
-     for (int n = 0; n <= 527-addr; n++) {    // loop through the bytes
+     for (int n = 0; n <= pgSize-1-addr; n++) {    // loop through the bytes
         SPI.transfer(cArr[n]); 
 //        serial.println(cArr[n]);
         }
      flashOff();                            // turn off SPI
-     delay(30);                              // delay, In datasheet 4ms needed to complete write - in practice about 15, sometimes longer.
+     flashBusy = 1;                         // the next flashOn() waits for the write to finish
      //serial.println("crossing page boundary");
-     wAddr = ((fLoc/528)+1)<<10;            // calculate new flash address by advancing the page and setting byte address to 0
+     wAddr = pageAddr((fLoc/pgSize + 1) * pgSize);   // calculate new flash address by advancing the page and setting byte address to 0
      flashOn();
      SPI.transfer(0x58);                  // opcode for read modify write
      SPI.transfer((wAddr >> 16) & 0xFF);  // first of three address bytes
      SPI.transfer((wAddr >> 8) & 0xFF);   // second address byte
      SPI.transfer(wAddr & 0xFF);          // third address byte
-     for (int n = 528-addr; n < nchar; n++) {    // loop through the rest of the bytes
+     for (int n = pgSize-addr; n < nchar; n++) {    // loop through the rest of the bytes
         //serial.println(cArr[n]);
         SPI.transfer(cArr[n]);           // write bytes
         }         
   }
   flashOff();                            // turn off SPI
-  delay(20);
+  flashBusy = 1;                         // the write finishes in the background (the next flashOn() waits for it)
   return fLoc + nchar;                   // calculate next flash location
 }
 
+//writeFlash() for SPI NOR flash, which has no read-modify-write. Where only 1 bits change to 0 the bytes are simply
+//programmed. Otherwise the page is read, its block erased and the page programmed again - only that page of the
+//block is kept, so data that are changed this way (the settings in page 0) must have a block to themselves.
+uint32_t writeNOR(uint32_t fLoc, char *cArr, uint16_t nchar) {
+  char *pb = scratchTake(pgSize);        //page buffer
+  uint16_t done = 0;
+  while(done < nchar) {
+    uint32_t loc = fLoc + done;
+    uint32_t pg = loc / pgSize;
+    uint16_t addr = loc % pgSize;
+    uint16_t n = (nchar - done < pgSize - addr) ? nchar - done : pgSize - addr;   //bytes in this page
+    readFlash(pg * pgSize, pb, pgSize);
+    bool prog = 1;
+    for(uint16_t i = 0; i < n; i++) {
+      if((pb[addr+i] & cArr[done+i]) != cArr[done+i]) {prog = 0;}
+      pb[addr+i] = cArr[done+i];
+    }
+    if(prog) {
+      programFlash(loc, cArr + done, n);
+    } else {
+      eraseCmd(chip->blkOp, pg - pg % blkPgs);
+      programFlash(pg * pgSize, pb, pgSize);
+    }
+    done = done + n;
+  }
+  scratchGive(pb);
+  return fLoc + nchar;
+}
+
+//Flash address of a memory location: DataFlash addresses have the page number above the byte address
+//(page << pgShift), NOR flash addresses are the same as the memory location
+uint32_t pageAddr(uint32_t fLoc) {
+  if(chip->pgShift == 0) {return fLoc;}
+  return ((fLoc / pgSize) << chip->pgShift) + (fLoc % pgSize);
+}
+
+//Find out which flash chip is fitted (JEDEC ID) and set up the memory layout for it: the settings in page 0, the
+//log, then the RFID data ring to the end of the chip. An unknown chip is used as an AT45DB321E.
+void flashInit() {
+  char id[3];
+  flashOn();
+  SPI.transfer(0x9F);                      // opcode for manufacturer and device ID
+  for(uint8_t i = 0; i < 3; i++) {id[i] = SPI.transfer(0);}
+  flashOff();
+  chip = &chips[0];
+  bool found = 0;
+  for(uint8_t c = 0; c < sizeof(chips) / sizeof(chips[0]); c++) {
+    if(((uint8_t)id[0] == chips[c].id[0]) && ((uint8_t)id[1] == chips[c].id[1]) && ((uint8_t)id[2] == chips[c].id[2])) {
+      chip = &chips[c];
+      found = 1;
+    }
+  }
+  if(!found) {serial.println("Unknown flash memory chip - using AT45DB321E settings");}
+  serial.print("Flash memory: "); serial.println(chip->name);
+  pgSize = chip->pgSize;
+  blkPgs = chip->blkPgs;
+  blkSize = pgSize * blkPgs;
+  logStart = chip->nor ? blkSize : pgSize;
+  logUnit = chip->nor ? blkSize : pgSize;
+  cpyLoc = chip->nor ? 5 * blkSize : blkSize - pgSize;
+  logLast = logStart + ((cpyLoc - logStart) / 5 - 1) * 5;
+  datStart = chip->nor ? 6 * blkSize : blkSize;
+  firstBlk = datStart / blkSize;
+  lastBlk = chip->nPgs / blkPgs - 1;
+  curBlk = firstBlk;
+  jrnSlots = (pgSize - jrnStart) / jrnSlot;
+  if(jrnSlots > jrnMax) {jrnSlots = jrnMax;}
+}
+
 void readFlash(uint32_t fLoc, char *carr, uint16_t nchar) {  // read one or more bytes from flash memory; must send array, but can read single bytes
-  uint16_t addr = fLoc%528;                  //calculate byte address
-  uint32_t wAddr = ((fLoc/528)<<10) + addr;  //calculate full flash address
+  uint16_t addr = fLoc%pgSize;               //calculate byte address
+  uint32_t wAddr = pageAddr(fLoc);          //calculate full flash address
   flashOn();                                 // activate flash chip
   SPI.transfer(0x03);                        // opcode for low freq read
   SPI.transfer((wAddr >> 16) & 0xFF);        // first of three address bytes
   SPI.transfer((wAddr >> 8) & 0xFF);         // second address byte
   SPI.transfer(wAddr & 0xFF);                // third address byte
   //  if(nchar==1){carr[0] = SPI.transfer(0);}
-  if(nchar + addr <= 527) {                 // If a page overflow will not happen read all the bytes
+  if((nchar + addr <= pgSize) || chip->nor) {   // If a page overflow will not happen read all the bytes (NOR flash reads on across pages)
     for (int n = 0; n < nchar; n++) {
       carr[n] = SPI.transfer(0);            // read the byte
       //serial.println(carr[n]);
       }       
   }
-  if(nchar + addr > 527) {                    // If a page overflow will happen read as many bytes as possible
+  else {                                      // If a page overflow will happen read as many bytes as possible
     //serial.println("Page cross read.");
-    for (int n = 0; n <= 527-addr; n++) {
+    for (int n = 0; n <= pgSize-1-addr; n++) {
       carr[n] = SPI.transfer(0);
       //serial.println(carr[n]); 
       }
     //serial.println("crossing page boundary");
     flashOff();                            // turn off SPI
-    delay(15);
-    wAddr = ((fLoc/528)+1)<<10;            // calculate new flash address by advancing the page and leaving byte address at 0
+    wAddr = pageAddr((fLoc/pgSize + 1) * pgSize);   // calculate new flash address by advancing the page and leaving byte address at 0
     flashOn();
     SPI.transfer(0x03);                  // opcode for read modify write
     SPI.transfer((wAddr >> 16) & 0xFF);  // first of three address bytes
     SPI.transfer((wAddr >> 8) & 0xFF);   // second address byte
     SPI.transfer(wAddr & 0xFF);          // third address byte
-    for (int n = 528-addr; n < nchar; n++) {    // loop through the rest of the bytes
+    for (int n = pgSize-addr; n < nchar; n++) {    // loop through the rest of the bytes
         carr[n] = SPI.transfer(0);       // read byte
         //serial.println(carr[n]);
     }                                      
@@ -818,6 +1611,91 @@ void readFlash(uint32_t fLoc, char *carr, uint16_t nchar) {  // read one or more
 flashOff(); 
 }
 
+//Program bytes into blank (erased) flash without erasing the rest of the page. Bytes must all be on one page.
+void programFlash(uint32_t fLoc, char *cArr, uint16_t nchar) {
+  uint32_t wAddr = pageAddr(fLoc);        //calculate full flash address
+  writeEnable();
+  flashOn();                               // activate flash chip
+  SPI.transfer(0x02);                      // opcode for byte/page program through buffer 1 without built-in erase (page program on NOR flash)
+  SPI.transfer((wAddr >> 16) & 0xFF);      // first of three address bytes
+  SPI.transfer((wAddr >> 8) & 0xFF);       // second address byte
+  SPI.transfer(wAddr & 0xFF);              // third address byte
+  for (uint16_t n = 0; n < nchar; n++) {   // loop through the bytes
+    SPI.transfer(cArr[n]);                 // write the byte
+  }
+  flashOff();                              // turn off SPI - programming starts now
+  flashBusy = 1;                           // page program time is about 3 ms (the next flashOn() waits for it)
+  evCount[evProgram]++;
+}
+
+//Wait up to maxMs milliseconds for the flash chip to finish programming or erasing (status register bit 7 is
+//set when the chip is ready). Returns 0 if it is still busy.
+bool flashWait(uint32_t maxMs) {
+  uint32_t t0 = millis();
+  uint32_t u0 = micros();
+  bool rdy = 1;
+  flashOn();
+  SPI.transfer(chip->nor ? 0x05 : 0xD7);   // opcode for status register read - the status is sent over and over
+  while(chip->nor ? (SPI.transfer(0) & 0x01) : !(SPI.transfer(0) & 0x80)) {   // NOR: bit 0 set while busy; DataFlash: bit 7 set when ready
+    if(millis() - t0 > maxMs) {
+      rdy = 0;
+      break;
+    }
+  }
+  flashOff();
+  uint32_t us = micros() - u0;
+  stTime[stFlashWait] += us;
+  return rdy;
+}
+
+//Send the write enable command that NOR flash needs before each program or erase (DataFlash does not use it)
+void writeEnable() {
+  if(!chip->nor) {return;}
+  flashOn();
+  SPI.transfer(0x06);
+  flashOff();
+}
+
+//Start an erase of the unit holding page pg: op = 0x81 (page, DataFlash only), chip->blkOp (block) or chip->secOp
+//(sector; DataFlash sector 0 is split into the first block and the rest). The chip erases in the background (the
+//next flashOn() waits for it).
+void eraseCmd(uint8_t op, uint32_t pg) {
+  uint32_t a = pageAddr(pg * pgSize);
+  writeEnable();
+  flashOn();
+  SPI.transfer(op);
+  SPI.transfer((a >> 16) & 0xFF);          // first of three address bytes
+  SPI.transfer((a >> 8) & 0xFF);           // second address byte
+  SPI.transfer(a & 0xFF);                  // third address byte
+  flashOff();                              // erasing starts now
+  flashBusy = 1;
+  evCount[evErase]++;
+  rdPg = 0xFFFFFFFF;                       // page buffer may hold an erased page
+}
+
+//Erase pages pg1 to pg2 with as few erase commands as possible: whole sectors, then whole blocks, then single pages
+//(NOR flash cannot erase single pages, so its ranges must be whole blocks). Returns the number of erase commands used.
+uint16_t eraseRange(uint32_t pg1, uint32_t pg2) {
+  uint16_t n = 0;
+  uint32_t pg = pg1;
+  uint16_t sp = chip->secPgs;
+  while(pg <= pg2) {
+    uint32_t secEnd = pg - pg % sp + sp - 1;                // last page of the sector holding pg
+    if(((pg % sp == 0) || (!chip->nor && (pg == blkPgs))) && (secEnd <= pg2)) {   // (DataFlash sector 0b starts after the first block)
+      eraseCmd(chip->secOp, pg);
+      pg = secEnd + 1;
+    } else if((pg % blkPgs == 0) && (pg + blkPgs - 1 <= pg2)) {
+      eraseCmd(chip->blkOp, pg);
+      pg = pg + blkPgs;
+    } else {
+      if(!chip->nor) {eraseCmd(0x81, pg);}
+      pg++;
+    }
+    n++;
+  }
+  return n;
+}
+
 // Input the device ID and write it to flash memory
 void inputID(uint32_t writeAddr) {                                         // Function to input and set feeder ID
   serial.println("Enter four alphanumeric characters");  // Ask for user input
@@ -827,70 +1705,125 @@ void inputID(uint32_t writeAddr) {                                         // Fu
     deviceID[1] = cArray1[1];
     deviceID[2] = cArray1[2];
     deviceID[3] = cArray1[3];
-    writeFlash(writeAddr, deviceID, 4);                 // Write the array to flash
+    writePage0(writeAddr, deviceID, 4);                 // Write the array to flash
   } else {
     serial.println("Invalid ID entered");                // error message if the string is the wrong lenth
   }
 }
 
 void getLogMessage(uint8_t x1) {
-  //serial.print(x1);
   // "Logging_started" = 11
   // "Going_to_sleep_" = 12
   // "Wake_from_sleep" = 13
-  
-  if(x1 == 11) {
-    logMess[0]='L'; logMess[1]='o'; logMess[2]='g'; logMess[3]='g'; logMess[4]='i'; 
-    logMess[5]='n'; logMess[6]='g'; logMess[7]='_'; logMess[8]='s'; logMess[9]='t'; 
-    logMess[10]='a'; logMess[11]='r'; logMess[12]='t'; logMess[13]='e'; logMess[14]='d';
-    logMess[15]='\0';}
-  if(x1 == 12) {
-    logMess[0]='G'; logMess[1]='o'; logMess[2]='i'; logMess[3]='n'; logMess[4]='g'; 
-    logMess[5]='_'; logMess[6]='t'; logMess[7]='o'; logMess[8]='_'; logMess[9]='s'; 
-    logMess[10]='l'; logMess[11]='e'; logMess[12]='e'; logMess[13]='p'; logMess[14]='_';
-    logMess[15]='\0';}
-  if(x1 == 13) {
-    logMess[0]='W'; logMess[1]='a'; logMess[2]='k'; logMess[3]='e'; logMess[4]='_'; 
-    logMess[5]='f'; logMess[6]='r'; logMess[7]='o'; logMess[8]='m'; logMess[9]='_'; 
-    logMess[10]='s'; logMess[11]='l'; logMess[12]='e'; logMess[13]='e'; logMess[14]='p';
-    logMess[15]='\0';}
+  // "Data_overwrite_" = 14
+  // "Clock_error____" = 15
+  // "Energy_report__" = 16
+  // "Used_charge_mAh" = 17 ... "Flash_writes___" = 21 (figures of the power report, see energyLog())
+  const char *m = logText(x1);   //(an unknown code leaves the last message)
+  if(m) {strcpy(logMess, m);}
+}
+
+//Text of a log line: the message and the time, or the message and the figure for the codes of logHasValue()
+void logLineText(uint8_t code, uint32_t v, char *text) {
+  getLogMessage(code); //Log message gets loaded into logMess
+  if(logHasValue(code)) {
+    formatLogValue(logMess, v, text);
+  } else {
+    convertUnix(v);    // covert unix time. Time values get stored in array timeIn, bytes 0 through 5.
+    formatLogLine(logMess, timeIn, text);
+  }
+}
+
+//Write a log line (event code and current time) to flash, and to the SD card in logging mode S.
+void logEvent(uint8_t code) {
+  logRecord(code, clockNow());
+}
+
+//Write a log line with v in the 4 bytes of the time: the current time, or a figure for the codes of logHasValue()
+void logRecord(uint8_t code, uint32_t v) {
+  flushSDQueue();                                   //queued RFID lines go to the SD card first (before sleeping, for example)
+  unixTime.unixLong = v;
+  char lg[5] = {code, unixTime.b1, unixTime.b2, unixTime.b3, unixTime.b4};
+  uint32_t loc = logWrap(logLoc);                   //After logLast the ring goes round to logStart
+  uint16_t u = logUnitOf(loc + 4);
+  if((logLoc == logStart) || (u != logUnitOf(logLoc - 1))) {   //First line to reach this unit: erase the one after it
+    eraseLogUnit(u);                                //(only a log left full by earlier firmware has no erased unit)
+    eraseLogUnit((u + 1) % logUnits());
+  }
+  bool synced = (logExp == logLoc);                 //SD card log is up to date before this line
+  uint16_t k = pgSize - (loc + 1) % pgSize;         //The line goes into erased flash: the time first...
+  if(k > 4) {k = 4;}
+  programFlash(loc + 1, lg + 1, k);
+  if(k < 4) {programFlash(loc + 1 + k, lg + 1 + k, 4 - k);}   //(the rest of it in the next page)
+  programFlash(loc, lg, 1);                         //...then the code, so a line cut short by a power failure has none
+  logLoc = loc + 5;
+  if(SDOK == 1 && logMode == 'S') {                 // save log message if SD writes are enabled
+    if(writeSDLine(logFile, code, lg) && synced) {logExp = logLoc;}
+  }
+  saveMemLoc();                                     //update the memory pointer journal
+  if(synced && (logExp == logLoc) && (SDOK == 1)) {
+    saveSyncState();
+    SDstop();
+  }
 }
 
 
 
 void eraseBackup(char eMode) {  //erase chip and replace stored info
+  uint32_t tm = millis();
   if(eMode == 'a') {   //Erase absolutely everything
-    serial.println("This will take 80 seconds");
+    serial.println("This will take about 80 seconds");
+    writeEnable();
     flashOn();
-    SPI.transfer(0xC7);  // opcode for chip erase: C7h, 94h, 80h, and 9Ah
-    SPI.transfer(0x94);    
-    SPI.transfer(0x80);    
-    SPI.transfer(0x9A);             
-    digitalWrite(FlashCS, HIGH);    //Deassert cs for process to start 
-    delay(80000);
-    flashOff();                         // Turn off SPI
-    serial.println("DONE!");
+    SPI.transfer(0xC7);  // opcode for chip erase: C7h, 94h, 80h, and 9Ah (just C7h on NOR flash)
+    if(!chip->nor) {
+      SPI.transfer(0x94);    
+      SPI.transfer(0x80);    
+      SPI.transfer(0x9A);             
+    }
+    flashOff();                         // Deassert cs for process to start 
+    if(!flashWait(240000)) {serial.println("Flash memory did not finish erasing");}   // up to 208 s in the datasheet
+    rdPg = 0xFFFFFFFF;
+    char rm[1] = {ringMark};
+    programFlash(ringByte, rm, 1);       // (page 7 holds no log lines)
+    serial.print("DONE! ("); serial.print((millis() - tm) / 1000, DEC); serial.println(" s)");
     serial.println("You must now reestablish all parameters");
     return;
   } 
   if(eMode == 'm') {  //Erase tag data only using memLoc as limit
-    //uint16_t startPage = 8; 
-    uint16_t endPage = (memLoc / 528) + 1;
-    for(uint16_t i=1; i <= endPage; i++) {
-      uint32_t pg = i << 10;
-      serial.print("Erasing Page ");
-      serial.println(i, DEC);
-      flashOn();
-      SPI.transfer(0x81);                    // opcode for page erase: 0x81
-      SPI.transfer((pg >> 16) & 0xFF);    // first of three address bytes
-      SPI.transfer((pg >> 8) & 0xFF);     // second address byte
-      SPI.transfer(pg & 0xFF);            // third address byte
-      digitalWrite(FlashCS, HIGH);           // Deassert cs for process to start 
-      delay(200);                             // delay for page erase
-      flashOff();
-    }
-    memLoc=datStart;     // reset memory addresses
+    serial.println("Erasing flash memory");
+    uint16_t nCmd;
+    if(!ringMem) {
+      nCmd = eraseRange(logStart / pgSize, (memLoc / pgSize) + 1);     //Log pages and old-style data
+    } else {
+      nCmd = eraseRange(logStart / pgSize, (datStart / pgSize) - 1);   //Log pages...
+      uint16_t sb = chip->secPgs / blkPgs;    //blocks per sector
+      for(uint16_t s = firstBlk / sb; s <= lastBlk / sb; s++) {   //...and the blocks in the ring that have been used, a sector at a time
+        uint16_t b1 = (s * sb < firstBlk) ? firstBlk : s * sb;
+        uint16_t b2 = (s * sb + sb - 1 > lastBlk) ? lastBlk : s * sb + sb - 1;
+        uint16_t nUsed = 0;
+        for(uint16_t i = b1; i <= b2; i++) {nUsed += !blockBlank(i);}
+        if(nUsed == b2 - b1 + 1) {           //A full sector is erased with one command (about 700 ms vs 45 ms per block)...
+          nCmd += eraseRange((uint32_t)b1 * blkPgs, (uint32_t)b2 * blkPgs + blkPgs - 1);
+        } else {                             //...otherwise just the used blocks
+          for(uint16_t i = b1; i <= b2; i++) {
+            if(!blockBlank(i)) {
+              eraseBlock(i);
+              nCmd++;
+            }
+          }
+        }
+      }
+    }
+    flashWait(3000);
+    serial.print(nCmd, DEC); serial.print(" erase commands, "); serial.print(millis() - tm, DEC); serial.println(" ms");
+    ringMem = 1;         // memory is now empty, so use the ring layout from here on
     logLoc=logStart;     // reset memory addresses
+    logExp=logStart;
+    openBlock(firstBlk); // start the ring over at the first block (this also records the reset in the memory pointer journal)
+    eraseDue = 0;        // the rest of the ring is already erased
+    expLoc = memLoc;     // nothing left to transfer
+    saveMemLoc();
   }
 }
 
@@ -917,20 +1850,297 @@ void showFlash (uint32_t fStart, uint32_t fEnd) {
 }
 
 
-void appendMemLog() { //// Read in last log line on SD card. Find matching line in Flash, Write remaining data to SD.
-  char SDArray[37];   // Array with 250 bytes
-  for(uint8_t i = 0; i < 250; i++) {SDArray[i] = 0xFF;} //initialize array.
+//Bring the data and log files on the SD card up to date. The sync file on the card records how far each file is
+//up to date (see saveSyncState()), so only the new data are written. If the files have grown since the sync file
+//was written, or there is no sync file that fits the files and the flash memory, the last lines of the files are
+//matched with the flash data instead (from the locations in the sync file, if there is one).
+void syncSD() {
+  uint32_t eLoc, lLoc;
+  uint8_t st = readSyncState(&eLoc, &lLoc);
+  if(st == 1) {
+    serial.println("SD card sync file found - appending new data");
+    if(ringLoc(eLoc) == memLoc) {
+      serial.println("RFID Data up to date, no data transfer needed.");
+      if(expLoc != memLoc) {
+        expLoc = memLoc;
+        overwriting = 0;
+        saveMemLoc();
+      }
+    } else {
+      extractMemRFID(3, eLoc);
+    }
+    if(lLoc == logLoc) {
+      serial.println("Log Data up to date, no data transfer needed.");
+      logExp = logLoc;
+    } else {
+      extractMemLog(3, lLoc);
+    }
+  } else if(st == 2) {
+    serial.println("SD card files changed since the sync file - matching their last lines from there");
+    appendMemRFID(eLoc);
+    appendMemLog(lLoc);
+  } else {
+    serial.println("No SD card sync file (or it is out of date) - matching the last lines on the SD card");
+    appendMemRFID(firstDataLoc());
+    appendMemLog(logFirst());
+  }
+  SDstop();                                   //(the transfers leave the card powered)
+}
+
+//Read the sync file on the SD card into *eLoc (RFID data on the card end here) and *lLoc (log data on the card end
+//here), from the newer of its two complete records (CRC) that belong to this reader. Returns 0 if there is none,
+//or the flash block holding *eLoc no longer has the sequence number it records (the flash memory has been erased
+//or the data there written over since), or the data or log file is shorter than it records. Returns 1 if the
+//files are the size it records and 2 if they have grown (a transfer, or the record written after it, was cut
+//short): the data up to *eLoc and *lLoc are on the card, and maybe some more.
+uint8_t readSyncState(uint32_t *eLoc, uint32_t *lLoc) {
+  char st[100];
+  uint32_t v[7];                          //record number, expLoc, block sequence, logExp, data file size, log file size, CRC
+  uint32_t best[7] = {0, 0, 0, 0, 0, 0, 0};
+  bool found = 0;
+  SDstart();
+  File f = SD.open(syncFile, FILE_READ);
+  if(!f) {return 0;}
+  for(uint8_t r = 0; r < 2; r++) {
+    uint8_t n = 0;
+    if(f.seek(r * syncSlot)) {
+      while(f.available() && (n < sizeof(st) - 1)) {
+        st[n] = f.read();
+        if(st[n] == '\r') {break;}
+        n++;
+      }
+    }
+    st[n] = 0;
+    if(parseSync(st, v) && (!found || (v[0] > best[0]))) {
+      memcpy(best, v, sizeof(v));
+      found = 1;
+    }
+  }
+  f.close();
+  if(!found) {return 0;}
+  syncCount = best[0];
+  uint32_t dLen = sdFileSize(dataFile);
+  uint32_t lLen = sdFileSize(logFile);
+  if((dLen < best[4]) || (lLen < best[5])) {return 0;}
+  if(!logHolds(best[3]) || (logBytes(best[3]) < logBytes(logExp))) {return 0;}   //(behind logExp: the log has gone round since)
+  if(ringMem) {
+    uint32_t seq;
+    uint16_t b = (best[1] - 1) / blkSize; //(a location at the very end of a block belongs to that block)
+    if((best[1] <= datStart) || (b > lastBlk) || !readBlkHdr(b, &seq) || (seq != best[2])) {return 0;}
+  } else {
+    if((best[1] < datStart) || (best[1] > memLoc)) {return 0;}
+  }
+  *eLoc = best[1];
+  *lLoc = best[3];
+  return ((dLen == best[4]) && (lLen == best[5])) ? 1 : 2;
+}
+
+//Check one record of the sync file (the text in st) and get its numbers into v. Returns 0 unless it is complete
+//(CRC) and belongs to this reader.
+bool parseSync(char *st, uint32_t *v) {
+  char *c = st;
+  if(strncmp(c, "ETAG2,", 6) != 0) {return 0;}
+  c = c + 6;
+  if(strncmp(c, deviceID, 4) != 0) {return 0;}
+  c = c + 4;
+  char *crcEnd = c;
+  for(uint8_t i = 0; i < 7; i++) {
+    if(*c != ',') {return 0;}
+    crcEnd = c;
+    c++;
+    v[i] = strtoul(c, &c, (i == 6) ? 16 : 10);
+  }
+  return v[6] == crc16k(0x0000, (uint8_t*)st, crcEnd - st);
+}
+
+//Write the sync file: how far the SD card data and log files are up to date (expLoc and logExp), the sequence
+//number of the flash block holding expLoc, and the sizes of the two files. The file has two records of syncSlot
+//bytes, written in turn in place, so a power failure while one is written leaves the other. A record is a line
+//of text padded with spaces:
+//ETAG2,<ID>,<record number>,<expLoc>,<block sequence>,<logExp>,<data file size>,<log file size>,<CRC of the text before it>
+void saveSyncState() {
+  if(SDOK != 1) {return;}
+  char st[100];
+  const uint8_t spN = 16;
+  char sp[spN];                                   //(spaces)
+  memset(sp, ' ', spN);
+  uint32_t seq = 0;
+  if(ringMem) {readBlkHdr((expLoc - 1) / blkSize, &seq);}
+  SDstart();
+  syncCount++;
+  uint32_t v[6] = {syncCount, expLoc, seq, logExp, sdFileSize(dataFile), sdFileSize(logFile)};
+  char *p = st;
+  memcpy(p, "ETAG2,", 6); p += 6;
+  for(uint8_t i = 0; (i < 4) && deviceID[i]; i++) {*p++ = deviceID[i];}
+  for(uint8_t i = 0; i < 6; i++) {
+    *p++ = ',';
+    p = putDec32(p, v[i]);
+  }
+  uint16_t crc = crc16k(0x0000, (uint8_t*)st, p - st);
+  *p++ = ',';
+  p = putHex2(putHex2(p, crc >> 8), crc & 0xFF);
+  uint8_t n = p - st;
+  File f = SD.open(syncFile, O_RDWR | O_CREAT);   //(not FILE_WRITE, which always writes at the end of the file)
+  if(!f) {return;}
+  if(f.size() < 2 * syncSlot) {                   //A new file: two blank records
+    f.seek(0);
+    for(uint8_t r = 0; r < 2; r++) {
+      for(uint16_t i = 0; i < syncSlot - 2; i = i + spN) {
+        uint16_t k = syncSlot - 2 - i;
+        f.write((uint8_t*)sp, (k < spN) ? k : spN);
+      }
+      f.write((uint8_t*)"\r\n", 2);
+    }
+  }
+  f.seek((syncCount & 1) * syncSlot);
+  f.write((uint8_t*)st, n);
+  for(uint8_t i = n; i < sizeof(st); i = i + spN) {   //(spaces over the end of a longer record)
+    uint8_t k = sizeof(st) - i;
+    f.write((uint8_t*)sp, (k < spN) ? k : spN);
+  }
+  f.close();
+}
+
+//Set the names of the SD card files from the device ID and the file format of the data and log files
+void setFileNames() {
+  makeFileName(logFile, binFmt ? "LOG.BIN" : "LOG.TXT");
+  makeFileName(dataFile, binFmt ? "DATA.BIN" : "DATA.TXT");
+  makeFileName(queryFile, "QRY.TXT");
+  makeFileName(syncFile, "SYNC.TXT");
+}
+
+//SD card file name: the 4-character device ID followed by ending (fName needs 13 characters)
+void makeFileName(char *fName, const char *ending) {
+  memcpy(fName, deviceID, 4);
+  strcpy(fName + 4, ending);
+}
+
+//Open a binary SD card file for adding records: a new file gets the 16-byte header, otherwise the record count is
+//read from the header. The file is left at its end. Header: "ETAG", format version (1), file type ('D' for RFID
+//data - old-style lines of 10 or 12 bytes, 'L' for log lines of 5 bytes), device ID (4 bytes), number of
+//records (4 bytes, least significant byte first) and 2 unused bytes. tools/etagbin.c converts the files to text.
+//A new file is given room for reserve bytes with sdReserve() before the header is written.
+File openBin(const char *fName, char type, uint32_t *nRec, uint32_t reserve) {
+  File f = SD.open(fName, O_RDWR | O_CREAT);   //(not FILE_WRITE, which always writes at the end of the file)
+  *nRec = 0;
+  if(!f) {return f;}
+  char hd[16];
+  if(f.size() < 16) {
+    sdReserve(f, reserve);
+    hd[0] = 'E'; hd[1] = 'T'; hd[2] = 'A'; hd[3] = 'G'; hd[4] = 1; hd[5] = type;
+    for(uint8_t i = 0; i < 4; i++) {hd[6+i] = deviceID[i];}
+    for(uint8_t i = 10; i < 16; i++) {hd[i] = 0;}
+    f.seek(0);
+    bool ok = (f.write((uint8_t*)hd, 16) == 16);   //(the file was shorter than a header, so it now ends here)
+    if(!ok) {f.close();}                   //(a full card: the file is given back closed)
+  } else {
+    f.seek(10);
+    f.read(hd, 4);
+    *nRec = ((uint32_t)(uint8_t)hd[3] << 24) + ((uint32_t)(uint8_t)hd[2] << 16) + ((uint32_t)(uint8_t)hd[1] << 8) + (uint8_t)hd[0];
+    f.seek(f.size());
+  }
+  return f;
+}
+
+//Write the record count into the header of a binary file and close it. Returns 0 if a write to the file failed.
+bool closeBin(File &f, uint32_t nRec) {
+  char n[4] = {(char)nRec, (char)(nRec >> 8), (char)(nRec >> 16), (char)(nRec >> 24)};
+  if(!f) {return 0;}
+  f.seek(10);
+  bool ok = (f.write((uint8_t*)n, 4) == 4);
+  return sdClose(f) && ok;
+}
+
+//Get the last record of a binary SD card file (records are read from the start, as RFID lines vary in length).
+//A file that ends in part of a record (a power failure while records were added) is cut back to its last whole
+//record, and the record count in the header is corrected, so new records go on after it. Returns the record
+//length, 0 if the file has no records, or binBad if it is not a binary file of this type or cannot be repaired.
+//The file itself is never removed.
+uint8_t lastBinRecord(const char *fName, char type, char *rec) {
+  File f = SD.open(fName, FILE_READ);
+  if(!f) {return binBad;}
+  uint32_t fLen = f.size();
+  uint32_t pos = 16;                     //end of the whole records
+  uint32_t nRec = 0;                     //number of whole records
+  uint8_t n = 0;
+  char hd[14];
+  f.read(hd, 14);
+  if((fLen < 16) || (hd[0] != 'E') || (hd[4] != 1) || (hd[5] != type)) {
+    f.close();
+    return binBad;
+  }
+  uint32_t hdRec = ((uint32_t)(uint8_t)hd[13] << 24) + ((uint32_t)(uint8_t)hd[12] << 16) + ((uint32_t)(uint8_t)hd[11] << 8) + (uint8_t)hd[10];
+  if(type == 'L') {                      //Log lines are all 5 bytes
+    nRec = (fLen - 16) / 5;
+    pos = 16 + nRec * 5;
+    if(nRec > 0) {n = 5;}
+  } else {
+    char *buf = scratchTake(512);
+    while(pos < fLen) {                  //Step through the records a buffer at a time - only the first byte of each is needed
+      f.seek(pos);
+      uint16_t m = f.read(buf, 512);
+      if(m == 0) {break;}
+      uint16_t i = 0;
+      while(i < m) {
+        uint8_t k = (buf[i] & 0x80) ? 12 : 10;
+        if(pos + i + k > fLen) {break;}  //part of a record at the end of the file
+        n = k;
+        nRec++;
+        i = i + k;
+      }
+      pos = pos + i;
+      if(i < m) {break;}
+    }
+    scratchGive(buf);
+  }
+  if(n > 0) {
+    f.seek(pos - n);
+    f.read(rec, n);
+  }
+  f.close();
+  if((pos != fLen) || (hdRec != nRec)) {
+#if USE_SDFAT
+    f = SD.open(fName, O_RDWR);
+    if(!f) {return binBad;}
+    serial.print(fName); serial.print(": cut back to "); serial.print(nRec); serial.println(" whole records");
+    bool ok = f.truncate(pos);
+    if(!closeBin(f, nRec) || !ok) {return binBad;}
+#else
+    if(pos != fLen) {                    //(the standard SD library cannot make a file shorter)
+      serial.print(fName); serial.println(" ends in part of a record - copy it off the card and remove it");
+      return binBad;
+    }
+    f = SD.open(fName, O_RDWR);
+    if(!f) {return binBad;}
+    if(!closeBin(f, nRec)) {return binBad;}
+#endif
+  }
+  return n;
+}
+
+//Size of a file on the SD card (0 if it does not exist)
+uint32_t sdFileSize(const char *fName) {
+  File f = SD.open(fName, FILE_READ);
+  if(!f) {return 0;}
+  uint32_t n = f.size();
+  f.close();
+  return n;
+}
+
+void appendMemLog(uint32_t lStart) { //// Read in last log line on SD card. Find matching line in Flash (from lStart, which the card has up to), Write remaining data to SD.
+  char SDArray[37];   // Array for the last SD card line
+  for(uint8_t i = 0; i < sizeof(SDArray); i++) {SDArray[i] = 0xFF;} //initialize array.
   char logLine[5];     //
-  char flashArr[500]; //large array for reading flash data.
   uint32_t startPos = 0;    // start position for matching lines.
   uint32_t posSD = 0;  // SD card file position
   uint32_t fLen;       // length of SD card file
   uint32_t fLoc;       // flash data location
+  uint8_t back = 0;    // power report figures after the line matched (see below)
   
   File myfile;     // for reading from SD
 
   //First check make sure flash log has at least one line of data
-  if((logLoc - logStart) < 3) {
+  if(logLoc == logStart) {
     serial.println("No log data to transfer");
     return;
   }
@@ -940,72 +2150,115 @@ void appendMemLog() { //// Read in last log line on SD card. Find matching line
     SDstart();
     if (!SD.exists(logFile)) {
       serial.println("No log file detected on SD card, need to make new SD file");
-      extractMemLog(3, logStart);  //dump all data to sd card here....
+      extractMemLog(3, logFirst());  //dump all data to sd card here....
       return;
     }
     if (SD.exists(logFile)) {
-      myfile = SD.open(logFile, FILE_READ);
-      fLen = myfile.size();
-      if(fLen < 38) { //no data or corrupt data in file, erase file and write all flash memory
-        myfile.close();               //Close file 
-        SD.remove(logFile);           //Delete the file that may have bad data
-        extractMemRFID(3, logStart);  //Write all flash data to new file
-        return;
+      if(binFmt) {                      //Binary file: the last raw log line
+        uint8_t n = lastBinRecord(logFile, 'L', logLine);
+        if(n == binBad) {               //not a log file that can be added to - leave it alone
+          serial.println("Log file on SD card can't be added to - no data transfer");
+          return;
+        }
+        if(n == 0) {                    //no data in file, write all flash memory
+          extractMemLog(3, logFirst());
+          return;
+        }
+        if(logHasValue(logLine[0])) {   //(see below)
+          myfile = SD.open(logFile, FILE_READ);
+          uint32_t pos = 16 + ((myfile.size() - 16) / 5 - 1) * 5;
+          while(logHasValue(logLine[0]) && (pos > 16) && (back < 5)) {
+            pos -= 5;
+            back++;
+            myfile.seek(pos);
+            myfile.read(logLine, 5);
+          }
+          myfile.close();
+        }
+      } else {
+        myfile = SD.open(logFile, FILE_READ);
+        fLen = myfile.size();
+        if(fLen < 38) { //no whole line in file, write all flash memory after it
+          myfile.close();               //Close file 
+          extractMemLog(3, logFirst());   //Write all flash data
+          return;
+        }
+        if((fLen > 35) && fLen < 75) { posSD = 0; }  // only one line. SD card file position for first line
+        if(fLen >= 75) { posSD = fLen - 38; }
+        //serial.print("file length: "); serial.println(fLen , DEC);
+        //serial.print("getting last line from: "); serial.println(posSD, DEC);
+        myfile.seek(posSD);
+
+        for(uint8_t i = 0; i < 37; i++) {
+          SDArray[i] = myfile.read();
+          }      
+        compressLogLine(SDArray, logLine);
+        //The figures of a power report (codes 17-21) repeat (0 reads stored, the same mAh), so they are not matched:
+        //the dated line before them is, and the figures after it are counted in back
+        while(logHasValue(logLine[0]) && (posSD >= 38) && (back < 5)) {
+          posSD -= 38;
+          back++;
+          myfile.seek(posSD);
+          for(uint8_t i = 0; i < 37; i++) {SDArray[i] = myfile.read();}
+          compressLogLine(SDArray, logLine);
+        }
+        myfile.close();
       }
-      if((fLen > 35) && fLen < 75) { posSD = 0; }  // only one line. SD card file position for first line
-      if(fLen >= 75) { posSD = fLen - 38; }
-      //serial.print("file length: "); serial.println(fLen , DEC);
-      //serial.print("getting last line from: "); serial.println(posSD, DEC);
-      myfile.seek(posSD);
-
-      for(uint8_t i = 0; i < 37; i++) {
-        SDArray[i] = myfile.read();
-        }      
-      compressLogLine(SDArray, logLine);
 
 
       //now seek to match logLine with data in flash
-      fLoc = logStart;                 //Start at beginning of log data
+      fLoc = logWrap(lStart);          //Start where the card is known to be up to (or the oldest log line)
       //serial.print("fLoc: "); serial.println(fLoc, DEC);
-      uint16_t fA1 = 0;
-      while((fLoc < logLoc) && (startPos == 0)) {
+      char *flashArr = scratchTake(logBatch);   //batch of flash data (given back before the transfer, which needs the arena)
+      uint8_t found = 2;               //1 = matching line found, 2 = end of flash data without a match
+      uint32_t nLeft = logBytes(lStart);
+      while(nLeft > 0) {
         //serial.println("Reading flash");
-        readFlash(fLoc, flashArr, 500);
-        for(fA1 = 0; fA1 < 495; fA1 = fA1 + 5) {
-           //serial.print("Matching "); serial.print(flashArr[fA1], HEX); serial.print(flashArr[fA1+1], HEX); serial.print(flashArr[fA1+2], HEX); serial.print(flashArr[fA1+3], HEX); serial.println(flashArr[fA1+4], HEX);
-           //serial.print("with "); serial.print(logLine[0], HEX); serial.print(logLine[1], HEX); serial.print(logLine[2], HEX); serial.print(logLine[3], HEX); serial.println(logLine[4], HEX);
+        uint32_t n = logLast + 5 - fLoc;   //(a batch stops at the end of the ring)
+        if(n > nLeft) {n = nLeft;}
+        if(n > logBatch) {n = logBatch;}
+        readFlash(fLoc, flashArr, n);
+        for(uint16_t fA1 = 0; fA1 < n; fA1 = fA1 + 5) {
            if((logLine[0]==flashArr[fA1]) && (logLine[1]==flashArr[fA1+1]) && (logLine[2]==flashArr[fA1+2]) && (logLine[3]==flashArr[fA1+3]) && (logLine[4]==flashArr[fA1+4])) {
               startPos = fLoc + fA1 + 5;  //Add five to get to next line.
-              serial.print("Matching log data found on SD card. ");
-              if(startPos >= logLoc) {
-                serial.println("Log Data up to date, no data transfer needed.");
-                return; 
-              }
-              serial.print("Appending new data starting at "); serial.println(startPos, DEC);
-              extractMemLog(3, startPos);
-              return;
+              found = 1;
+              break;
            }
-           if(flashArr[fA1]==0xFF) {
-              serial.print("end of flash data - no match - append everything."); 
-              extractMemLog(3, logStart);
-              return;
-           }
-           
         }
-        fLoc = fLoc + fA1;
+        if(found == 1) {break;}
+        nLeft = nLeft - n;
+        fLoc = logWrap(fLoc + n);
         //serial.print("fLoc is now "); serial.println(fLoc, DEC);
       }
+      scratchGive(flashArr);
+      if(found == 1) {
+        for(uint8_t i = 0; i < back; i++) {startPos = logWrap(startPos) + 5;}   //(the figures after the line matched)
+        serial.print("Matching log data found on SD card. ");
+        if(startPos == logLoc) {
+          serial.println("Log Data up to date, no data transfer needed.");
+          logExp = logLoc;             //(the card was read back: its last line is the last one in flash)
+          saveMemLoc();
+          saveSyncState();
+          return;
+        }
+        serial.print("Appending new data starting at "); serial.println(startPos, DEC);
+        extractMemLog(3, startPos);
+      }
+      if(found == 2) {
+        serial.print("end of flash data - no match - appending the log from "); serial.println(lStart, DEC);
+        extractMemLog(3, lStart);
+      }
     }
   }
 }
 
 
 
-void appendMemRFID() { // Read in last line from SD card. Find matching line in Flash, Write remaining data to SD.
+void appendMemRFID(uint32_t fStart) { // Read in last line from SD card. Find matching line in Flash (from fStart, which the card has up to), Write remaining data to SD.
   //serial.println("Appending RFID data to SD card.");
-  char SDArray[50];   // Array with 250 bytes
-  for(uint8_t i = 0; i < 250; i++) {SDArray[i] = 0xFF;} //initialize array.
-  char flashArr[500]; //large array for reading flash data.
+  char SDArray[50];   // Array for the last SD card line
+  for(uint8_t i = 0; i < sizeof(SDArray); i++) {SDArray[i] = 0xFF;} //initialize array.
+  char flashArr[12]; //one line of flash data
   char SDline[50]; //array used for Flash data matching
   uint8_t startPos;    // start position for SD array compression/processing
   uint8_t stopPos;    // start position for SD array compression/processing
@@ -1015,7 +2268,7 @@ void appendMemRFID() { // Read in last line from SD card. Find matching line in
   File myfile;     // for reading from SD
 
   //First check make sure flash has at least one line of data
-  if((memLoc - datStart) < 9) {
+  if(ringLoc(firstDataLoc()) == memLoc) {
     serial.println("No RFID data to transfer");
     return;
   }
@@ -1026,84 +2279,85 @@ void appendMemRFID() { // Read in last line from SD card. Find matching line in
         SDstart();
     if (!SD.exists(dataFile)) {
       serial.println("No RFID file detected on SD card, need to make new sd file");
-      extractMemRFID(3, datStart);  //dump all data to sd card here....
+      extractMemRFID(3, firstDataLoc());  //dump all data to sd card here....
       return;
     }
     if (SD.exists(dataFile)) {
-      myfile = SD.open(dataFile, FILE_READ);
-      fLen = myfile.size();
-      if(fLen < 36) { //no data or corrupt data in file, erase file and write all flash memory
-        myfile.close();         //Close file 
-        SD.remove(dataFile);    //Delete the file that may have bad data
-        extractMemRFID(3, datStart);
-        return;
-      }
+      uint8_t SDLineBytes;
+      if(binFmt) {                  //Binary file: the last raw line
+        SDLineBytes = lastBinRecord(dataFile, 'D', SDline);
+        if(SDLineBytes == binBad) { //not a data file that can be added to - leave it alone
+          serial.println("RFID file on SD card can't be added to - no data transfer");
+          return;
+        }
+        if(SDLineBytes == 0) {      //no data in file, write all flash memory
+          extractMemRFID(3, firstDataLoc());
+          return;
+        }
+      } else {
+        myfile = SD.open(dataFile, FILE_READ);
+        fLen = myfile.size();
+        if(fLen < 36) { //no whole line in file, write all flash memory after it
+          myfile.close();         //Close file 
+          extractMemRFID(3, firstDataLoc());
+          return;
+        }
       
-      fLen < 50 ? posSD = 0 : posSD = fLen-50;
-      //serial.print("reading characters starting at number "); serial.println(posSD, DEC);
-      myfile.seek(posSD);   //go to read start position
-      uint8_t lineLen = 35;     // 1 indicates ISO line, 0 indicated EM4100 line
+        fLen < 50 ? posSD = 0 : posSD = fLen-50;
+        //serial.print("reading characters starting at number "); serial.println(posSD, DEC);
+        myfile.seek(posSD);   //go to read start position
+        uint8_t lineLen = 35;     // 1 indicates ISO line, 0 indicated EM4100 line
       
-      for(uint8_t i = 0; i < 50; i++) {
-        uint8_t SB1 = myfile.read();
-        if(posSD == 0) {SDArray[i] = SB1;}
-        if((posSD == 0) & (i == fLen)) {
-          lineLen = fLen - 1; 
-          break;
-        }
-        if(posSD > 0) {
-          if(SB1 == 13) {  //look for carriage return
-            if(i < 10) {lineLen = 44;} // if i is less than 10 then the data line must be longer than 40 
-            SB1 = myfile.read(); //Read but ignore - should be line feed
-            for(uint8_t j = 0; j < lineLen; j++) {
-               SDArray[j] = myfile.read();
-            }    
+        for(uint8_t i = 0; i < 50; i++) {
+          uint8_t SB1 = myfile.read();
+          if(posSD == 0) {SDArray[i] = SB1;}
+          if((posSD == 0) & (i == fLen)) {
+            lineLen = fLen - 1; 
+            break;
+          }
+          if(posSD > 0) {
+            if(SB1 == 13) {  //look for carriage return
+              if(i < 10) {lineLen = 44;} // if i is less than 10 then the data line must be longer than 40 
+              SB1 = myfile.read(); //Read but ignore - should be line feed
+              for(uint8_t j = 0; j < lineLen; j++) {
+                 SDArray[j] = myfile.read();
+              }    
+            }
           }
         }
-      }
 
-      uint8_t SDLineBytes = compressSDLine(SDArray, SDline, lineLen);
+        myfile.close();
+        SDLineBytes = compressSDLine(SDArray, SDline);
+      }
 //      serial.println(); serial.println();
 
       //Loop through flash data to find the matching line.
-      uint8_t BX = SDline[6];                   //default match for low byte of timestamp is 6th byth of byte array
-      if(SDLineBytes == 12) {BX = SDline[8];}   //change to 8th byte for ISO tags
-      fLoc = datStart;                          //Start at beginning of flash data
-      while(fLoc < memLoc) {
-        uint16_t fA1 = 0;
-        readFlash(fLoc, flashArr, 500);
-        while(fA1 < 485) {
-          //serial.print("evaluating flash data at "); serial.println(fLoc+fA1, DEC);
-          if(flashArr[fA1] == 0xFF) {
-             serial.println("No matching RFID data found - appending all of flash memory.");
-             extractMemRFID(3, datStart);
-             return;
-          }
-          uint8_t lineLen = 0;
-          if(flashArr[fA1] < 100) {lineLen = 10;} else {lineLen = 12;} //detect tag type and set line length
-            if(flashArr[fA1+lineLen-4] == BX){
-              bool match = compareArrays(flashArr, SDline, fA1, 0, SDLineBytes);
-              if(match) {
-                uint32_t startPoint = fLoc + fA1 + SDLineBytes;  
-                serial.print("Matching RFID data found on SD card. ");  //serial.println(startPoint, DEC);
-                if(startPoint < memLoc) {
-                  serial.print(" Appending new data starting at "); serial.println(startPoint, DEC);
-                  extractMemRFID(3, startPoint);      
-                return;
-                } else {
-                  serial.println("RFID Data up to date, no data transfer needed.");
-                  serial.println();
-                  return;
-                } 
-              }
-            }
-          fA1 = fA1 + lineLen;
+      fLoc = ringLoc(fStart);                   //Start where the card is known to be up to (or the beginning of flash data)
+      while(fLoc != memLoc) {
+        uint8_t lnLen = readLine(&fLoc, flashArr);  //Read a line (compressed records are expanded to the old-style line format) and move to the next one
+        if(lnLen == 0) {        //Damaged data - skip to the next good line
+          resyncLine(&fLoc);
+          continue;
+        }
+        if((lnLen == SDLineBytes) && compareArrays(flashArr, SDline, 0, 0, SDLineBytes)) {
+          serial.print("Matching RFID data found on SD card. ");
+          if(fLoc != memLoc) {
+            serial.print(" Appending new data starting at "); serial.println(fLoc, DEC);
+            extractMemRFID(3, fLoc);
+          } else {
+            serial.println("RFID Data up to date, no data transfer needed.");
+            serial.println();
+            expLoc = memLoc;           //(the card was read back: its last line is the last one in flash)
+            overwriting = 0;
+            saveMemLoc();
+            saveSyncState();
           }
-          fLoc = fLoc + fA1;
+          return;
+        }
       } 
       // no match if you made it this far. Append everything
-      serial.println("No matching data found - appending everything from flash memory.");
-      extractMemRFID(3, datStart);
+      serial.print("No matching data found - appending the flash data from "); serial.println(fStart, DEC);
+      extractMemRFID(3, fStart);
       return;
     }
   }
@@ -1127,141 +2381,49 @@ boolean compareArrays(char *a, char *b, uint16_t start_a, uint16_t start_b, uint
       return true; //if you get this far all matches are OK
 }
 
-uint8_t compressLogLine(char *SDarr, char *line) { //SDarr = array of chars, line = array to write compressed data, lfn = first byte of input charater array, lnSt = where to start writing, leng = how many bytes in each character line. 
-  // "Logging_started" = 11
-  // "Going_to_sleep_" = 12
-  // "Wake_from_sleep" = 13
-  
-//  serial.print("Compressing line: ");
-//  for(uint8_t i = 0; i < 37; i++){
-//    serial.print(SDarr[i]); 
-//  }
-//  serial.println();
-  
-  switch(SDarr[0])
-  {
-    case 'L' : line[0] = 11; break;
-    case 'G' : line[0] = 12; break;
-    case 'W' : line[0] = 13; break;
+uint8_t compressLogLine(char *SDarr, char *line) { //SDarr = log text line, line = array to write the 5-byte log line
+  unsigned int tm[6];
+  uint8_t code = parseLogLine(SDarr, tm);
+  if(code) {line[0] = code;}
+  if(logHasValue(code)) {
+    unixTime.unixLong = getLogValue(SDarr);
+  } else {
+    unixTime.unixLong = getUnix2(tm[2] - 2000, tm[0], tm[1], tm[3], tm[4], tm[5]);
   }
-  
-  byte mo = (char2hex(SDarr[17])*10) + char2hex(SDarr[18]);
-  byte da = (char2hex(SDarr[20])*10) + char2hex(SDarr[21]);
-  byte yr = (char2hex(SDarr[25])*10) + char2hex(SDarr[26]);
-  byte hh = (char2hex(SDarr[28])*10) + char2hex(SDarr[29]);
-  byte mm = (char2hex(SDarr[31])*10) + char2hex(SDarr[32]);
-  byte ss = (char2hex(SDarr[34])*10) + char2hex(SDarr[35]);
-  
-  //serial.print(mo,DEC); serial.print(" "); serial.print(da,DEC); serial.print(" "); serial.print(yr,DEC); serial.print(" "); serial.print(hh,DEC); serial.print(" "); serial.print(mm,DEC); serial.print(" "); serial.print(mo,DEC); serial.print(" "); serial.print(ss,DEC); serial.println(" "); 
-  
-  unixTime.unixLong = getUnix2(yr, mo, da, hh, mm, ss);
   line[1] = unixTime.b1;
   line[2] = unixTime.b2;
   line[3] = unixTime.b3;
   line[4] = unixTime.b4;
-
-  //serial.print(line[1], HEX); serial.print(" "); serial.print(line[1], HEX); serial.print(" "); serial.print(line[2], HEX); serial.print(" "); serial.print(line[3], HEX); serial.print(" "); serial.println(line[4], HEX);
-
+  return 5;
 }
 
-uint8_t compressSDLine(char *SDarr, char *line, uint8_t leng) { //SDarr = array of chars, line = array to write compressed data, lfn = first byte of input charater array, lnSt = where to start writing, leng = how many bytes in each character line. 
-  serial.println();
-  if(leng > 38) { //longer than 34 = ISO tag
-    //serial.println("Compressing ISO tag.");
-    line[0] = char2hex(SDarr[21]) | 0b10000000;
-    countryCode = (char2hex(SDarr[0]) << 8) + (char2hex(SDarr[1]) << 4) + char2hex(SDarr[2]);
-    line[6] = countryCode >> 2;      //country code is encoded across two byte, and byte are read in reverse order for ISO tags.
-    line[5] = (char2hex(SDarr[4]) << 4) + char2hex(SDarr[5]); 
-    line[5] = (line[5] & 0b00111111) + (countryCode << 6);     // tack on two bits from country code.
-    line[4] = (char2hex(SDarr[6]) << 4) + char2hex(SDarr[7]);
-    line[3] = (char2hex(SDarr[8]) << 4) + char2hex(SDarr[9]);
-    line[2] = (char2hex(SDarr[10]) << 4) + char2hex(SDarr[11]);
-    line[1] = (char2hex(SDarr[12]) << 4) + char2hex(SDarr[13]);
-    line[7] = (char2hex(SDarr[16]) * 100) + (char2hex(SDarr[17]) * 10) + char2hex(SDarr[18]);
-    byte mo = (char2hex(SDarr[24])*10) + char2hex(SDarr[25]);
-    byte da = (char2hex(SDarr[27])*10) + char2hex(SDarr[28]);
-    byte yr = (char2hex(SDarr[32])*10) + char2hex(SDarr[33]);
-    byte hh = (char2hex(SDarr[35])*10) + char2hex(SDarr[36]);
-    byte mm = (char2hex(SDarr[38])*10) + char2hex(SDarr[39]);
-    byte ss = (char2hex(SDarr[41])*10) + char2hex(SDarr[42]);
-    unixTime.unixLong = getUnix2(yr, mo, da, hh, mm, ss);
-    line[8] = unixTime.b1;
-    line[9] = unixTime.b2;
-    line[10] = unixTime.b3;
-    line[11] = unixTime.b4;
-
-//    for(uint8_t i = 0; i<12; i++) {
-//      serial.print(line[i], HEX); serial.print(" ");
-//    }
-    return 12;
-  }
-  if(leng < 38) { //shorter than 34 = EM4100 tag
-    //serial.println("Compressing EM4100 tag.");
-    line[0] = char2hex(SDarr[12]);
-    line[1] = (char2hex(SDarr[0]) << 4) + char2hex(SDarr[1]); 
-    line[2] = (char2hex(SDarr[2]) << 4) + char2hex(SDarr[3]);
-    line[3] = (char2hex(SDarr[4]) << 4) + char2hex(SDarr[5]);
-    line[4] = (char2hex(SDarr[6]) << 4) + char2hex(SDarr[7]);  
-    line[5] = (char2hex(SDarr[8]) << 4) + char2hex(SDarr[9]);
-    //serial.print(" - "); serial.print(" ")
-    byte mo = (char2hex(SDarr[15])*10) + char2hex(SDarr[16]);
-    byte da = (char2hex(SDarr[18])*10) + char2hex(SDarr[19]);
-    byte yr = (char2hex(SDarr[23])*10) + char2hex(SDarr[24]);
-    byte hh = (char2hex(SDarr[26])*10) + char2hex(SDarr[27]);
-    byte mm = (char2hex(SDarr[29])*10) + char2hex(SDarr[30]);
-    byte ss = (char2hex(SDarr[32])*10) + char2hex(SDarr[33]);
-    //serial.print(mo, DEC); serial.print(da, DEC); serial.print(yr, DEC); serial.print(hh, DEC); serial.print(mm, DEC); serial.print(ss, DEC);
-    unixTime.unixLong = getUnix2(yr, mo, da, hh, mm, ss);
-    //serial.print(" "); serial.print(unixTime.unixLong, DEC);
-    line[6] = unixTime.b1;
-    line[7] = unixTime.b2;
-    line[8] = unixTime.b3;
-    line[9] = unixTime.b4;
-
-//    for(uint8_t i = 0; i<10; i++) {
-//      serial.print(line[i], HEX); serial.print(" ");
-//    }
-    return 10;
-  }
-}
-
-
-char char2hex(char ch)
-{
-  char rT;
-  switch(ch)
-  {
-    case '0': rT = 0; break;
-    case  '1' : rT = 1; break;
-    case  '2': rT = 2; break;
-    case  '3': rT = 3; break;
-    case  '4' :rT = 4; break;
-    case  '5': rT = 5; break;
-    case  '6': rT = 6; break;
-    case  '7': rT = 7; break;
-    case  '8': rT = 8; break;
-    case  '9': rT = 9; break;
-    case  'A': rT = 10; break;
-    case  'B': rT = 11; break;
-    case  'C': rT = 12; break;
-    case  'D': rT = 13; break;
-    case  'E': rT = 14; break;
-    case  'F' : rT = 15; break;
-    default: rT = 0; break;
-  }
-  return rT;
+uint8_t compressSDLine(char *SDarr, char *line) { //SDarr = RFID text line, line = array to write the line in the old-style format
+  unsigned int tm[6];
+  uint8_t n = parseTagLine(SDarr, line, tm);
+  unixTime.unixLong = getUnix2(tm[2] - 2000, tm[0], tm[1], tm[3], tm[4], tm[5]);
+  line[n-4] = unixTime.b1;
+  line[n-3] = unixTime.b2;
+  line[n-2] = unixTime.b3;
+  line[n-1] = unixTime.b4;
+  return n;
 }
 
 
 void extractMemRFID(uint8_t prntWrt, uint32_t flashStart) {  //Takes data from Flash and prints to screen and/or writes to SD card
-  if(memLoc <= flashStart) {
+  flashStart = ringLoc(flashStart);
+  if((flashStart == memLoc) || (!ringMem && (memLoc < flashStart))) {
     serial.println("no RFID data to write");
     return;
   }
   bool prnt = bitRead(prntWrt, 0);
   bool wrt = bitRead(prntWrt, 1);
-  char BA[500];           //define byte array to store (500 bytes)
+  char BA[12];                 //one line of data in the old-style line format (compressed records are expanded)
+  static char text[48];        //text version of the line
   uint32_t dMem = flashStart;  //counter for memory position
+  uint32_t nLines = 0;         //number of lines transferred
+  uint32_t nBad = 0;           //number of bytes of damaged data skipped
+  uint32_t tm = millis();      //start time of the transfer
+  uint32_t nRec = 0;           //number of records in a binary file
   File myFile;
 
   //Check if file on SD card exists. if not create it.
@@ -1269,99 +2431,231 @@ void extractMemRFID(uint8_t prntWrt, uint32_t flashStart) {  //Takes data from F
     SDstart();
     if(!SD.exists(dataFile)) {
       serial.println("Creating new file on SD card");
-      myFile = SD.open(dataFile, FILE_WRITE);
-      delay(10);
-      myFile.close();
     } 
-    
-    //else {
-    //  serial.println("file on SD card found");
-    //}
-    //SDstop();
+    if(binFmt) {
+      myFile = openBin(dataFile, 'D', &nRec, ringBytes(flashStart) * 4);   //Open for appending raw lines (compressed records take about 1/4 of the space)
+    } else {
+      myFile = SD.open(dataFile, FILE_WRITE);  //Open for appending new data to file
+      myFile.seek(myFile.size());              //(so position() is the end of the file)
+      sdReserve(myFile, ringBytes(flashStart) * 14);   //(about 36 characters for each 2 or 3 bytes of compressed data)
+    }
+    if(!myFile) {
+      serial.println("data file not opened!!");
+    }
+    sdBegin(myFile);
   }
   
   serial.print("transferring data from "); serial.print(flashStart, DEC); serial.print(" to "); serial.println(memLoc, DEC);
-  while(dMem < memLoc) {                 // read batches of flash data until end of data is reached.   
-     //showFlash(dMem, dMem+500);
-     digitalWrite(LED_RFID, LOW);   // Flash LED to indicate progress             
-     readFlash(dMem, BA, 500);       // Read in batch of data
-
-     digitalWrite(LED_RFID, HIGH);  // Flash LED to indicate progress 
-     flashOff();                    // Make sure flash is off 
-     //serial.print("Flash batch read in starting at "); serial.println(dMem, DEC);
-     uint16_t b = 0;                // initialize byte counter
-
-     //Write lines to SD card and/or serial
-     if(wrt && (SDOK == 1)) {  //open SD card file if needed
-         myFile = SD.open(dataFile, FILE_WRITE);  //Open for appending new data to file
-     } 
-     
-     while((b < 480) & (dMem < memLoc)) {       //Don't go through end of array, in case of cutting off data lines.
-        //serial.print("first byte of line at position "); serial.print(b, DEC); serial.print(" is "); serial.println(BA[b], HEX);
-        if((BA[b] == 129) | (BA[b] == 130)) { //This determines whether you have an ISO tag or not
-            //serial.println("Writing ISO line");
-            unixTime.b1 = BA[b+8]; unixTime.b2 = BA[b+9]; unixTime.b3 = BA[b+10]; unixTime.b4 = BA[b+11];
-            convertUnix(unixTime.unixLong);  // convert unix time. Time values get stored in array timeIn, bytes 0 through 5.
-            static char text[41]; 
-            countryCode = (BA[b+6]<<2) + (BA[b+5]>>6);
-            sprintf(text, "%03X.%02X%02X%02X%02X%02X, %03d, %d, %02d/%02d/%04d %02d:%02d:%02d",
-                 countryCode, (BA[b+5] & 0b00111111), BA[b+4], BA[b+3], BA[b+2], BA[b+1], BA[b+7], (BA[b] & 0x0F),  
-                 timeIn[0], timeIn[1], timeIn[2], timeIn[3], timeIn[4], timeIn[5]);
-            //if(prnt) {serial.print(dMem, DEC); serial.print(" "); serial.println(text);}
-            if(prnt) {serial.println(text);}
-            if(wrt && SDOK == 1) {myFile.println(text);}
-            b = b + 12;
-            dMem = dMem + 12;
-         } 
-         if((BA[b] == 1) | (BA[b] == 2)) {
-            //serial.println("Writing EM4100 line");
-            unixTime.b1 = BA[b+6]; unixTime.b2 = BA[b+7]; unixTime.b3 = BA[b+8]; unixTime.b4 = BA[b+9];
-            convertUnix(unixTime.unixLong);
-            static char text[41];
-            sprintf(text, "%02X%02X%02X%02X%02X, %d, %02d/%02d/%04d %02d:%02d:%02d",
-                  BA[b+1], BA[b+2], BA[b+3], BA[b+4], BA[b+5], BA[b], timeIn[0], timeIn[1], timeIn[2], timeIn[3], timeIn[4], timeIn[5]);
-            //if(prnt) {serial.print(dMem, DEC); serial.print(" "); serial.println(text);}
-            if(prnt) {serial.println(text);}
-            if(wrt && SDOK == 1) {myFile.println(text);}
-            b = b + 10;
-            dMem = dMem + 10;
-          }
-          if( ((BA[b] > 9 && BA[b] < 129) || (BA[b] > 133)) && (dMem < memLoc) ) {
-            serial.println("data file alignment error. Store data and write all to new file");
-            serial.println("last dMem:"); serial.println(dMem, DEC);
-            serial.print(b, DEC); serial.print(" "); serial.print(BA[b], HEX); serial.print(" "); serial.print(BA[b+1], HEX); serial.print(" "); serial.println(BA[b+3], HEX);
-            showFlash(4224, 5500); 
-        
-            delay(500);
-            if(wrt && SDOK == 1) {myFile.close(); SDstop();}      //close the file 
-            dMem = memLoc + 1000; 
-            break;
-            return;
-          }   
-          //serial.print("dMem is now "); serial.println(dMem, DEC);  
-      } 
-      if(wrt && SDOK == 1) {
-        myFile.close();  //close the file 
-        //SDstop();
-      }     
+  while(dMem != memLoc) {                 // read lines of data until end of data is reached.   
+     digitalWrite(LED_RFID, LOW);         // Flash LED to indicate progress             
+     uint8_t lineLen = readLine(&dMem, BA);  // Read in one line (dMem moves on to the next line)
+     digitalWrite(LED_RFID, HIGH);        // Flash LED to indicate progress 
+     if(lineLen == 0) {                   // Damaged data - skip to the next good line
+        nBad = nBad + resyncLine(&dMem);
+        continue;
+     }
+     if(prnt || !binFmt) {formatLine(BA, text);}   //(binary files get the raw line - no formatting)
+     if(prnt) {serial.println(text);}
+     if(wrt && SDOK == 1) {
+       if(binFmt) {
+         sdWrite(BA, lineLen);
+       } else {
+         sdPrintln(text);
+       }
+     }
+     nLines++;
+  }
+  if(wrt && SDOK == 1) {
+    bool ok = sdEnd();
+    if(binFmt) {
+      ok = closeBin(myFile, nRec + nLines) && ok;
+    } else {
+      ok = sdClose(myFile) && ok;  //close the file
+    }
+    if(ok) {               //Everything up to memLoc is now on the SD card
+      expLoc = memLoc;
+      overwriting = 0;
+      saveMemLoc();
+      saveSyncState();
+    } else {               //(expLoc stays, so the next sync writes these lines again)
+      serial.println("SD card write failed - RFID data not synced");
+    }
   }
+  serial.print(nLines, DEC); serial.print(" lines transferred in "); serial.print(millis() - tm, DEC); serial.println(" ms");
+  if(nBad) {serial.print(nBad, DEC); serial.println(" bytes of damaged data skipped");}
   serial.println();
 }
 
 
+//Get the query settings from the user, then display or save the matching reads
+void queryMenu() {
+  serial.println("Start time: enter mmddyyhhmmss (or just press Enter to start with the first read)");
+  qStart = (getInputString(20000) == 12) ? inputUnix() : 0;
+  serial.println("End time: enter mmddyyhhmmss (or just press Enter to end with the last read)");
+  qEnd = (getInputString(20000) == 12) ? inputUnix() : 0xFFFFFFFF;
+  serial.println("Tag ID: enter 10 characters for EM4100 or 13 for ISO11784/5 tags (or just press Enter for all tags)");
+  inputTag(getInputString(20000));
+  serial.println("Tag type: E = EM4100, I = ISO11784/5 (or just press Enter for both)");
+  char c = getInputByte(20000);
+  qType = (c == 'E') ? 1 : ((c == 'I') ? 2 : 3);
+  serial.println("Antenna number (or just press Enter for all antennas)");
+  c = getInputByte(20000);
+  qAnt = ((c > '0') && (c < '8')) ? c - '0' : 0;
+  serial.println("S = show results here, W = write results to SD card");
+  c = getInputByte(20000);
+  if(c == 'W') {
+    if(SDOK == 1) {queryRFID(2);} else {serial.println("SD card missing");}
+  } else {
+    queryRFID(1);
+  }
+}
+
+//Convert a tag ID entered by the user (tIn characters in cArray1) to the query tag (qTag). Sets and returns qTagSet.
+bool inputTag(byte tIn) {
+  qTagSet = 0;
+  for(uint8_t i = 0; i < 7; i++) {qTag[i] = 0;}
+  if(tIn == 10) {             //EM4100 tag: same byte order as the data lines
+    for(uint8_t i = 0; i < 5; i++) {qTag[i+1] = getHex2(cArray1 + i*2);}
+    qTagSet = 1;
+  }
+  if(tIn == 13) {             //ISO tag: 3 characters of country code (the '.' is ignored) and 10 characters of ID, encoded as in compressSDLine()
+    countryCode = (hexVal(cArray1[0]) << 8) + getHex2(cArray1 + 1);
+    qTag[0] = 0x80;
+    qTag[6] = countryCode >> 2;
+    qTag[5] = (getHex2(cArray1 + 3) & 0b00111111) + (countryCode << 6);
+    for(uint8_t i = 0; i < 4; i++) {qTag[4-i] = getHex2(cArray1 + 5 + i*2);}
+    qTagSet = 1;
+  }
+  return qTagSet;
+}
+
+//Convert a date and time entered as mmddyyhhmmss (in cArray1) to unix time
+uint32_t inputUnix() {
+  byte mo = (cArray1[0]-48) * 10 + (cArray1[1] - 48);  //Convert two ascii characters into a single decimal number
+  byte da = (cArray1[2]-48) * 10 + (cArray1[3] - 48);
+  byte yr = (cArray1[4]-48) * 10 + (cArray1[5] - 48);
+  byte hh = (cArray1[6]-48) * 10 + (cArray1[7] - 48);
+  byte mm = (cArray1[8]-48) * 10 + (cArray1[9] - 48);
+  byte ss = (cArray1[10]-48) * 10 + (cArray1[11] - 48);
+  return getUnix2(yr, mo, da, hh, mm, ss);
+}
+
+//Check an RFID data line (old-style line format) against the query settings
+bool lineMatch(char *line, uint8_t len) {
+  uint32_t t = ((uint32_t)(uint8_t)line[len-1] << 24) + ((uint32_t)(uint8_t)line[len-2] << 16) + ((uint32_t)(uint8_t)line[len-3] << 8) + (uint8_t)line[len-4];
+  if((t < qStart) || (t > qEnd)) {return 0;}
+  if(!(qType & ((line[0] & 0x80) ? 2 : 1))) {return 0;}
+  if(qAnt && ((line[0] & 0x0F) != qAnt)) {return 0;}
+  if(qTagSet) {
+    if((line[0] & 0x80) != qTag[0]) {return 0;}
+    if(!compareArrays(line, qTag, 1, 1, (len == 12) ? 6 : 5)) {return 0;}
+  }
+  return 1;
+}
+
+//Find the last compressed page that was started at or before time t. Pages are searched in the order they were
+//written (oldest block first) with a binary search on their base times - times go up from page to page unless the
+//clock was set back. Returns 0 if there is no such page (start from the beginning of the data).
+uint32_t findPage(uint32_t t) {
+  if(!ringMem) {return 0;}
+  uint16_t nBlk = lastBlk - firstBlk + 1;
+  uint16_t ob = firstDataLoc() / blkSize;                  //oldest block
+  uint32_t lo = 0;                                         //page number in write order (0 = first page of the oldest block)
+  uint32_t hi = (uint32_t)((curBlk + nBlk - ob) % nBlk + 1) * blkPgs;
+  uint32_t found = 0;
+  while(lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    uint32_t pg = (uint32_t)(firstBlk + ((ob - firstBlk) + mid / blkPgs) % nBlk) * blkPgs + mid % blkPgs;
+    char hd[9];
+    readFlash(pg * pgSize + pgOff(pg), hd, 9);
+    uint32_t pt = 0;                                       //pages of old-style lines count as older than any compressed page
+    if(blkFormat(pg / blkPgs) == blkMark2) {
+      pt = (hd[0] == pgMark) ? ((uint32_t)(uint8_t)hd[8] << 24) + ((uint32_t)(uint8_t)hd[7] << 16) + ((uint32_t)(uint8_t)hd[6] << 8) + (uint8_t)hd[5] : 0xFFFFFFFF;   //blank pages are newer
+    }
+    if(pt <= t) {
+      if(pt) {found = pg;}
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return found;
+}
+
+//Display (prntWrt bit 0) and/or write to the SD card (bit 1) the RFID reads that match the query settings
+//(qStart, qEnd, qTag, qType, qAnt). Reading starts at the page found by findPage(), and compressed pages that
+//cannot hold a match (according to their headers and Bloom filters) are skipped without being read. A page that
+//starts after the end time does not end the query: if the clock was set back, later pages can hold earlier reads.
+void queryRFID(uint8_t prntWrt) {
+  uint32_t tm = millis();
+  bool prnt = bitRead(prntWrt, 0);
+  bool wrt = bitRead(prntWrt, 1);
+  char BA[12];
+  static char text[48];
+  uint32_t nMatch = 0;
+  uint32_t nRead = 0;
+  uint32_t nSkip = 0;
+  File myFile;
+  if(wrt && SDOK == 1) {
+    SDstart();
+    myFile = SD.open(queryFile, FILE_WRITE);
+  }
+  uint32_t dMem = ringLoc(firstDataLoc());
+  uint32_t pg = (qStart > 0) ? findPage(qStart) : 0;
+  if(pg) {dMem = ringLoc(pg * pgSize + pgOff(pg));}
+  while(dMem != memLoc) {
+    pg = dMem / pgSize;
+    if(ringMem && (dMem % pgSize == (uint32_t)(pgOff(pg) + pgHdr)) && (blkFormat(pg / blkPgs) == blkMark2)) {   //First record of a compressed page - check the page header
+      char hd[pgHdr];
+      readFlash(pg * pgSize + pgOff(pg), hd, pgHdr);
+      uint32_t t1 = ((uint32_t)(uint8_t)hd[8] << 24) + ((uint32_t)(uint8_t)hd[7] << 16) + ((uint32_t)(uint8_t)hd[6] << 8) + (uint8_t)hd[5];
+      uint32_t t2 = ((uint32_t)(uint8_t)hd[12] << 24) + ((uint32_t)(uint8_t)hd[11] << 16) + ((uint32_t)(uint8_t)hd[10] << 8) + (uint8_t)hd[9];
+      if(hd[51] == 0x00) {                                 //Sealed page: skip it if it cannot hold a match
+        if((t1 > qEnd) || (t2 < qStart) || !(hd[15] & qType) || (qAnt && !(hd[16] & (1 << qAnt))) || (qTagSet && !bloomTest(hd + 17, qTag))) {
+          dMem = ringLoc((pg + 1) * pgSize);
+          nSkip++;
+          continue;
+        }
+      }
+      nRead++;
+    }
+    uint8_t lineLen = readLine(&dMem, BA);
+    if(lineLen == 0) {
+      resyncLine(&dMem);
+      continue;
+    }
+    if(lineMatch(BA, lineLen)) {
+      formatLine(BA, text);
+      if(prnt) {serial.println(text);}
+      if(wrt && SDOK == 1) {myFile.println(text);}
+      nMatch++;
+    }
+  }
+  if(wrt && SDOK == 1) {
+    myFile.close();
+    SDstop();
+  }
+  serial.print(nMatch, DEC); serial.print(" matching reads found in "); serial.print(millis() - tm, DEC); serial.println(" ms");
+  if(ringMem) {serial.print(nRead, DEC); serial.print(" pages read, "); serial.print(nSkip, DEC); serial.println(" pages skipped");}
+  if(wrt) {serial.print("Results added to "); serial.println(queryFile);}
+}
+
+
 void extractMemLog(uint8_t prntWrt, uint32_t flashStart) {
 //  serial.println("Write log mem...");
 //  serial.println();
   
-  if(logLoc <= flashStart) {
+  uint32_t nLeft = logBytes(flashStart);   //bytes of log lines to transfer
+  if(nLeft == 0) {
     serial.println("no log data to write");
     return;
   }
 
   bool prnt = bitRead(prntWrt, 0);
   bool wrt = bitRead(prntWrt, 1);
-  char BA[500];           //define byte array to store (500 bytes)
-  uint32_t dMem = flashStart;  //counter for memory position
+  char *BA = scratchTake(logBatch);   //batch of log data (from the scratch arena)
+  uint32_t dMem = logWrap(flashStart);  //counter for memory position
+  uint32_t nRec = 0;           //number of records in a binary file
   File myFile;
 
     //Check if file on SD card exists. if not create it.
@@ -1370,63 +2664,73 @@ void extractMemLog(uint8_t prntWrt, uint32_t flashStart) {
     if(!SD.exists(logFile)) {
       serial.print("Creating new log file on SD card: ");
       serial.println(logFile);
-      myFile = SD.open(logFile, FILE_WRITE);
-      delay(10);
-      myFile.close();
     } 
-    //else {
-    //  serial.println("file on SD card found");
-    //}
-    //SDstop();
-  }
-
-  if(!SD.exists(logFile)) {
-    serial.println("log file not created!!");
+    if(binFmt) {                             //Open the file once for the whole transfer
+      myFile = openBin(logFile, 'L', &nRec, nLeft);  //Open for appending raw log lines
+    } else {
+      myFile = SD.open(logFile, FILE_WRITE);  //Open for appending new data to file
+      myFile.seek(myFile.size());             //(so position() is the end of the file)
+      sdReserve(myFile, nLeft * 7);           //(35 characters for each 5-byte log line)
+    }
+    if(!myFile) {
+      serial.println("log file not created!!");
+    }
+    sdBegin(myFile);
   }
 
   serial.print("transferring data from "); serial.print(flashStart, DEC); serial.print(" to "); serial.println(logLoc, DEC);
-  while(dMem < logLoc) {                 // read batches of flash data until end of data is reached.   
-     //showFlash(dMem, dMem+500);
+  while(nLeft > 0) {                     // read batches of flash data until end of data is reached.   
+     uint32_t n = logLast + 5 - dMem;    // (a batch stops at the end of the ring)
+     if(n > nLeft) {n = nLeft;}
+     if(n > logBatch) {n = logBatch;}
      digitalWrite(LED_RFID, LOW);   // Flash LED to indicate progress             
-     readFlash(dMem, BA, 500);       // Read in batch of data
+     readFlash(dMem, BA, n);        // Read in batch of data
 
      digitalWrite(LED_RFID, HIGH);  // Flash LED to indicate progress 
      flashOff();                    // Make sure flash chip is off 
      //serial.print("Flash batch read in starting at "); serial.println(dMem, DEC);
-     uint16_t b = 0; 
 
           //Write lines to SD card and/or serial
-     if(wrt && (SDOK == 1)) {  //open SD card file if needed
-         myFile = SD.open(logFile, FILE_WRITE);  //Open for appending new data to file
-     } 
-     
-     while((b < 490) & (dMem < logLoc)) {       //Don't go through end of array, in case of cutting off data lines.
+     for(uint16_t b = 0; b < n; b = b + 5) {
         //serial.print("first byte of line at position "); serial.print(b, DEC); serial.print(" is "); serial.println(BA[b], HEX);
-        if(BA[b] != 0xFF) {
-          getLogMessage(BA[b]); //Log message gets loaded into logMess
+        if(BA[b] == 0xFF) {            //(a line cut short by a power failure)
+          continue;
+        } else if(binFmt && !prnt) {   //Binary file: just the raw log line
+          if(wrt && SDOK == 1) {sdWrite(BA + b, 5);}
+          nRec++;
+        } else {
           unixTime.b1 = BA[b+1]; unixTime.b2 = BA[b+2]; unixTime.b3 = BA[b+3]; unixTime.b4 = BA[b+4];
-          convertUnix(unixTime.unixLong);  // covert unix time. Time values get stored in array timeIn, bytes 0 through 5.
-          static char text[20]; 
-          sprintf(text, ", %02d/%02d/%04d %02d:%02d:%02d", timeIn[0], timeIn[1], timeIn[2], timeIn[3], timeIn[4], timeIn[5]);
+          logLineText(BA[b], unixTime.unixLong, cArray2);
           if(prnt){
-             serial.print(logMess);
-             serial.println(text);
+             serial.println(cArray2);
           }
-          if(wrt && SDOK == 1){
-             myFile.print(logMess);
-             myFile.println(text);
+          if(wrt && SDOK == 1 && binFmt){
+             sdWrite(BA + b, 5);
+             nRec++;
+          } else if(wrt && SDOK == 1){
+             sdPrintln(cArray2);
           }
-          b = b + 5;
-          dMem = dMem + 5;
-        } else {
-          break; 
         }
-       //serial.print("dMem is now "); serial.println(dMem, DEC);  
       } 
-      if(wrt && SDOK == 1) {
-        myFile.close();  //close the file 
-        //SDstop();
-      }     
+      nLeft = nLeft - n;
+      dMem = logWrap(dMem + n);
+      //serial.print("dMem is now "); serial.println(dMem, DEC);  
+  }
+  scratchGive(BA);
+  if(wrt && SDOK == 1) {
+    bool ok = sdEnd();
+    if(binFmt) {
+      ok = closeBin(myFile, nRec) && ok;
+    } else {
+      ok = sdClose(myFile) && ok;  //close the file
+    }
+    if(ok) {               //Everything up to logLoc is now on the SD card
+      logExp = logLoc;
+      saveMemLoc();
+      saveSyncState();
+    } else {               //(logExp stays, so the next sync writes these lines again)
+      serial.println("SD card write failed - log data not synced");
+    }
   }
   serial.println();
   return;
@@ -1441,9 +2745,18 @@ bool SDstart() {                 // Startup routine for the SD card
   digitalWrite(FlashCS, HIGH);   // Deactivate flash chip if necessary
   pinMode(SDon, OUTPUT);         // Make sure the SD power pin is an output
   digitalWrite(SDon, LOW);       // Power to the SD card
+  if(sdOnAt == 0) {              // (count the time from the first start)
+    sdOnAt = millis() | 1;
+    evCount[evSDStart]++;
+  }
   delay(20);
   digitalWrite(SDselect, LOW);   // SD card turned on
-  if (!SD.begin(SDselect)) {     // Return a 1 if everyting works
+#if USE_SDFAT
+  bool cardOK = SD.begin(SdSpiConfig(SDselect, SHARED_SPI, SPI_SPEED));   // (the flash chip shares the SPI bus)
+#else
+  bool cardOK = SD.begin(SDselect);
+#endif
+  if (!cardOK) {                 // Return a 1 if everyting works
     //serial.println("SD fail");
     return 0;
   } else {
@@ -1457,68 +2770,959 @@ void SDstop() {                 // Stop routine for the SD card
   SD.end();                     // End SD communication
   digitalWrite(SDselect, HIGH); // SD card turned off
   digitalWrite(SDon, HIGH);     // power off the SD card
+  if(sdOnAt) {
+    stTime[stSDOn] += (millis() - sdOnAt) * 1000ull;
+    sdOnAt = 0;
+  }
+}
+
+//Buffered SD card writer for data transfers. Output is collected in sdBuf and written sdBufBlocks whole 512-byte
+//card blocks at a time, lined up with the blocks of the file (the first write only fills up the block the file ends
+//in), so the SD library never has to write part of a block or read one back, and SdFat sends the blocks to the card
+//with one multi-block write. The file stays open for the whole transfer; every sdSyncBlocks blocks it is flushed so
+//the directory entry on the card is brought up to date (a power failure part way through a long transfer then
+//loses at most that much).
+void sdBegin(File &f) {
+  sdOut = &f;
+  sdBufN = 0;
+  sdBlocks = 0;
+  sdErr = !f;
+  sdBufEnd = 512 - (f.position() % 512);   //room left in the block the file ends in
 }
 
-uint32_t getMemLoc(uint32_t startMem, uint32_t endMem){ //startMem = beginning of first page; endMem = beginning of last page.
-    //serial.println("Getting memLoc");
-    char ccc[5] = {0,0,0,0,0};
-    char ff[533]; //huge array for entire page plus a few at the end. 
-    uint32_t mLoc = startMem; //Start with specified memory location
-    startMem = startMem + 527;  //look at last byte on first memory page
+void sdWrite(const char *b, uint16_t n) {
+  while(n > 0) {
+    uint16_t k = sdBufEnd - sdBufN;
+    if(k > n) {k = n;}
+    memcpy(sdBuf + sdBufN, b, k);
+    sdBufN = sdBufN + k;
+    b = b + k;
+    n = n - k;
+    if(sdBufN == sdBufEnd) {              //Buffer is full - write it
+      if(sdOut->write((uint8_t*)sdBuf, sdBufN) != sdBufN) {sdErr = 1;}   //(a full card, or the card failed)
+      uint32_t prevBlocks = sdBlocks;
+      sdBlocks = sdBlocks + (sdBufN + 511) / 512;
+      sdBufN = 0;
+      sdBufEnd = sizeof(sdBuf);
+      if((sdSyncBlocks > 0) && (sdBlocks / sdSyncBlocks != prevBlocks / sdSyncBlocks)) {sdOut->flush();}
+    }
+  }
+}
 
-    while(startMem <= endMem){  //This loop provides the last page address
-       readFlash(startMem, ccc, 5);
-       if((ccc[0]==0xFF) && (ccc[1]==0xFF) && (ccc[2]==0xFF) && (ccc[3]==0xFF) && (ccc[4]==0xFF)) {
+void sdPrintln(const char *text) {        //Same as File.println() - a line of text with CR LF
+  sdWrite(text, strlen(text));
+  sdWrite("\r\n", 2);
+}
+
+//Write what is left in the buffer (the file is then closed with closeBin() or sdClose()). Returns 0 if the file
+//did not open or any of the transfer was not written.
+bool sdEnd() {
+  if((sdBufN > 0) && (sdOut->write((uint8_t*)sdBuf, sdBufN) != sdBufN)) {sdErr = 1;}
+  sdBufN = 0;
+#if USE_SDFAT
+  if(sdTrunc && !sdOut->truncate()) {sdErr = 1;}   //Give back the preallocated space that was not used
+#endif
+  sdTrunc = 0;
+  return !sdErr;
+}
+
+//Close an SD card file. Returns 0 if a write to it failed or what was written could not be saved on the card.
+bool sdClose(File &f) {
+  if(!f) {return 0;}
+#if USE_SDFAT
+  bool ok = !f.getWriteError();
+  return f.close() && ok;
+#else
+  f.flush();                              //(the standard SD library's close() does not say if this worked)
+  bool ok = !f.getWriteError();
+  f.close();
+  return ok;
+#endif
+}
+
+//Preallocate n bytes for a new (empty) file with SdFat before a transfer. The file gets contiguous clusters, so
+//the blocks can be written one after another without looking for free clusters or updating the FAT as the file
+//grows; sdEnd() gives back what was not used. Only done on exFAT cards, which keep the length of the data written
+//apart from the space allocated (a preallocated FAT16/FAT32 file has the full size until it is cut back, so a
+//power failure would leave unwritten space in it). Otherwise, or if the card has no room in one piece, the file
+//just grows as usual.
+void sdReserve(File &f, uint32_t n) {
+#if USE_SDFAT
+  if(f && (SD.fatType() == FAT_TYPE_EXFAT) && (f.size() == 0) && (n > 0)) {sdTrunc = f.preAllocate(n);}
+#endif
+}
+
+//Find the next free memory location in a range of pages. Data are appended in order and every line ends with a byte
+//that is never 0xFF, so the pages holding data come first, followed by empty pages. A binary search over pages
+//finds the last page with data, and the end of the data is just past the last non-0xFF byte on that page.
+uint32_t getMemLoc(uint32_t startMem, uint32_t endMem, uint32_t hint){ //startMem = beginning of first page; endMem = beginning of last page; hint = location from journal
+    char *ff = scratchTake(pgSize);       //array for one entire page
+    uint32_t lo = startMem / pgSize;         //last page known to hold data (or the first page)
+    uint32_t hi = endMem / pgSize;           //last page that might hold data
+    if((hint > startMem) && (hint <= endMem + pgSize)) {  //Check the journal location - the byte before it must hold data
+       readFlash(hint - 1, ff, 1);
+       if(ff[0] != 0xFF) {lo = (hint - 1) / pgSize;}     //Data found - start the search from here
+    }
+    
+    uint32_t step = 1;                    //Look ahead 1, 2, 4, 8... pages to find an empty page quickly when the journal is recent
+    while(lo < hi) {
+       uint32_t pg = lo + step;
+       if(pg > hi) {pg = hi;}
+       if(pageUsed(pg)) {
+          lo = pg;
+          step = step << 1;
+       } else {
+          hi = pg - 1;
           break;
-          } else {
-          startMem = startMem + 528;   //Data found at end of page. try the next one
-       }  
-    }
-    //uint32_t endLoc = startMem + 80; //Define uppler limit for search
-    startMem = startMem-527; //Go back to beginning of page
-    //serial.print("Byte search starting at "); serial.println(startMem, DEC);
-    readFlash(startMem, ff, 533);  //read in entire page plus a few bytes
-    for(uint16_t i = 0; i < 528; i++) { //
-      if(ff[i] == 0xFF) {
-        if((ff[i+1]==0xFF) && (ff[i+2]==0xFF) && (ff[i+3]==0xFF) &(ff[i+4]==0xFF)) { //Check for a string of empty bytes.
-          //serial.print("end found at "); 
-          startMem = startMem+i;
-          //serial.println(startMem, DEC);
-          return startMem;
-        }
+       }
+    }
+    while(lo < hi) {                      //Binary search for the last page with data between lo and hi
+       uint32_t mid = lo + (hi - lo + 1) / 2;
+       if(pageUsed(mid)) {lo = mid;} else {hi = mid - 1;}
+    }
+
+    readFlash(lo * pgSize, ff, pgSize);         //read in the last page with data
+    int16_t i = pgSize - 1;
+    while((i >= 0) && (ff[i] == 0xFF)) {i--;}   //search backward for the last byte of data
+    scratchGive(ff);
+    return (lo * pgSize) + i + 1;            //(only the first page can be empty)
+}
+
+//Log lines are kept in a ring of erase units (pages 1-6, or blocks 1-4 on NOR flash). A line starts every 5 bytes from
+//logStart to logLast, then at logStart again, so a line can run on into the next unit. The unit after the one being
+//written is always erased, so the newest unit is the used one followed by an erased one. logLoc and logExp are
+//between logStart and logLast + 5 (the same place in the ring as logStart).
+
+//Number of erase units in the log ring
+uint16_t logUnits() {
+  return (cpyLoc - logStart) / logUnit;
+}
+
+//Unit of the log ring holding loc
+uint16_t logUnitOf(uint32_t loc) {
+  return (loc - logStart) / logUnit;
+}
+
+//First log line that starts in unit u (any bytes before it are the end of a line from the unit before)
+uint32_t logUnitLine(uint16_t u) {
+  return logStart + ((uint32_t)u * logUnit + 4) / 5 * 5;
+}
+
+//A log location at the end of the ring is the same place as logStart
+uint32_t logWrap(uint32_t loc) {
+  return (loc > logLast) ? logStart : loc;
+}
+
+//Bytes of log lines from loc round the ring to logLoc
+uint32_t logBytes(uint32_t loc) {
+  if(loc == logLoc) {return 0;}
+  loc = logWrap(loc);
+  if(logLoc >= loc) {return logLoc - loc;}
+  return (logLast + 5 - loc) + (logLoc - logStart);
+}
+
+//Oldest log line: the first line of the first used unit after the erased one ahead of logLoc
+uint32_t logFirst() {
+  if(logLoc == logStart) {return logStart;}
+  uint16_t n = logUnits();
+  uint16_t u = logUnitOf(logLoc - 1);
+  for(uint16_t i = 2; i < n; i++) {
+    uint16_t k = (u + i) % n;
+    if(pageUsed((logStart + (uint32_t)k * logUnit) / pgSize)) {return logUnitLine(k);}
+  }
+  return logUnitLine(u);
+}
+
+//Check that a log line starts at loc (or that loc is logLoc)
+bool logHolds(uint32_t loc) {
+  if((loc < logStart) || (loc > logLast + 5) || ((loc - logStart) % 5 != 0)) {return 0;}
+  return logBytes(loc) <= logBytes(logFirst());
+}
+
+//Find the end of the log lines at startup: in the used unit of the ring that is followed by an erased one (the last
+//unit if they are all used). hint = logLoc from the journal.
+uint32_t getLogLoc(uint32_t hint) {
+  uint16_t n = logUnits();
+  uint16_t used = 0;                                 //one bit for each unit
+  for(uint16_t k = 0; k < n; k++) {
+    if(pageUsed((logStart + (uint32_t)k * logUnit) / pgSize)) {used |= 1 << k;}
+  }
+  if(!used) {return logStart;}
+  uint16_t u = n - 1;
+  for(uint16_t k = 0; k < n; k++) {
+    if(bitRead(used, k) && !bitRead(used, (k + 1) % n)) {u = k;}
+  }
+  uint32_t a = logStart + (uint32_t)u * logUnit;
+  uint32_t loc = getMemLoc(a, a + logUnit - pgSize, hint);
+  return logStart + (loc - logStart + 4) / 5 * 5;    //(past a line cut short by a power failure)
+}
+
+//Erase unit u of the log ring, ahead of the lines being written. Lines in it that are not on the SD card yet are
+//lost, so logExp moves on past them.
+void eraseLogUnit(uint16_t u) {
+  uint32_t a = logStart + (uint32_t)u * logUnit;
+  if(!pageUsed(a / pgSize)) {return;}
+  uint32_t e = logWrap(logExp);
+  uint32_t next = logUnitLine((u + 1) % logUnits());
+  if((logExp != logLoc) && (e >= a) && ((e < next) || (next == logStart))) {
+    if(Debug) {serial.println("Log lines not on the SD card written over");}
+    logExp = next;
+  }
+  eraseCmd(chip->nor ? chip->blkOp : 0x81, a / pgSize);   //(a page erase takes about 12 ms, a NOR block erase 45 ms)
+}
+
+//Check for data at the beginning of a page. A line is at most 12 bytes long and ends with a byte that is never 0xFF,
+//so any page with data has a non-0xFF byte among its first 12 bytes.
+bool pageUsed(uint32_t pg) {
+  char ccc[12];
+  readFlash(pg * pgSize, ccc, 12);
+  for(uint8_t i = 0; i < 12; i++) {
+     if(ccc[i] != 0xFF) {return 1;}
+  }
+  return 0;
+}
+
+//Rewrite bytes of page 0. That erases the page (read-modify-write, or the block erase of writeNOR()), so the settings
+//(bytes 0-63) as they are to be afterwards are first copied to cpyLoc with a CRC, and the copy is used up (its mark
+//cleared) once the rewrite is done. A copy that is still there at startup is put back by restorePage0().
+void writePage0(uint16_t loc, char *cArr, uint16_t nchar) {
+  char *cp = scratchTake(jrnStart + 3);
+  readFlash(0, cp, jrnStart);
+  for(uint16_t i = 0; i < nchar; i++) {
+    if(loc + i < jrnStart) {cp[loc + i] = cArr[i];}
+  }
+  uint16_t crc = crc16k(0x0000, (uint8_t*)cp, jrnStart);
+  cp[jrnStart] = crc & 0xFF; cp[jrnStart + 1] = crc >> 8;
+  cp[jrnStart + 2] = cpyMark;                    //mark last, so a copy cut short by a power failure is not used
+  writeFlash(cpyLoc, cp, jrnStart + 3);
+  writeFlash(loc, cArr, nchar);
+  cp[0] = 0;
+  programFlash(cpyLoc + jrnStart + 2, cp, 1);    //clearing the mark needs no erase
+  scratchGive(cp);
+}
+
+//Put the settings of page 0 back from their copy if the power failed while writePage0() was rewriting page 0. The
+//journal is left as it is (entries cut short fail their CRC). If the power fails again the copy is still there.
+void restorePage0() {
+  char *cp = scratchTake(jrnStart + 3);
+  char *pg = scratchTake(jrnStart);
+  readFlash(cpyLoc, cp, jrnStart + 3);
+  uint16_t crc = crc16k(0x0000, (uint8_t*)cp, jrnStart);
+  if(((uint8_t)cp[jrnStart + 2] == cpyMark) && (crc == ((uint8_t)cp[jrnStart + 1] << 8) + (uint8_t)cp[jrnStart])) {
+    readFlash(0, pg, jrnStart);
+    if(memcmp(pg, cp, jrnStart) != 0) {
+      serial.println("Power failed while page 0 was written - restoring the settings");
+      writeFlash(0, cp, jrnStart);
+    }
+    cp[0] = 0;
+    programFlash(cpyLoc + jrnStart + 2, cp, 1);
+  }
+  scratchGive(cp);
+}
+
+//Earlier firmware logged on into page 7, which now holds the settings copy. The first startup moves any lines there
+//to the start of the log ring (its pages they go in and the one after are erased first, losing those oldest lines),
+//erases page 7 and sets ringMark in page 0 by programming only that byte. If the power fails before that, it is
+//simply done again.
+void moveOldLog() {
+  char rm[1];
+  readFlash(ringByte, rm, 1);
+  if(rm[0] == ringMark) {return;}
+  uint32_t end = getMemLoc(cpyLoc, cpyLoc + logUnit - pgSize, 0);   //end of the lines in page 7 (block 5 on NOR flash)
+  uint32_t from = logLast + 5;                                       //first line past the end of the ring
+  if(end > cpyLoc) {
+    serial.println("Moving log lines out of page 7");
+    uint32_t n = end - from;
+    for(uint16_t u = 0; u <= logUnitOf(logStart + n - 1) + 1; u++) {
+      eraseCmd(chip->nor ? chip->blkOp : 0x81, (logStart + (uint32_t)u * logUnit) / pgSize);
+    }
+    char *buf = scratchTake(pgSize);                                 //(writeNOR() takes a page buffer as well)
+    for(uint32_t i = 0; i < n; i = i + pgSize) {
+      uint16_t k = (n - i < pgSize) ? n - i : pgSize;
+      readFlash(from + i, buf, k);
+      writeFlash(logStart + i, buf, k);
+    }
+    scratchGive(buf);
+    eraseCmd(chip->nor ? chip->blkOp : 0x81, cpyLoc / pgSize);
+  }
+  rm[0] = ringMark;
+  programFlash(ringByte, rm, 1);
+}
+
+//Get the most recent memLoc, logLoc, expLoc and logExp from the pointer journal in page 0. Returns 0 if there is no good journal entry.
+bool loadMemLoc(uint32_t *mLoc, uint32_t *lLoc, uint32_t *eLoc, uint32_t *lExp) {
+  char *jr = scratchTake(jrnSlot * jrnMax);
+  bool found = 0;
+  readFlash(jrnStart, jr, jrnSlot * jrnSlots);   //read the whole journal at once
+  jrnNext = 0;
+  for(uint8_t i = 0; i < jrnSlots; i++) {
+    char *e = jr + (i * jrnSlot);
+    bool blank = 1;
+    for(uint8_t j = 0; j < jrnSlot; j++) {
+      if(e[j] != 0xFF) {blank = 0;}
+    }
+    if(blank) {break;}                            //Entries are added in order, so the first blank slot ends the journal
+    jrnNext = i + 1;
+    uint16_t crc = crc16k(0x0000, (uint8_t*)e, 16);
+    if(crc == ((uint8_t)e[17] << 8) + (uint8_t)e[16]) {   //Use only complete entries (power could fail while writing one)
+      *mLoc = ((uint32_t)(uint8_t)e[3] << 24) + ((uint32_t)(uint8_t)e[2] << 16) + ((uint32_t)(uint8_t)e[1] << 8) + (uint8_t)e[0];
+      *lLoc = ((uint32_t)(uint8_t)e[7] << 24) + ((uint32_t)(uint8_t)e[6] << 16) + ((uint32_t)(uint8_t)e[5] << 8) + (uint8_t)e[4];
+      *eLoc = ((uint32_t)(uint8_t)e[11] << 24) + ((uint32_t)(uint8_t)e[10] << 16) + ((uint32_t)(uint8_t)e[9] << 8) + (uint8_t)e[8];
+      *lExp = ((uint32_t)(uint8_t)e[15] << 24) + ((uint32_t)(uint8_t)e[14] << 16) + ((uint32_t)(uint8_t)e[13] << 8) + (uint8_t)e[12];
+      found = 1;
+    }
+  }
+  scratchGive(jr);
+  return found;
+}
+
+//Add the current memLoc, logLoc, expLoc and logExp to the pointer journal in page 0. Entries are programmed into blank
+//bytes without erasing the page; only a full journal is rewritten, through writePage0() so the settings are kept.
+void saveMemLoc() {
+  char *jr = scratchTake(jrnSlot * jrnMax);
+  jr[0] = memLoc; jr[1] = memLoc >> 8; jr[2] = memLoc >> 16; jr[3] = memLoc >> 24;
+  jr[4] = logLoc; jr[5] = logLoc >> 8; jr[6] = logLoc >> 16; jr[7] = logLoc >> 24;
+  jr[8] = expLoc; jr[9] = expLoc >> 8; jr[10] = expLoc >> 16; jr[11] = expLoc >> 24;
+  jr[12] = logExp; jr[13] = logExp >> 8; jr[14] = logExp >> 16; jr[15] = logExp >> 24;
+  uint16_t crc = crc16k(0x0000, (uint8_t*)jr, 16);
+  jr[16] = crc & 0xFF; jr[17] = crc >> 8;
+  if(jrnNext >= jrnSlots) {                                   //Journal is full: rewrite it with just this entry
+    for(uint16_t i = jrnSlot; i < jrnSlot * jrnSlots; i++) {jr[i] = 0xFF;}
+    writePage0(jrnStart, jr, jrnSlot * jrnSlots);
+    jrnNext = 1;
+  } else {
+    programFlash(jrnStart + (jrnNext * jrnSlot), jr, jrnSlot);
+    jrnNext++;
+  }
+  scratchGive(jr);
+}
+
+//Find the end of the RFID data in the ring layout. The newest block is found with a binary search over the
+//block sequence numbers: going around the ring from any block with a header, the sequence numbers go up until
+//the newest block and are lower (or blank) after that. The end of data in that block is found with getMemLoc.
+uint32_t getRingLoc(uint32_t hint) {  //hint = location from journal (0 if none)
+  uint16_t nBlk = lastBlk - firstBlk + 1;
+  uint32_t seq;
+  uint16_t w = 0;                        //newest block
+  if((hint > datStart) && (hint <= (uint32_t)(lastBlk + 1) * blkSize)) {   //Check the journal: its block should be the newest
+    uint16_t b = (hint - 1) / blkSize;
+    uint32_t nSeq;
+    if(readBlkHdr(b, &seq) && !(readBlkHdr(nextBlk(b), &nSeq) && (nSeq > seq))) {w = b;}
+  }
+  if(w == 0) {
+    uint16_t r = firstBlk;               //First find a block with a header (erased blocks may come first)
+    uint32_t rSeq;
+    while(!readBlkHdr(r, &rSeq)) {
+      r = nextBlk(r);
+      if(r == firstBlk) {                //No blocks used yet - start the ring
+        blkSeq = 0;
+        openBlock(firstBlk);
+        return memLoc;
+      }
+    }
+    uint16_t lo = 0;                     //Binary search over ring positions after r for the last block with sequence >= rSeq
+    uint16_t hi = nBlk - 1;
+    while(lo < hi) {
+      uint16_t mid = lo + (hi - lo + 1) / 2;
+      uint16_t b = firstBlk + (r - firstBlk + mid) % nBlk;
+      if(readBlkHdr(b, &seq) && (seq >= rSeq)) {lo = mid;} else {hi = mid - 1;}
+    }
+    w = firstBlk + (r - firstBlk + lo) % nBlk;
+    readBlkHdr(w, &seq);
+  }
+  curBlk = w;
+  blkSeq = seq;
+  uint32_t bStart = (uint32_t)w * blkSize;
+  if((hint <= bStart) || (hint > bStart + blkSize)) {hint = bStart;}
+  uint32_t loc = getMemLoc(bStart, bStart + blkSize - pgSize, hint);
+  return (loc < bStart + blkHdr) ? bStart + blkHdr : loc;   //The header ends in blank bytes, so skip past it
+}
+
+//Read a block header. Returns 1 and the sequence number if the block has a header.
+bool readBlkHdr(uint16_t blk, uint32_t *seq) {
+  char hd[5];
+  readFlash((uint32_t)blk * blkSize, hd, 5);
+  if((hd[0] != blkMark1) && (hd[0] != blkMark2)) {return 0;}
+  *seq = ((uint32_t)(uint8_t)hd[4] << 24) + ((uint32_t)(uint8_t)hd[3] << 16) + ((uint32_t)(uint8_t)hd[2] << 8) + (uint8_t)hd[1];
+  return 1;
+}
+
+//Format byte of a block header: blkMark1 (old-style lines), blkMark2 (compressed pages) or 0xFF (erased)
+char blkFormat(uint16_t blk) {
+  char hd[1];
+  readFlash((uint32_t)blk * blkSize, hd, 1);
+  return hd[0];
+}
+
+//Check whether a block is erased (a header is always written before any data in the block)
+bool blockBlank(uint16_t blk) {
+  char hd[blkHdr];
+  readFlash((uint32_t)blk * blkSize, hd, blkHdr);
+  for(uint8_t i = 0; i < blkHdr; i++) {
+    if(hd[i] != 0xFF) {return 0;}
+  }
+  return 1;
+}
+
+//Next block in the ring
+uint16_t nextBlk(uint16_t blk) {
+  return (blk >= lastBlk) ? firstBlk : blk + 1;
+}
+
+//First data location in the ring block that follows the block holding loc
+uint32_t nextBlkLoc(uint32_t loc) {
+  return (uint32_t)nextBlk(loc / blkSize) * blkSize + blkHdr;
+}
+
+//Location of the page header in a page of a compressed block (the first page of a block also holds the block header)
+uint16_t pgOff(uint32_t pg) {
+  return (pg % blkPgs == 0) ? blkHdr : 0;
+}
+
+//In the ring layout, move a location that is past the last record of a page or block on to the first record
+//of the next page or block. Locations at memLoc (the end of the data) are not moved.
+uint32_t ringLoc(uint32_t loc) {
+  char c[1];
+  while(ringMem && (loc != memLoc)) {
+    if((loc / blkSize == memLoc / blkSize) && (loc > memLoc)) {return memLoc;}   //Past the end of the data
+    if(loc % blkSize == 0) {                                   //End of a block - go on to the next block in the ring
+      loc = nextBlkLoc(loc - 1);
+      continue;
+    }
+    char f = blkFormat(loc / blkSize);
+    if(f == 0xFF) {return memLoc;}                             //Erased block - past the end of the data
+    readFlash(loc, c, 1);
+    if(f != blkMark2) {                                        //Block of old-style lines: the rest of the block is empty
+      if(c[0] != 0xFF) {break;}
+      loc = (loc / blkSize + 1) * blkSize;
+      continue;
+    }
+    uint32_t pgEnd = (loc / pgSize + 1) * pgSize;
+    if(loc % pgSize == pgOff(loc / pgSize)) {                        //Start of a compressed page - skip the page header
+      loc = (c[0] == pgMark) ? loc + pgHdr : pgEnd;
+      continue;
+    }
+    if(!(c[0] & 0x80)) {break;}                                //Committed record
+    loc = pgEnd;                                               //The rest of the page is empty (or not committed)
+  }
+  return loc;
+}
+
+//Bytes of RFID data from loc to memLoc, going round the ring (at most the size of the data area)
+uint32_t ringBytes(uint32_t loc) {
+  uint32_t dataEnd = (uint32_t)(lastBlk + 1) * blkSize;
+  uint32_t n = (memLoc >= loc) ? memLoc - loc : (dataEnd - loc) + (memLoc - datStart);
+  return (n < dataEnd - datStart) ? n : dataEnd - datStart;
+}
+
+//Location of the oldest RFID data in flash
+uint32_t firstDataLoc() {
+  if(!ringMem) {return datStart;}
+  uint16_t b = curBlk;
+  uint32_t seq;
+  for(uint8_t i = 0; i < 2; i++) {     //The oldest block follows the erased block ahead of the current block...
+    b = nextBlk(b);
+    if((b != curBlk) && readBlkHdr(b, &seq)) {return (uint32_t)b * blkSize + blkHdr;}
+  }
+  return (uint32_t)firstBlk * blkSize + blkHdr;   //...unless the ring has not gone all the way around yet
+}
+
+//Start writing a new block: write its header with the next sequence number and erase the block after it
+void openBlock(uint16_t blk) {
+  reclaimBlock(blk);                   //Make sure this block is erased (normally done when the previous block was opened)
+  blkSeq++;
+  char hd[5];
+  hd[0] = blkMark2; hd[1] = blkSeq; hd[2] = blkSeq >> 8; hd[3] = blkSeq >> 16; hd[4] = blkSeq >> 24;
+  programFlash((uint32_t)blk * blkSize + 1, hd + 1, 4);   //Sequence number first...
+  programFlash((uint32_t)blk * blkSize, hd, 1);           //...then the block mark, so a block is only used once its header is complete
+  curBlk = blk;
+  memLoc = (uint32_t)blk * blkSize + blkHdr;
+  pgOpen = 0;                          //The first record in the block starts a new page
+  saveMemLoc();
+  eraseDue = 1;                        //Erase the next block ahead of time...
+  if(!idleErase) {eraseAhead();}       //...now, or the next time the reader is idle
+}
+
+//Erase the block after the current block if it is waiting to be erased, so records can always be programmed
+//without an erase.
+void eraseAhead() {
+  if(!eraseDue || !ringMem) {return;}
+  eraseDue = 0;
+  reclaimBlock(nextBlk(curBlk));
+}
+
+//Erase a used block so it can be written again. If it holds data that are not on the SD card yet, they are lost - note this in the log.
+void reclaimBlock(uint16_t blk) {
+  if(blockBlank(blk)) {return;}
+  uint32_t e = expLoc;
+  if(e % blkSize == 0) {e = nextBlkLoc(e - 1);}   //Transfer ended at the very end of a block
+  if(e / blkSize == blk) {             //Oldest data not yet written to SD are in this block
+    if(!overwriting) {logEvent(14);}   //"Data_overwrite_" (only once until the next transfer)
+    overwriting = 1;
+    expLoc = nextBlkLoc(expLoc);
+  }
+  eraseBlock(blk);
+}
+
+//Erase one block (8 pages)
+void eraseBlock(uint16_t blk) {
+  eraseCmd(chip->blkOp, (uint32_t)blk * blkPgs);     // block erase takes about 45 ms
+}
+
+//Store one line of RFID data (old-style line format) in flash and return the location where it was stored.
+//In the ring layout the line is compressed into a record in the current page (see the notes at the top);
+//a new page is started when needed, and a new block when the current block is full.
+uint32_t storeLine(char *line, uint8_t len) {
+  uint32_t oldMem = memLoc;
+  if(!ringMem) {                                           //Old-style memory layout
+    if(memLoc + len > chip->nPgs * pgSize) {                     //Old-style memory is full
+      if(Debug) {serial.println("Flash memory full - transfer data and erase to keep logging");}
+      return oldMem;
+    }
+    memLoc = writeFlash(memLoc, line, len);
+    if((memLoc / pgSize) != (oldMem / pgSize)) {saveMemLoc();}   //update the memory pointer journal when a new page is started
+    return oldMem;
+  }
+  uint8_t idLen = (len == 12) ? 6 : 5;
+  uint32_t t = ((uint32_t)(uint8_t)line[len-1] << 24) + ((uint32_t)(uint8_t)line[len-2] << 16) + ((uint32_t)(uint8_t)line[len-3] << 8) + (uint8_t)line[len-4];
+  char ent[7];                                             //dictionary entry for this tag: tag type and ID
+  tagEntry(line, len, ent);
+  
+  uint8_t idx = 15;                                        //Look for the tag in the dictionary of the current page (15 = new tag)
+  for(uint8_t i = 0; pgOpen && (i < pgDictN); i++) {
+    if(compareArrays(pgDict[i], ent, 0, 0, 7)) {idx = i;}
+  }
+  bool newPg = !pgOpen || (t < pgTime);                    //Start a new page if the clock has gone backward
+  
+  char rec[16];
+  uint8_t rl = 0;
+  for(uint8_t k = 0; k < 2; k++) {                         //Build the record (again for a new page if it does not fit)
+    if(newPg) {idx = 15;}
+    uint32_t d = newPg ? 0 : t - pgTime;
+    rl = 0;
+    rec[rl++] = (idx << 3) | (line[0] & 0x07);
+    if(idx == 15) {                                        //New tag: tag type and ID
+      for(uint8_t i = 0; i <= idLen; i++) {rec[rl++] = ent[i];}
+    }
+    if(len == 12) {rec[rl++] = line[7];}                   //temperature byte
+    do {
+      rec[rl] = d & 0x7F;
+      d = d >> 7;
+      if(d) {rec[rl] |= 0x80;}
+      rl++;
+    } while(d);
+    if(newPg || (memLoc + rl <= ((memLoc - 1) / pgSize + 1) * pgSize)) {break;}
+    newPg = 1;
+  }
+  rdPg = 0xFFFFFFFF;                                       //page buffer is out of date
+  char c0 = rec[0];
+  rec[0] = c0 | 0x80;                                      //The record is written with the top bit of its first byte set...
+  
+  if(newPg) {
+    uint32_t pg = (memLoc - 1) / pgSize + 1;                  //Start a new page after the page holding the last record...
+    if(!pgOpen && (memLoc % pgSize == pgOff(memLoc / pgSize))) {pg = memLoc / pgSize;}   //...or at memLoc if nothing has been written there
+    if(pgOpen) {sealPage();}                               //No more records will go into the last page
+    if(pg / blkPgs != curBlk) {                                 //Block is full
+      openBlock(nextBlk(curBlk));
+      pg = (uint32_t)curBlk * blkPgs;
+    }
+    uint32_t seq = blkSeq * blkPgs + (pg % blkPgs);
+    char pb[pgHdr + 16];
+    for(uint8_t i = 0; i < pgHdr; i++) {pb[i] = 0xFF;}
+    pb[0] = pgMark;
+    pb[1] = seq; pb[2] = seq >> 8; pb[3] = seq >> 16; pb[4] = seq >> 24;
+    pb[5] = t; pb[6] = t >> 8; pb[7] = t >> 16; pb[8] = t >> 24;
+    for(uint8_t i = 0; i < rl; i++) {pb[pgHdr+i] = rec[i];}
+    memLoc = pg * pgSize + pgOff(pg);
+    oldMem = memLoc + pgHdr;
+    programFlash(memLoc, pb, pgHdr + rl);                  //page header and first record in one write
+    memLoc = oldMem + rl;
+    pgOpen = 1;
+    pgDictN = 0;
+    pgCount = 0;
+    pgMix = 0;
+    pgAnt = 0;
+    pgCRC = 0;
+    for(uint8_t i = 0; i < 32; i++) {pgBloom[i] = 0;}
+  } else {
+    programFlash(memLoc, rec, rl);
+    memLoc = memLoc + rl;
+  }
+  rec[0] = c0;
+  programFlash(oldMem, rec, 1);                            //...and then committed by clearing that bit
+  if(oldMem % pgSize == (uint32_t)(pgOff(oldMem / pgSize) + pgHdr)) {saveMemLoc();}   //update the memory pointer journal when a new page is started
+  if((idx == 15) && (pgDictN < dictLen)) {                 //Add a new tag to the dictionary
+    for(uint8_t i = 0; i < 7; i++) {pgDict[pgDictN][i] = ent[i];}
+    pgDictN++;
+  }
+  pgTime = t;
+  pgCount++;                                               //Keep track of what is in the page for its header
+  pgMix |= (len == 12) ? 2 : 1;
+  pgAnt |= 1 << (line[0] & 0x07);
+  pgCRC = crc16k(pgCRC, (uint8_t*)rec, rl);
+  bloomAdd(pgBloom, ent);
+  return oldMem;
+}
+
+//Make the dictionary entry of a tag (tag type and ID; EM4100 IDs are padded with a zero) from a line in the old-style line format
+void tagEntry(char *line, uint8_t len, char *ent) {
+  for(uint8_t i = 0; i < 7; i++) {ent[i] = 0;}
+  ent[0] = line[0] & 0x80;
+  for(uint8_t i = 1; i < ((len == 12) ? 7 : 6); i++) {ent[i] = line[i];}
+}
+
+//Get the 3 Bloom filter bit numbers (0-255) of a tag from a hash (FNV-1a) of its dictionary entry
+void bloomBits(char *ent, uint8_t *bits) {
+  uint32_t h = 2166136261;
+  for(uint8_t i = 0; i < 7; i++) {
+    h = (h ^ (uint8_t)ent[i]) * 16777619;
+  }
+  bits[0] = h;
+  bits[1] = h >> 8;
+  bits[2] = h >> 16;
+}
+
+//Add a tag to a 32-byte Bloom filter
+void bloomAdd(char *bf, char *ent) {
+  uint8_t bits[3];
+  bloomBits(ent, bits);
+  for(uint8_t i = 0; i < 3; i++) {bf[bits[i] >> 3] |= 1 << (bits[i] & 0x07);}
+}
+
+//Check a 32-byte Bloom filter for a tag. Returns 0 if the tag is certainly not there.
+bool bloomTest(char *bf, char *ent) {
+  uint8_t bits[3];
+  bloomBits(ent, bits);
+  for(uint8_t i = 0; i < 3; i++) {
+    if(!(bf[bits[i] >> 3] & (1 << (bits[i] & 0x07)))) {return 0;}
+  }
+  return 1;
+}
+
+//Fill in the rest of the header of the current page (last time, record count, tag types, antennas, Bloom filter and CRC)
+//once no more records will be added to it, then the seal mark.
+void sealPage() {
+  uint32_t pg = (memLoc - 1) / pgSize;
+  uint32_t hLoc = pg * pgSize + pgOff(pg);
+  char hd[pgHdr];
+  readFlash(hLoc, hd, 9);                 //page mark, sequence number and base time
+  hd[9] = pgTime; hd[10] = pgTime >> 8; hd[11] = pgTime >> 16; hd[12] = pgTime >> 24;
+  hd[13] = pgCount; hd[14] = pgCount >> 8;
+  hd[15] = pgMix;
+  hd[16] = pgAnt;
+  for(uint8_t i = 0; i < 32; i++) {hd[17+i] = pgBloom[i];}
+  uint16_t crc = crc16k(pgCRC, (uint8_t*)hd + 1, 48);
+  hd[49] = crc; hd[50] = crc >> 8;
+  programFlash(hLoc + 9, hd + 9, pgHdr - 10);
+  hd[51] = 0x00;
+  programFlash(hLoc + 51, hd + 51, 1);    //Seal mark last, once the rest of the header is complete
+  pgOpen = 0;
+  rdPg = 0xFFFFFFFF;                      //page buffer is out of date
+}
+
+//Read a page into buf and check it. Returns 0 if it is not a compressed page, 1 if the page is still open
+//(header not filled in yet), 2 if the page is sealed and its CRC is good, 3 if the CRC is bad.
+uint8_t checkPage(uint32_t pg, char *buf) {
+  readFlash(pg * pgSize, buf, pgSize);
+  if(!ringMem || (blkFormat(pg / blkPgs) != blkMark2)) {return 0;}
+  char *hd = buf + pgOff(pg);
+  if(hd[0] != pgMark) {return 0;}
+  if(hd[51] != 0x00) {return 1;}         //Not sealed (or power failed while sealing) - records are read up to the first one not committed
+  uint16_t n = hd[13] + (hd[14] << 8);   //Find the end of the records by decoding them
+  uint16_t r = pgOff(pg) + pgHdr;
+  uint32_t t = ((uint32_t)(uint8_t)hd[8] << 24) + ((uint32_t)(uint8_t)hd[7] << 16) + ((uint32_t)(uint8_t)hd[6] << 8) + (uint8_t)hd[5];
+  uint16_t dict[15];
+  uint8_t dictN = 0;
+  char line[12];
+  uint8_t len;
+  for(uint16_t i = 0; i < n; i++) {
+    uint8_t b = decodeRec(buf, r, &t, dict, &dictN, line, &len);
+    if(b == 0) {return 3;}
+    r = r + b;
+  }
+  uint16_t crc = 0x0000;
+  for(uint16_t i = pgOff(pg) + pgHdr; i < r; i = i + 255) {   //crc16k() takes up to 255 bytes at a time
+    crc = crc16k(crc, (uint8_t*)buf + i, (r - i > 255) ? 255 : r - i);
+  }
+  crc = crc16k(crc, (uint8_t*)hd + 1, 48);
+  return (crc == hd[49] + (hd[50] << 8)) ? 2 : 3;
+}
+
+//After a restart, get ready to add records to the page holding the end of the data: rebuild its dictionary and
+//find the time of its last record. A block of old-style lines is closed and a new (compressed) block is started.
+void resumePage() {
+  pgOpen = 0;
+  if(blkFormat(curBlk) != blkMark2) {
+    openBlock(nextBlk(curBlk));
+    return;
+  }
+  uint32_t pg = (memLoc - 1) / pgSize;
+  uint16_t off = pgOff(pg);
+  rdPg = 0xFFFFFFFF;
+  if(checkPage(pg, rdPage) != 1) {return;}   //Page not started yet, or already sealed
+  memLoc = (pg + 1) * pgSize;                //Unless the page can be resumed the next record starts a new page
+  uint32_t t = ((uint32_t)(uint8_t)rdPage[off+8] << 24) + ((uint32_t)(uint8_t)rdPage[off+7] << 16) + ((uint32_t)(uint8_t)rdPage[off+6] << 8) + (uint8_t)rdPage[off+5];
+  uint32_t r = pg * pgSize + off + pgHdr;    //first record
+  char line[12];
+  uint8_t len;
+  rdDictN = 0;
+  pgCount = 0;
+  pgMix = 0;
+  pgAnt = 0;
+  pgCRC = 0;
+  for(uint8_t i = 0; i < 32; i++) {pgBloom[i] = 0;}
+  while((r < memLoc) && !(rdPage[r - pg * pgSize] & 0x80)) {   //Committed records
+    uint8_t n = decodeRec(rdPage, r - pg * pgSize, &t, rdDict, &rdDictN, line, &len);
+    if(n == 0) {return;}                  //Bad record - the next record will start a new page
+    pgCount++;
+    pgMix |= (len == 12) ? 2 : 1;
+    pgAnt |= 1 << (line[0] & 0x07);
+    pgCRC = crc16k(pgCRC, (uint8_t*)rdPage + (r - pg * pgSize), n);
+    char ent[7];
+    tagEntry(line, len, ent);
+    bloomAdd(pgBloom, ent);
+    r = r + n;
+  }
+  for(uint16_t i = r - pg * pgSize; i < pgSize; i++) {   //A record that was not committed (power failed while it was
+    if(rdPage[i] != 0xFF) {return;}                 //being written) cannot be written over
+  }
+  for(uint16_t i = off + 9; i < off + pgHdr; i++) {   //Nor can a seal that was not finished
+    if(rdPage[i] != 0xFF) {return;}
+  }
+  memLoc = r;
+  for(pgDictN = 0; pgDictN < rdDictN; pgDictN++) {
+    char *e = rdPage + rdDict[pgDictN];
+    for(uint8_t i = 0; i < 7; i++) {pgDict[pgDictN][i] = 0;}
+    for(uint8_t i = 0; i < ((e[0] & 0x80) ? 7 : 6); i++) {pgDict[pgDictN][i] = e[i];}
+  }
+  pgTime = t;
+  pgOpen = 1;
+}
+
+//Decode one compressed record from a page held in RAM. pos = location of the record in the page, *t = time of the
+//previous record (updated to the time of this record), dict and *dictN = locations of the tags in the page dictionary
+//(a new tag is added). The record is put into line in the old-style line format and the line length (10 or 12)
+//goes in *len. Returns the number of bytes in the record (0 if it is not valid).
+uint8_t decodeRec(char *pgBuf, uint16_t pos, uint32_t *t, uint16_t *dict, uint8_t *dictN, char *line, uint8_t *len) {
+  uint16_t p = pos;
+  char b = pgBuf[p++];
+  if(b & 0x80) {return 0;}
+  uint16_t e;                                   //location of the tag type and ID
+  if((b >> 3) == 15) {                          //New tag - type and ID are in the record
+    e = p;
+    if((pgBuf[e] != 0x00) && (pgBuf[e] != 0x80)) {return 0;}
+    p = p + ((pgBuf[e] & 0x80) ? 7 : 6);
+    if(p > pgSize) {return 0;}
+    if(*dictN < dictLen) {dict[(*dictN)++] = e;}
+  } else {
+    if((b >> 3) >= *dictN) {return 0;}
+    e = dict[b >> 3];
+  }
+  line[0] = pgBuf[e] | (b & 0x07);
+  *len = 10;
+  if(pgBuf[e] & 0x80) {                         //ISO tag - 6 ID bytes and a temperature byte
+    for(uint8_t i = 1; i < 7; i++) {line[i] = pgBuf[e+i];}
+    if(p >= pgSize) {return 0;}
+    line[7] = pgBuf[p++];
+    *len = 12;
+  } else {
+    for(uint8_t i = 1; i < 6; i++) {line[i] = pgBuf[e+i];}
+  }
+  uint32_t d = 0;
+  uint8_t sh = 0;
+  char c;
+  do {                                          //time difference
+    if((p >= pgSize) || (sh > 28)) {return 0;}
+    c = pgBuf[p++];
+    d |= (uint32_t)(c & 0x7F) << sh;
+    sh = sh + 7;
+  } while(c & 0x80);
+  *t = *t + d;
+  if(!goodTime(*t)) {return 0;}
+  line[*len-4] = *t; line[*len-3] = *t >> 8; line[*len-2] = *t >> 16; line[*len-1] = *t >> 24;
+  return p - pos;
+}
+
+//Read the RFID data line at loc (old-style line format, compressed records are expanded) and move loc on to the
+//next line. Returns the line length (10 or 12), or 0 if there is no valid line at loc.
+uint8_t readLine(uint32_t *loc, char *line) {
+  uint8_t len = 0;
+  uint32_t pg = *loc / pgSize;
+  if(!ringMem || ((pg != rdPg) && (blkFormat(*loc / blkSize) != blkMark2))) {   //Old-style line
+    readFlash(*loc, line, 12);
+    len = lineOK(line);
+    if(len) {*loc = ringLoc(*loc + len);}
+    return len;
+  }
+  uint16_t off = pgOff(pg);
+  if(pg != rdPg) {                              //Read in the whole page and check it
+    rdState = checkPage(pg, rdPage);
+    rdPg = pg;
+    rdNext = 0;
+  }
+  if((rdState != 1) && (rdState != 2)) {return 0;}
+  if(*loc != rdNext) {                          //Decode the page up to loc to get the dictionary and the time of the record before loc
+    rdNext = pg * pgSize + off + pgHdr;
+    rdTime = ((uint32_t)(uint8_t)rdPage[off+8] << 24) + ((uint32_t)(uint8_t)rdPage[off+7] << 16) + ((uint32_t)(uint8_t)rdPage[off+6] << 8) + (uint8_t)rdPage[off+5];
+    rdDictN = 0;
+    while(rdNext < *loc) {
+      uint8_t n = decodeRec(rdPage, rdNext - pg * pgSize, &rdTime, rdDict, &rdDictN, line, &len);
+      if(n == 0) {return 0;}
+      rdNext = rdNext + n;
+    }
+    if(rdNext != *loc) {return 0;}
+  }
+  uint8_t n = decodeRec(rdPage, *loc - pg * pgSize, &rdTime, rdDict, &rdDictN, line, &len);
+  if(n == 0) {return 0;}
+  rdNext = *loc + n;
+  *loc = rdNext;
+  if((rdNext % pgSize == 0) || (rdPage[rdNext % pgSize] & 0x80)) {*loc = ringLoc(rdNext);}   //End of the committed records in this page
+  return len;
+}
+
+//Check an RFID data line in the old-style line format: the tag type and antenna (first byte) and the time must be
+//good. Returns the line length (10 or 12), or 0 if the line is not valid.
+uint8_t lineOK(char *line) {
+  uint8_t len = 0;
+  if((line[0] == 1) || (line[0] == 2)) {len = 10;}
+  if((line[0] == 129) || (line[0] == 130)) {len = 12;}
+  if(len && !goodTime(lineTime(line, len))) {len = 0;}
+  return len;
+}
+
+//Time of an RFID data line in the old-style line format
+uint32_t lineTime(char *line, uint8_t len) {
+  return ((uint32_t)(uint8_t)line[len-1] << 24) + ((uint32_t)(uint8_t)line[len-2] << 16) + ((uint32_t)(uint8_t)line[len-3] << 8) + (uint8_t)line[len-4];
+}
+
+//Check that a time read from flash is possible (years 2000 to 2099, as kept by the clock)
+bool goodTime(uint32_t t) {
+  return (t >= 946684800) && (t < 4102444800);
+}
+
+//Find the next good RFID data after damaged data at *loc (where readLine() failed), report the damaged bytes and
+//move *loc on to the good data. Compressed pages are checked on their own, so the rest of a damaged page is
+//skipped. Old-style lines are searched for one byte at a time: a line is taken as good when it and the two lines
+//after it have good tag types and times, with no time earlier than the one before (lines past the end of the
+//data or block are not needed). Returns the number of bytes skipped.
+uint32_t resyncLine(uint32_t *loc) {
+  uint32_t start = *loc;
+  uint32_t p;
+  if(ringMem && (blkFormat(start / blkSize) == blkMark2)) {
+    p = (start / pgSize + 1) * pgSize;                       //Rest of the page
+  } else {
+    uint32_t lim = memLoc;                             //Search to the end of the data...
+    if(ringMem && ((start / blkSize != memLoc / blkSize) || (memLoc < start))) {lim = (start / blkSize + 1) * blkSize;}   //...or the block
+    char ln[36];
+    for(p = start + 1; p < lim; p++) {
+      readFlash(p, ln, 36);
+      uint8_t i = 0;                                   //Position of the line being checked in ln
+      uint32_t t = 0;                                  //Time of the line before it
+      uint8_t nOK = 0;                                 //Number of good lines in a row
+      while(nOK < 3) {
+        if(p + i >= lim) {break;}                      //End of the data
+        if(ringMem && (nOK > 0) && (ln[i] == 0xFF)) {break;}   //End of an old-style block
+        uint8_t n = lineOK(ln + i);
+        if((n == 0) || (lineTime(ln + i, n) < t)) {nOK = 0; break;}
+        t = lineTime(ln + i, n);
+        i = i + n;
+        nOK++;
       }
+      if(nOK) {break;}
     }
-    serial.print("Problem finding memory location");
-    return 4224;
+  }
+  serial.print("Damaged data skipped: flash bytes "); serial.print(start, DEC); serial.print(" to "); serial.println(p - 1, DEC);
+  *loc = ringLoc(p);
+  return p - start;
+}
+
+//Make a text line (as written to the SD card) from an RFID data line in the old-style line format
+void formatLine(char *BA, char *text) {
+  uint8_t t = (BA[0] & 0x80) ? 8 : 6;   //time bytes follow the ISO (8) or EM4100 (6) tag data
+  unixTime.b1 = BA[t]; unixTime.b2 = BA[t+1]; unixTime.b3 = BA[t+2]; unixTime.b4 = BA[t+3];
+  convertUnix(unixTime.unixLong);  // convert unix time. Time values get stored in array timeIn, bytes 0 through 5.
+  formatTagLine(BA, timeIn, text);
 }
 
-bool writeSDLine(String fName, uint8_t mess, char *BA) {
+bool writeSDLine(const char *fName, uint8_t mess, char *BA) {   //BA is a text line, or the raw line (log line) for binary files
   bool success = 0;       // valriable to indicate success of operation
   SDstart();                                        // start up the SD card
+  if(binFmt) {                                      // Binary file: add the raw line
+    uint32_t nRec;
+    File bFile = openBin(fName, mess ? 'L' : 'D', &nRec, 0);
+    if(bFile) {
+      uint8_t n = mess ? 5 : ((BA[0] & 0x80) ? 12 : 10);
+      success = (bFile.write((uint8_t*)BA, n) == n);
+      success = closeBin(bFile, nRec + 1) && success;
+    }
+    SDstop();
+    return success;
+  }
   File dFile = SD.open(fName, FILE_WRITE);          // Open the file
   if (dFile) {                                      // If the file is opened successfully...
+     const char *text = BA;
      if(mess !=0) {                                 // write if it is a log file
-        getLogMessage(mess); //Log message gets loaded into logMess
         unixTime.b1 = BA[1]; unixTime.b2 = BA[2]; unixTime.b3 = BA[3]; unixTime.b4 = BA[4];
-        convertUnix(unixTime.unixLong);  // covert unix time. Time values get stored in array timeIn, bytes 0 through 5.
-        static char text[22]; 
-        sprintf(text, ", %02d/%02d/%04d %02d:%02d:%02d", timeIn[0], timeIn[1], timeIn[2], timeIn[3], timeIn[4], timeIn[5]);
-        text[21] = '\0';
-        
-        dFile.print(logMess);  // write log message
-        dFile.println(text);     // write date/time and new line      
+        logLineText(mess, unixTime.unixLong, cArray2);
+        text = cArray2;                             // log message, date/time (or figure)
       }
-      if(mess == 0) {   
-        dFile.println(BA);
-      }
-      success = 1;                                         // ...note success of operation...
-      dFile.close();                                       // ...close the file...
+      success = (dFile.println(text) == strlen(text) + 2);   // ...note success of operation (the whole line and CR LF)...
+      success = sdClose(dFile) && success;                   // ...close the file...
   }
   SDstop();                                              // Disable SD
   //fName[5] = 'D';                                        // Make sure fName is set to the RFID data file
   return success;                                        // Indicates success (1) or failure (0)
 }
 
+//Queue an RFID line for the SD card in logging mode S (BA is a text line, or the raw line for binary files;
+//fromLoc is memLoc before the line was stored). Starting the SD card for every read adds about 50 ms to the
+//read loop and wears the card, so lines are collected in sdQueue and written together by flushSDQueue() once
+//there are sdBatchLines of them or the oldest is sdBatchSecs old, while no tag is present. The flash memory
+//always has the lines, so a power failure only loses them from the card until the next sync.
+void queueSDLine(char *BA, uint32_t fromLoc) {
+  uint8_t n = binFmt ? ((BA[0] & 0x80) ? 12 : 10) : strlen(BA) + 2;
+  if(sdQueueN + n > sizeof(sdQueue)) {flushSDQueue();}    //Queue is full - write it now
+  if(sdQueueLines == 0) {
+    sdQueueTime = clockNow();
+    sdQueueFrom = fromLoc;
+  }
+  memcpy(sdQueue + sdQueueN, BA, binFmt ? n : n - 2);
+  if(!binFmt) {sdQueue[sdQueueN + n - 2] = '\r'; sdQueue[sdQueueN + n - 1] = '\n';}
+  sdQueueN = sdQueueN + n;
+  sdQueueLines++;
+  sdQueueTo = memLoc;
+}
+
+//Write the queued RFID lines to the SD card data file with one start of the card. If the card was up to date
+//when the first line was queued, it still is, and the sync state is saved.
+void flushSDQueue() {
+  if(sdQueueLines == 0) {return;}
+  bool success = 0;
+  SDstart();
+  if(binFmt) {
+    uint32_t nRec;
+    File bFile = openBin(dataFile, 'D', &nRec, 0);
+    if(bFile) {
+      success = (bFile.write((uint8_t*)sdQueue, sdQueueN) == sdQueueN);
+      success = closeBin(bFile, nRec + sdQueueLines) && success;
+    }
+  } else {
+    File dFile = SD.open(dataFile, FILE_WRITE);
+    if(dFile) {
+      success = (dFile.write((uint8_t*)sdQueue, sdQueueN) == sdQueueN);
+      success = sdClose(dFile) && success;
+    }
+  }
+  if(success && (expLoc == sdQueueFrom)) {
+    expLoc = sdQueueTo;
+    saveSyncState();
+  }
+  SDstop();
+  if(Debug) {serial.print(sdQueueLines); serial.println(success ? " lines written to SD card" : " lines not written to SD card");}
+  sdQueueN = 0;
+  sdQueueLines = 0;
+}
+
 ///////Sleep Function/////////////Sleep Function/////////
 
 void lpSleep() {
@@ -1533,6 +3737,7 @@ void lpSleep() {
 
   __WFI();    //Enter sleep mode
   //...Sleep...wait for interrupt
+  evCount[evWake]++;
   USB->DEVICE.CTRLA.reg |= USB_CTRLA_ENABLE;         // enable USB
   detachInterrupt(INT1);                             // turn interrupt off
   SysTick->CTRL  |= SysTick_CTRL_ENABLE_Msk;         // Enable clock
@@ -0,0 +1,29 @@
+/*
+ * IdleHal.h
+ *
+ * The one piece of hardware the idle waits of the sketch need: stop the CPU until the next interrupt. On the
+ * SAMD21 this is IDLE0 sleep (clocks, SysTick, USB and the pin interrupts keep running), so with SysTick on the
+ * CPU is at most 1 ms away from waking. cpuIdle() and idleDelay() in ETAG_V10.ino are built on halIdle() and do
+ * the power accounting. On other targets halIdle() is only declared here, so a host build of the sketch supplies
+ * its own (for example one that moves a simulated clock on to its next tick).
+ */
+
+#ifndef IDLEHAL_H_
+#define IDLEHAL_H_
+
+void halIdle();
+
+#if defined(ARDUINO_ARCH_SAMD)
+void halIdle() {
+  uint32_t scr = SCB->SCR;
+  uint32_t sleepMode = PM->SLEEP.reg;
+  SCB->SCR = scr & ~SCB_SCR_SLEEPDEEP_Msk;         // idle sleep, not standby (lpSleep())
+  PM->SLEEP.reg = PM_SLEEP_IDLE_CPU;                // only the CPU clock stops
+  __DSB();
+  __WFI();
+  PM->SLEEP.reg = sleepMode;                        // put the sleep settings back as they were
+  SCB->SCR = scr;
+}
+#endif
+
+#endif
@@ -24,7 +24,7 @@
 /**********Included Needed Files********************/
 #include <Wire.h>
 #include <SPI.h>
-#include <SD.h>              // include the standard SD card library
+#include "TextCodec.h"         // hex digits for the tag ID strings
 
 /***********Include needed constants to set up pins***********/
 #define serial SerialUSB     // Designate the USB connection as the primary serial comm port
@@ -63,17 +63,17 @@ byte RFIDbyteCounter;                 // Counts the number of bytes that have go
 byte RFIDbytes[16];                   // Array of bytes for storing all RFID tag data (ID code and parity bits)
 uint8_t messageBytes;                 // Number of bytes in RFID message (5 for EM4100; 8 for normal ISO; 
 int IntPin;                           // Pin for RFID input (interrupt pin)
-uint16_t temp[600];
-uint16_t tc = 0;
 
 /******************Functions Declarations***********************/
-void processTag(byte *RFIDtagArray, char *RFIDstring, byte RFIDtagUser, unsigned long *RFIDtagNumber);
+void processTag(byte *RFIDtagArray, char *RFIDstring, byte RFIDtagUser, uint32_t *RFIDtagNumber);
 //checks if there is a parity fail when a pulse has been detected, if the parity is fine, then the tag will start reading in data.
 byte FastRead(byte whichCircuit, unsigned int checkDelay, unsigned int readTime);
 byte ISOFastRead(byte whichCircuit, unsigned int checkDelay, unsigned int readTime);
 void INT_demodOut();
 void ISOINT_demodOut();
 void shutDownRFID();
+void cpuIdle();                       // idle waits with power accounting (in ETAG_V10.ino, built on IdleHal.h)
+void idleDelay(uint32_t ms);
 uint16_t crc16k(uint16_t crc, uint8_t *mem, uint8_t len);
 
 /*********************Functions Definitions*************************/
@@ -83,42 +83,19 @@ uint16_t crc16k(uint16_t crc, uint8_t *mem, uint8_t len);
  *      RFIDtagArray - byte array of length 5 to store the individual bytes of a Tag ID
  *      RFIDstring - charArray(String) of length 10 that stores the TagID
  *      RFIDtagUser - byte that stores the first(most signficant) byte of a tag ID(user #)
- *      RFIDtagNumber - unsigned long that stores bytes 1 through 4 of a tag ID(user #)
+ *      RFIDtagNumber - uint32_t that stores bytes 1 through 4 of a tag ID(user #)
  * @return -
  *      nothing
  */
-void processTag(byte *RFIDtagArray, char *RFIDstring, byte RFIDtagUser, unsigned long *RFIDtagNumber)
+void processTag(byte *RFIDtagArray, char *RFIDstring, byte RFIDtagUser, uint32_t *RFIDtagNumber)
 {
-  // process each byte (could do a loop but.....)
-  RFIDtagArray[0] = ((RFIDbytes[0] << 3) & 0xF0) + ((RFIDbytes[1] >> 1) & 0x0F);
-  String StringOne = String(RFIDtagArray[0], HEX);
-  if(RFIDtagArray[0] < 0x10) {StringOne = String("0" + StringOne);}
+  for(uint8_t i = 0; i < 5; i++) {
+    RFIDtagArray[i] = ((RFIDbytes[i * 2] << 3) & 0xF0) + ((RFIDbytes[i * 2 + 1] >> 1) & 0x0F);
+    putHex2(RFIDstring + i * 2, RFIDtagArray[i]);   // upper case hex digits
+  }
+  RFIDstring[10] = '\0';
   RFIDtagUser = RFIDtagArray[0];
-
-  RFIDtagArray[1] = ((RFIDbytes[2] << 3) & 0xF0) + ((RFIDbytes[3] >> 1) & 0x0F);
-  String StringTwo = String(RFIDtagArray[1], HEX);
-  if(RFIDtagArray[1] < 0x10) {StringTwo = String("0" + StringTwo);}
-  *RFIDtagNumber = RFIDtagArray[1] << 24;
-
-  RFIDtagArray[2] = ((RFIDbytes[4] << 3) & 0xF0) + ((RFIDbytes[5] >> 1) & 0x0F);
-  String StringThree = String(RFIDtagArray[2], HEX);
-  if(RFIDtagArray[2] < 0x10) {StringThree = String("0" + StringThree);}
-  *RFIDtagNumber = *RFIDtagNumber + (RFIDtagArray[2] << 16);
-
-  RFIDtagArray[3] = ((RFIDbytes[6] << 3) & 0xF0) + ((RFIDbytes[7] >> 1) & 0x0F);
-  String StringFour = String(RFIDtagArray[3], HEX);
-  if(RFIDtagArray[3] < 0x10) {StringFour = String("0" + StringFour);}
-  *RFIDtagNumber = *RFIDtagNumber + (RFIDtagArray[3] << 8);
-
-  RFIDtagArray[4] = ((RFIDbytes[8] << 3) & 0xF0) + ((RFIDbytes[9] >> 1) & 0x0F);
-  String StringFive = String(RFIDtagArray[4], HEX);
-  if(RFIDtagArray[4] < 0x10) {StringFive = String("0" + StringFive);}
-  *RFIDtagNumber = *RFIDtagNumber + RFIDtagArray[4];
-  String(StringOne + StringTwo + StringThree + StringFour + StringFive).toCharArray(RFIDstring, 11); //updates the RFIDstring with the five new strings
-  do {
-     *RFIDstring = toupper( *RFIDstring );  //capitalize each character in the char array
-     RFIDstring++;
-   } while ( *RFIDstring != '\0' );
+  *RFIDtagNumber = (RFIDtagArray[1] << 24) + (RFIDtagArray[2] << 16) + (RFIDtagArray[3] << 8) + RFIDtagArray[4];
 }
 
 void processISOTag(byte *RFIDtagArray, char *RFIDstring, uint16_t *countryCode, uint8_t *tagTemp, uint32_t *RFIDtagNumber)
@@ -127,12 +104,13 @@ void processISOTag(byte *RFIDtagArray, char *RFIDstring, uint16_t *countryCode,
   *tagTemp = RFIDbytes[10];
   *RFIDtagNumber = (RFIDtagArray[3]<<24) + (RFIDtagArray[2]<<16) + (RFIDtagArray[1]<<8) + RFIDtagArray[0];
   *countryCode = (RFIDtagArray[5]<<2) + (RFIDtagArray[4]>>6);
-  sprintf(RFIDstring, "%03X.%02X%02X%02X%02X%02X", 
-             *countryCode, (RFIDbytes[4] & 0b00111111), RFIDbytes[3], RFIDbytes[2], RFIDbytes[1], RFIDbytes[0]);
-    do {
-     *RFIDstring = toupper( *RFIDstring );  //capitalize each character in the char array
-     RFIDstring++;
-   } while ( *RFIDstring != '\0' );
+  char *p = RFIDstring;                             // "3E7.0123456789"
+  *p++ = hexChars[*countryCode >> 8];
+  p = putHex2(p, *countryCode & 0xFF);
+  *p++ = '.';
+  p = putHex2(p, RFIDbytes[4] & 0b00111111);
+  for(int8_t i = 3; i >= 0; i--) {p = putHex2(p, RFIDbytes[i]);}
+  *p = '\0';
 }
 
 
@@ -178,12 +156,12 @@ byte FastRead(byte whichCircuit, unsigned int checkDelay, unsigned int readTime)
   attachInterrupt(digitalPinToInterrupt(IntPin), INT_demodOut, CHANGE);
 
   // delay(checkTime);
-  delay(checkDelay);
+  idleDelay(checkDelay);                   // the demod pin interrupt counts pulses while the CPU idles
   // serial.print("pulses detected... ");
   // serial.println(pulseCount, DEC);
   if (pulseCount > (checkDelay - 25)) {     // May want a separate variable for threshold pulse count.
     while (millis() < stopMillis & parityFail != 0) {
-      delay(1);
+      cpuIdle();                         // wake on each demod pulse or ms tick to check again
     }
   } else {
     detachInterrupt(digitalPinToInterrupt(IntPin));
@@ -334,12 +312,12 @@ byte ISOFastRead(byte whichCircuit, unsigned int checkDelay, unsigned int readTi
   attachInterrupt(digitalPinToInterrupt(IntPin), ISOINT_demodOut, CHANGE);
 
   // delay(checkTime);
-  delay(checkDelay);
+  idleDelay(checkDelay);                   // the demod pin interrupt counts pulses while the CPU idles
   //serial.print("pulses detected... ");
   //serial.println(pulseCount, DEC);
   if (pulseCount > (checkDelay - 25)) {     // May want a separate variable for threshold pulse count.
       while (millis() < stopMillis & crcOK != 3) {
-        delay(1);
+        cpuIdle();                       // wake on each demod pulse or ms tick to check again
       }
       //serial.print("Exiting read loop... ");
   } else {
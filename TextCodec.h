@@ -0,0 +1,265 @@
+/*
+ * TextCodec.h
+ *
+ * Text form of the RFID data lines and log lines, exactly as they are written to the SD card files
+ * (IDDATA.TXT and IDLOG.TXT). Lines are made with lookup tables for the hex and decimal digits and read back
+ * from fixed character positions, without sprintf(), String or any memory allocation. This file is plain C so
+ * the same code is used by tools/etagbin.c, and tools/codectest.c checks the lines byte for byte against the
+ * sprintf() formats the sketch used before and times both.
+ *
+ * Line layouts (character positions from 0):
+ *   EM4100       "0123456789, 1, 11/14/2023 22:18:20"            34 characters
+ *                 0-9 tag ID (hex), 12 antenna, 15-33 date and time
+ *   ISO11784/5   "3E7.0123456789, 025, 1, 11/14/2023 22:18:20"   43 characters
+ *                 0-2 country code (hex), 3 '.', 4-13 tag ID (hex), 16-18 temperature, 21 antenna, 24-42 date and time
+ *   Log          "Logging_started, 11/14/2023 22:18:20"          36 characters
+ *                 0-14 message, 17-35 date and time
+ *   Log figure   "Reads_stored___,               1234"          36 characters
+ *                 0-14 message, 17-35 the figure, right-aligned (codes 17-21, the totals of the power report)
+ * RFID data lines are given in the old-style line format stored in flash memory (see ETAG_V10.ino). Times are
+ * given as an array of month, day, year, hours, minutes and seconds (the timeIn array of the sketch).
+ */
+
+#ifndef TEXTCODEC_H_
+#define TEXTCODEC_H_
+
+#include <stdint.h>
+#include <string.h>
+
+const char hexChars[] = "0123456789ABCDEF";
+const char decPairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+const uint8_t hexVals[256] = {                  // value of each character as a hex digit ('0' to 'F'; others 0)
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 0, 0, 0, 0, 0,
+  0, 10, 11, 12, 13, 14, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+const char logTexts[11][16] = {"Logging_started", "Going_to_sleep_", "Wake_from_sleep", "Data_overwrite_", "Clock_error____", "Energy_report__",
+                               "Used_charge_mAh", "Sleep_seconds__", "Awake_seconds__", "Reads_stored___", "Flash_writes___"};  // log codes 11-21
+const uint8_t logCodes[26] = {19, 0, 15, 14, 16, 21, 12, 0, 0, 0, 0, 11, 0, 0, 0, 0, 0, 20, 18, 0, 17, 0, 13, 0, 0, 0};  // code of the message starting with 'A' to 'Z' (0 = none)
+
+/*********************Making text*************************/
+// Each function writes its characters at p and returns the position after them.
+
+char *putHex2(char *p, uint8_t b) {             // 2 hex digits (like %02X)
+  p[0] = hexChars[b >> 4];
+  p[1] = hexChars[b & 0x0F];
+  return p + 2;
+}
+
+char *putDec2(char *p, uint8_t v) {             // 2 decimal digits, v = 0 to 99 (like %02d)
+  p[0] = decPairs[v * 2];
+  p[1] = decPairs[v * 2 + 1];
+  return p + 2;
+}
+
+char *putDec3(char *p, uint16_t v) {            // 3 decimal digits, v = 0 to 999 (like %03d)
+  p[0] = '0' + v / 100;
+  return putDec2(p + 1, v % 100);
+}
+
+char *putDec4(char *p, uint16_t v) {            // 4 decimal digits, v = 0 to 9999 (like %04d)
+  return putDec2(putDec2(p, v / 100), v % 100);
+}
+
+char *putDec(char *p, uint8_t v) {              // 1 to 3 decimal digits, no leading zeros (like %d)
+  if(v >= 100) {return putDec3(p, v);}
+  if(v >= 10) {return putDec2(p, v);}
+  p[0] = '0' + v;
+  return p + 1;
+}
+
+char *putDec32(char *p, uint32_t v) {           // 1 to 10 decimal digits, no leading zeros (like %lu)
+  char d[10];
+  uint8_t n = 0;
+  do {
+    d[n++] = '0' + v % 10;
+    v /= 10;
+  } while(v);
+  while(n) {*p++ = d[--n];}
+  return p;
+}
+
+// Date and time as "MM/DD/YYYY hh:mm:ss" (19 characters)
+char *putDateTime(char *p, const unsigned int *tm) {
+  p = putDec2(p, tm[0]); *p++ = '/';
+  p = putDec2(p, tm[1]); *p++ = '/';
+  p = putDec4(p, tm[2]); *p++ = ' ';
+  p = putDec2(p, tm[3]); *p++ = ':';
+  p = putDec2(p, tm[4]); *p++ = ':';
+  return putDec2(p, tm[5]);
+}
+
+/*
+ * Make the text line for an RFID data line.
+ * @parameters -
+ *      BA - data line in the old-style format (10 bytes for EM4100, 12 bytes for ISO11784/5); the time bytes are not used
+ *      tm - time of the read (month, day, year, hours, minutes, seconds)
+ *      text - receives the line and a closing '\0' (at least 44 characters)
+ * @return -
+ *      length of the line (34 or 43)
+ */
+uint8_t formatTagLine(const char *BA, const unsigned int *tm, char *text) {
+  const uint8_t *b = (const uint8_t*)BA;
+  char *p = text;
+  if(b[0] & 0x80) {                                  // ISO tag: country code, ID, temperature, antenna
+    uint16_t countryCode = (b[6] << 2) + (b[5] >> 6);
+    *p++ = hexChars[countryCode >> 8];
+    p = putHex2(p, countryCode & 0xFF);
+    *p++ = '.';
+    p = putHex2(p, b[5] & 0x3F);
+    for(uint8_t i = 4; i > 0; i--) {p = putHex2(p, b[i]);}
+    *p++ = ','; *p++ = ' ';
+    p = putDec3(p, b[7]);
+    *p++ = ','; *p++ = ' ';
+    p = putDec(p, b[0] & 0x0F);
+  } else {                                           // EM4100 tag: ID, antenna
+    for(uint8_t i = 1; i < 6; i++) {p = putHex2(p, b[i]);}
+    *p++ = ','; *p++ = ' ';
+    p = putDec(p, b[0]);
+  }
+  *p++ = ','; *p++ = ' ';
+  p = putDateTime(p, tm);
+  *p = '\0';
+  return p - text;
+}
+
+/*
+ * Make the text line for a log line: the message, then the time.
+ * @return -
+ *      length of the line (36 for the usual 15-character messages); text needs room for it and a closing '\0'
+ */
+uint8_t formatLogLine(const char *mess, const unsigned int *tm, char *text) {
+  uint8_t n = strlen(mess);
+  memcpy(text, mess, n);
+  char *p = text + n;
+  *p++ = ','; *p++ = ' ';
+  p = putDateTime(p, tm);
+  *p = '\0';
+  return p - text;
+}
+
+/*
+ * Make the text line for a log line that holds a figure in place of the time (see logHasValue()): the message,
+ * then the figure right-aligned in the 19 characters of the date and time, so the line has the same length.
+ */
+uint8_t formatLogValue(const char *mess, uint32_t v, char *text) {
+  uint8_t n = strlen(mess);
+  memcpy(text, mess, n);
+  char *p = text + n;
+  *p++ = ','; *p++ = ' ';
+  char d[10];
+  uint8_t k = putDec32(d, v) - d;
+  memset(p, ' ', 19 - k);
+  memcpy(p + 19 - k, d, k);
+  p[19] = '\0';
+  return p + 19 - text;
+}
+
+// Message for a log code, or 0 for an unknown code
+const char *logText(uint8_t code) {
+  return ((code >= 11) && (code <= 21)) ? logTexts[code - 11] : 0;
+}
+
+// Log codes 17-21 hold a figure of the power report (charge used in mAh, seconds asleep, seconds awake, reads
+// stored, flash page programs) in the 4 bytes that hold the time in the other log lines
+uint8_t logHasValue(uint8_t code) {
+  return (code >= 17) && (code <= 21);
+}
+
+/*********************Reading text*************************/
+// Hex fields: characters that are not hex digits (including lower case letters) are read as 0. Decimal fields
+// are read as '0' to '9' without a check (the lines are written by formatTagLine() and formatLogLine()).
+
+uint8_t hexVal(char c) {
+  return hexVals[(uint8_t)c];
+}
+
+uint8_t getHex2(const char *p) {
+  return (hexVal(p[0]) << 4) + hexVal(p[1]);
+}
+
+uint8_t getDec2(const char *p) {
+  return (p[0] - '0') * 10 + (p[1] - '0');
+}
+
+// Read "MM/DD/YYYY hh:mm:ss" into tm (month, day, year, hours, minutes, seconds)
+void getDateTime(const char *p, unsigned int *tm) {
+  tm[0] = getDec2(p);
+  tm[1] = getDec2(p + 3);
+  tm[2] = getDec2(p + 6) * 100 + getDec2(p + 8);
+  tm[3] = getDec2(p + 11);
+  tm[4] = getDec2(p + 14);
+  tm[5] = getDec2(p + 17);
+}
+
+/*
+ * Read an RFID text line back into the old-style line format. An ISO line is told apart by the '.' after the
+ * country code.
+ * @parameters -
+ *      text - the line (at least 34 characters, 43 for an ISO line)
+ *      BA - receives the line, except for the time bytes
+ *      tm - receives the time (month, day, year, hours, minutes, seconds)
+ * @return -
+ *      length of the line in the old-style format (10 for EM4100, 12 for ISO11784/5)
+ */
+uint8_t parseTagLine(const char *text, char *BA, unsigned int *tm) {
+  if(text[3] == '.') {                               // ISO tag
+    uint16_t countryCode = (hexVal(text[0]) << 8) + getHex2(text + 1);
+    BA[0] = (text[21] - '0') | 0x80;
+    BA[6] = countryCode >> 2;                        // country code is spread over two bytes, and the bytes are in reverse order
+    BA[5] = (getHex2(text + 4) & 0x3F) + (countryCode << 6);
+    for(uint8_t i = 0; i < 4; i++) {BA[4 - i] = getHex2(text + 6 + i * 2);}
+    BA[7] = (text[16] - '0') * 100 + getDec2(text + 17);
+    getDateTime(text + 24, tm);
+    return 12;
+  }
+  BA[0] = text[12] - '0';                            // EM4100 tag
+  for(uint8_t i = 0; i < 5; i++) {BA[i + 1] = getHex2(text + i * 2);}
+  getDateTime(text + 15, tm);
+  return 10;
+}
+
+// The characters 1 to 14 of a message are the same (as two overlapping 8-byte words, loaded with memcpy() so any
+// alignment is fine)
+uint8_t sameMessRest(const char *a, const char *b) {
+  uint64_t a0, a1, b0, b1;
+  memcpy(&a0, a + 1, 8); memcpy(&a1, a + 7, 8);
+  memcpy(&b0, b + 1, 8); memcpy(&b1, b + 7, 8);
+  return (a0 == b0) && (a1 == b1);
+}
+
+// Read the figure of a log line made by formatLogValue()
+uint32_t getLogValue(const char *text) {
+  const char *p = text + 17;
+  while(*p == ' ') {p++;}
+  uint32_t v = 0;
+  while((*p >= '0') && (*p <= '9')) {v = v * 10 + (*p++ - '0');}
+  return v;
+}
+
+/*
+ * Read a log text line: returns the log code (0 if the message is not known) and the time in tm (for the codes
+ * of logHasValue() read the figure with getLogValue() instead). The messages all start with a different letter,
+ * so the first letter gives the only message the line can be, and the rest of it is compared in full.
+ */
+uint8_t parseLogLine(const char *text, unsigned int *tm) {
+  getDateTime(text + 17, tm);
+  uint8_t i = (uint8_t)text[0] - 'A';
+  uint8_t code = (i < 26) ? logCodes[i] : 0;
+  return (code && sameMessRest(text, logTexts[code - 11])) ? code : 0;
+}
+
+#endif
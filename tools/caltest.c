@@ -0,0 +1,61 @@
+/*
+  caltest - check the date conversions of Calendar.h against the C library (gmtime() and timegm()).
+
+  Build:  cc -O2 -o caltest caltest.c
+  Use:    ./caltest
+
+  Every minute of every day from 1970 to February 2106 (the end of 32-bit unix time) is converted both ways with
+  calTime() and calUnix(), with the seconds stepped through 0-59 from one minute to the next, first in time order
+  (the remembered-day path of the sketch, where most times fall on the same day as the one before) and then in
+  a scrambled order (a new day nearly every time). Prints the first few differences and the number found; the
+  exit status is 0 if there are none.
+*/
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "../Calendar.h"
+
+static unsigned long bad = 0;
+
+static void check(uint32_t t) {
+  unsigned int tm[6];
+  time_t x = t;
+  struct tm g;
+  gmtime_r(&x, &g);
+  calTime(t, tm);
+  if((tm[0] != (unsigned int)g.tm_mon + 1) || (tm[1] != (unsigned int)g.tm_mday) || (tm[2] != (unsigned int)g.tm_year + 1900) ||
+     (tm[3] != (unsigned int)g.tm_hour) || (tm[4] != (unsigned int)g.tm_min) || (tm[5] != (unsigned int)g.tm_sec)) {
+    if(bad++ < 10) {
+      printf("calTime(%lu): %02u/%02u/%04u %02u:%02u:%02u, gmtime: %02d/%02d/%04d %02d:%02d:%02d\n", (unsigned long)t,
+             tm[0], tm[1], tm[2], tm[3], tm[4], tm[5], g.tm_mon + 1, g.tm_mday, g.tm_year + 1900, g.tm_hour, g.tm_min, g.tm_sec);
+    }
+  }
+  uint32_t u = calUnix(g.tm_year + 1900, g.tm_mon + 1, g.tm_mday, g.tm_hour, g.tm_min, g.tm_sec);
+  if(u != t) {
+    if(bad++ < 10) {printf("calUnix(%04d-%02d-%02d %02d:%02d:%02d): %lu, timegm: %lu\n", g.tm_year + 1900, g.tm_mon + 1,
+                           g.tm_mday, g.tm_hour, g.tm_min, g.tm_sec, (unsigned long)u, (unsigned long)t);}
+  }
+}
+
+int main(void) {
+  const uint32_t minutes = 0xFFFFFFFFul / 60;      /* every minute up to the end of 32-bit unix time */
+  unsigned long n = 0;
+  for(uint32_t m = 0; m < minutes; m++) {          /* in time order */
+    check(m * 60 + m % 60);
+    n++;
+  }
+  for(uint32_t i = 0; i < minutes; i++) {          /* scrambled: a large odd step visits every minute once */
+    uint32_t m = (uint32_t)(((uint64_t)i * 2654435761u) % minutes);
+    check(m * 60 + (i * 7) % 60);
+    n++;
+  }
+  check(CAL_2000 - 1);                             /* the ends of the table range */
+  check(CAL_2000);
+  check(CAL_2100 - 1);
+  check(CAL_2100);
+  check(0xFFFFFFFFul);
+  printf("%lu times checked, %lu differences\n", n + 5, bad);
+  return bad != 0;
+}
@@ -0,0 +1,249 @@
+/*
+  codectest - check the text lines of TextCodec.h against the sprintf() formats and the char2hex() parser the
+  sketch used before, and time both in each direction.
+
+  Build:  cc -O2 -o codectest codectest.c
+  Use:    ./codectest [lines]        (default 3000000)
+
+  Random RFID lines (EM4100 and ISO11784/5, any byte values) with random times from 2000 to 2099 are made into
+  text with formatTagLine() and with the old sprintf() formats of formatLine(), and log lines with formatLogLine()
+  and the old message + sprintf() of extractMemLog(); the two must be the same, byte for byte. Every line is
+  also read back with parseTagLine() or parseLogLine() and must give the same line and time (RFID lines are read
+  back with a one-digit antenna number, as the sketch writes them), and the old parser of compressSDLine() and
+  compressLogLine() must read the same; a log line with one character of its message changed must read as unknown.
+  Numbers made with putDec32() (as in the SD card sync record) must match %lu, and the log lines of the power
+  report figures (formatLogValue()) must match "%s, %19lu" and read back with parseLogLine() and getLogValue(). Then the lines made per second
+  both ways, and the lines read per second both ways, are printed (each timed on its own). The exit status is 0 if
+  no differences were found.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "../TextCodec.h"
+#include "../Calendar.h"
+
+static uint32_t rng = 12345;
+static uint32_t rnd(void) {
+  rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+  return rng;
+}
+
+/* A random line in the old-style flash format (the time bytes are not used) and its time */
+static void randomLine(uint8_t *b, unsigned int *tm) {
+  for(uint8_t i = 0; i < 12; i++) {b[i] = rnd();}
+  if(rnd() & 1) {b[0] |= 0x80;} else {b[0] &= 0x7F;}
+  calTime(CAL_2000 + rnd() % (CAL_2100 - CAL_2000), tm);
+}
+
+/* The old formatLine() */
+static int oldTagLine(const uint8_t *b, const unsigned int *tm, char *text) {
+  if(b[0] & 0x80) {
+    uint16_t countryCode = (b[6] << 2) + (b[5] >> 6);
+    return sprintf(text, "%03X.%02X%02X%02X%02X%02X, %03d, %d, %02d/%02d/%04d %02d:%02d:%02d",
+                   countryCode, (b[5] & 0x3F), b[4], b[3], b[2], b[1], b[7], (b[0] & 0x0F), tm[0], tm[1], tm[2], tm[3], tm[4], tm[5]);
+  }
+  return sprintf(text, "%02X%02X%02X%02X%02X, %d, %02d/%02d/%04d %02d:%02d:%02d",
+                 b[1], b[2], b[3], b[4], b[5], b[0], tm[0], tm[1], tm[2], tm[3], tm[4], tm[5]);
+}
+
+/* The old log line of extractMemLog(): the message, then the time */
+static int oldLogLine(const char *mess, const unsigned int *tm, char *text) {
+  strcpy(text, mess);
+  return strlen(mess) + sprintf(text + strlen(mess), ", %02d/%02d/%04d %02d:%02d:%02d", tm[0], tm[1], tm[2], tm[3], tm[4], tm[5]);
+}
+
+/* The old char2hex() */
+static char char2hex(char ch) {
+  switch(ch) {
+    case '0': return 0;
+    case '1': return 1;
+    case '2': return 2;
+    case '3': return 3;
+    case '4': return 4;
+    case '5': return 5;
+    case '6': return 6;
+    case '7': return 7;
+    case '8': return 8;
+    case '9': return 9;
+    case 'A': return 10;
+    case 'B': return 11;
+    case 'C': return 12;
+    case 'D': return 13;
+    case 'E': return 14;
+    case 'F': return 15;
+    default: return 0;
+  }
+}
+
+/* The old compressSDLine(), up to the time fields it passed to getUnix2() (two-digit year, here as 20yy) */
+static uint8_t oldParseTagLine(const char *a, uint8_t leng, uint8_t *line, unsigned int *tm) {
+  const char *d;
+  uint8_t n;
+  if(leng > 38) {
+    uint16_t countryCode = (char2hex(a[0]) << 8) + (char2hex(a[1]) << 4) + char2hex(a[2]);
+    line[0] = char2hex(a[21]) | 0x80;
+    line[6] = countryCode >> 2;
+    line[5] = (char2hex(a[4]) << 4) + char2hex(a[5]);
+    line[5] = (line[5] & 0x3F) + (countryCode << 6);
+    line[4] = (char2hex(a[6]) << 4) + char2hex(a[7]);
+    line[3] = (char2hex(a[8]) << 4) + char2hex(a[9]);
+    line[2] = (char2hex(a[10]) << 4) + char2hex(a[11]);
+    line[1] = (char2hex(a[12]) << 4) + char2hex(a[13]);
+    line[7] = (char2hex(a[16]) * 100) + (char2hex(a[17]) * 10) + char2hex(a[18]);
+    d = a + 24;
+    n = 12;
+  } else {
+    line[0] = char2hex(a[12]);
+    line[1] = (char2hex(a[0]) << 4) + char2hex(a[1]);
+    line[2] = (char2hex(a[2]) << 4) + char2hex(a[3]);
+    line[3] = (char2hex(a[4]) << 4) + char2hex(a[5]);
+    line[4] = (char2hex(a[6]) << 4) + char2hex(a[7]);
+    line[5] = (char2hex(a[8]) << 4) + char2hex(a[9]);
+    d = a + 15;
+    n = 10;
+  }
+  tm[0] = char2hex(d[0]) * 10 + char2hex(d[1]);
+  tm[1] = char2hex(d[3]) * 10 + char2hex(d[4]);
+  tm[2] = 2000 + char2hex(d[8]) * 10 + char2hex(d[9]);
+  tm[3] = char2hex(d[11]) * 10 + char2hex(d[12]);
+  tm[4] = char2hex(d[14]) * 10 + char2hex(d[15]);
+  tm[5] = char2hex(d[17]) * 10 + char2hex(d[18]);
+  return n;
+}
+
+/* The old compressLogLine(), the same way (it knew the first four log codes) */
+static uint8_t oldParseLogLine(const char *a, unsigned int *tm) {
+  uint8_t code = 0;
+  switch(a[0]) {
+    case 'L': code = 11; break;
+    case 'G': code = 12; break;
+    case 'W': code = 13; break;
+    case 'D': code = 14; break;
+  }
+  tm[0] = char2hex(a[17]) * 10 + char2hex(a[18]);
+  tm[1] = char2hex(a[20]) * 10 + char2hex(a[21]);
+  tm[2] = 2000 + char2hex(a[25]) * 10 + char2hex(a[26]);
+  tm[3] = char2hex(a[28]) * 10 + char2hex(a[29]);
+  tm[4] = char2hex(a[31]) * 10 + char2hex(a[32]);
+  tm[5] = char2hex(a[34]) * 10 + char2hex(a[35]);
+  return code;
+}
+
+int main(int argc, char **argv) {
+  long n = (argc > 1) ? atol(argv[1]) : 3000000;
+  long bad = 0;
+  uint8_t b[12], back[12];
+  unsigned int tm[6], tmBack[6];
+  char text[64], oldText[64];
+  for(long i = 0; i < n; i++) {
+    randomLine(b, tm);
+    uint8_t len = formatTagLine((const char*)b, tm, text);
+    int oldLen = oldTagLine(b, tm, oldText);
+    if((len != oldLen) || (memcmp(text, oldText, len + 1) != 0)) {
+      if(bad++ < 10) {printf("RFID line: \"%s\", sprintf: \"%s\"\n", text, oldText);}
+    }
+    b[0] = (b[0] & 0x80) | (1 + rnd() % 9);    /* lines are read back with the antenna numbers the sketch uses */
+    formatTagLine((const char*)b, tm, text);
+    uint8_t nb = parseTagLine(text, (char*)back, tmBack);
+    uint8_t want = (b[0] & 0x80) ? 12 : 10;
+    if((nb != want) || (memcmp(back, b, want - 4) != 0) || (memcmp(tmBack, tm, sizeof(tm)) != 0)) {
+      if(bad++ < 10) {printf("RFID line read back differs: \"%s\"\n", text);}
+    }
+    if((oldParseTagLine(text, strlen(text), back, tmBack) != want) || (memcmp(back, b, want - 4) != 0) || (memcmp(tmBack, tm, sizeof(tm)) != 0)) {
+      if(bad++ < 10) {printf("RFID line read back by char2hex() differs: \"%s\"\n", text);}
+    }
+    uint8_t code = 11 + rnd() % 6;
+    len = formatLogLine(logText(code), tm, text);
+    oldLen = oldLogLine(logText(code), tm, oldText);
+    if((len != oldLen) || (memcmp(text, oldText, len + 1) != 0)) {
+      if(bad++ < 10) {printf("log line: \"%s\", sprintf: \"%s\"\n", text, oldText);}
+    }
+    if((parseLogLine(text, tmBack) != code) || (memcmp(tmBack, tm, sizeof(tm)) != 0)) {
+      if(bad++ < 10) {printf("log line read back differs: \"%s\"\n", text);}
+    }
+    if((code <= 14) && ((oldParseLogLine(text, tmBack) != code) || (memcmp(tmBack, tm, sizeof(tm)) != 0))) {
+      if(bad++ < 10) {printf("log line read back by char2hex() differs: \"%s\"\n", text);}
+    }
+    text[1 + rnd() % 14] ^= 0x20;               /* the message is checked in full */
+    if(parseLogLine(text, tmBack) != 0) {
+      if(bad++ < 10) {printf("log line with a changed message read as known: \"%s\"\n", text);}
+    }
+    uint32_t v = rnd() >> (rnd() % 32);
+    char *p = putDec32(text, v);
+    *p = '\0';
+    sprintf(oldText, "%lu", (unsigned long)v);
+    if(strcmp(text, oldText) != 0) {
+      if(bad++ < 10) {printf("putDec32: \"%s\", sprintf: \"%s\"\n", text, oldText);}
+    }
+    code = 17 + rnd() % 5;                      /* a figure of the power report */
+    len = formatLogValue(logText(code), v, text);
+    sprintf(oldText, "%s, %19lu", logText(code), (unsigned long)v);
+    if((len != 36) || (strcmp(text, oldText) != 0) || (parseLogLine(text, tmBack) != code) || (getLogValue(text) != v)) {
+      if(bad++ < 10) {printf("log figure line: \"%s\", sprintf: \"%s\"\n", text, oldText);}
+    }
+  }
+  printf("%ld RFID and log lines checked, %ld differences\n", n, bad);
+
+  /* Timing: the same lines made both ways, then read both ways (the sum keeps the compiler from skipping the work) */
+  const long m = 1000;
+  static uint8_t lines[1000][12];
+  static unsigned int times[1000][6];
+  static char tagText[1000][64], logLines[1000][40];
+  static uint8_t tagLen[1000], logCode[1000];
+  for(long i = 0; i < m; i++) {
+    randomLine(lines[i], times[i]);
+    lines[i][0] = (lines[i][0] & 0x80) | (1 + rnd() % 9);
+    tagLen[i] = formatTagLine((const char*)lines[i], times[i], tagText[i]);
+    logCode[i] = 11 + rnd() % 4;
+    formatLogLine(logText(logCode[i]), times[i], logLines[i]);
+  }
+  long reps = (n / m > 0) ? n / m : 1;
+  double lines_ = (double)reps * m;
+  unsigned long sum = 0;
+  clock_t c[9];
+  c[0] = clock();
+  for(long r = 0; r < reps; r++) {
+    for(long i = 0; i < m; i++) {sum += oldTagLine(lines[i], times[i], text) + text[r % 30];}
+  }
+  c[1] = clock();
+  for(long r = 0; r < reps; r++) {
+    for(long i = 0; i < m; i++) {sum += formatTagLine((const char*)lines[i], times[i], text) + text[r % 30];}
+  }
+  c[2] = clock();
+  for(long r = 0; r < reps; r++) {
+    for(long i = 0; i < m; i++) {sum += oldLogLine(logText(logCode[i]), times[i], text) + text[r % 30];}
+  }
+  c[3] = clock();
+  for(long r = 0; r < reps; r++) {
+    for(long i = 0; i < m; i++) {sum += formatLogLine(logText(logCode[i]), times[i], text) + text[r % 30];}
+  }
+  c[4] = clock();
+  for(long r = 0; r < reps; r++) {
+    for(long i = 0; i < m; i++) {sum += oldParseTagLine(tagText[i], tagLen[i], back, tmBack) + back[r % 10] + tmBack[r % 6];}
+  }
+  c[5] = clock();
+  for(long r = 0; r < reps; r++) {
+    for(long i = 0; i < m; i++) {sum += parseTagLine(tagText[i], (char*)back, tmBack) + back[r % 10] + tmBack[r % 6];}
+  }
+  c[6] = clock();
+  for(long r = 0; r < reps; r++) {
+    for(long i = 0; i < m; i++) {sum += oldParseLogLine(logLines[i], tmBack) + tmBack[r % 6];}
+  }
+  c[7] = clock();
+  for(long r = 0; r < reps; r++) {
+    for(long i = 0; i < m; i++) {sum += parseLogLine(logLines[i], tmBack) + tmBack[r % 6];}
+  }
+  c[8] = clock();
+  const char *names[8] = {"RFID lines made, sprintf:", "RFID lines made, formatTagLine:", "log lines made, sprintf:",
+                          "log lines made, formatLogLine:", "RFID lines read, char2hex:", "RFID lines read, parseTagLine:",
+                          "log lines read, char2hex:", "log lines read, parseLogLine:"};
+  for(int k = 0; k < 8; k++) {
+    printf("%-32s %7.2f M lines/s", names[k], lines_ / ((double)(c[k + 1] - c[k]) / CLOCKS_PER_SEC) / 1e6);
+    if(k == 7) {printf("  (%lu)", sum % 10);}
+    printf("\n");
+  }
+  return bad != 0;
+}
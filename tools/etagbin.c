@@ -0,0 +1,137 @@
+/*
+  etagbin - convert binary ETAG SD card files (IDDATA.BIN and IDLOG.BIN, written when the SD card file format
+  is set to binary with menu option F) to the text lines of the IDDATA.TXT and IDLOG.TXT files.
+
+  Build:  cc -O2 -o etagbin etagbin.c
+  Use:    ./etagbin RF01DATA.BIN > RF01DATA.TXT
+          ./etagbin RF01LOG.BIN > RF01LOG.TXT
+          ./etagbin -t 0123456789 RF01DATA.BIN       (only the reads of one tag: 10 characters for EM4100, 13 for
+                                                       ISO11784/5 as in menu option T, or 3E7.0123456789)
+
+  File layout (see openBin() in ETAG_V10.ino): a 16-byte header - "ETAG", format version (1), file type
+  ('D' for RFID data, 'L' for log), device ID (4 bytes), number of records (4 bytes, least significant byte
+  first) and 2 unused bytes - followed by the records as they are stored in flash memory: RFID lines of 10 bytes
+  (EM4100) or 12 bytes (ISO11784/5, first byte has the top bit set) and 5-byte log lines (log codes 17-21 hold a
+  figure of the power report in place of the time, see logHasValue() in TextCodec.h). The text is made the
+  same way as formatLine(), extractMemLog() and convertUnix() in the sketch (the lines are made by the sketch's
+  TextCodec.h and Calendar.h), with the same CR LF line ends. The records are lines as expanded from flash
+  pages, without the page headers, so the per-page Bloom filters are not in these files: the tag lookup (-t)
+  reads every record of the file. On the reader, menu option T skips the flash pages whose filter rules the tag out.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include "../TextCodec.h"
+#include "../Calendar.h"
+
+static unsigned int timeIn[6];   /* month, day, year, hours, minutes, seconds */
+static char tag[15];             /* tag lookup (-t): the start of the text lines to print, "" for all lines */
+static uint8_t tagLen = 0;
+
+/* Set the tag lookup from the tag ID as typed: returns 0 if it is not a tag ID */
+static int setTag(const char *id) {
+  size_t n = strlen(id);
+  if((n == 13) && !strchr(id, '.')) {      /* ISO tag as in menu option T: put the '.' of the text lines in */
+    memcpy(tag, id, 3);
+    tag[3] = '.';
+    memcpy(tag + 4, id + 3, 10);
+  } else if((n == 10) || ((n == 14) && (id[3] == '.'))) {
+    memcpy(tag, id, n);
+  } else {
+    return 0;
+  }
+  tagLen = (n == 13) ? 14 : n;
+  for(uint8_t i = 0; i < tagLen; i++) {
+    tag[i] = toupper((unsigned char)tag[i]);
+    if((i != 3 || tagLen != 14) && !isxdigit((unsigned char)tag[i])) {return 0;}
+  }
+  tag[tagLen] = '\0';
+  return 1;
+}
+
+static uint32_t getTime(const uint8_t *b) {
+  return ((uint32_t)b[3] << 24) + ((uint32_t)b[2] << 16) + ((uint32_t)b[1] << 8) + b[0];
+}
+
+/* Log messages as in getLogMessage(); an unknown code repeats the last message, as in the sketch */
+static const char *logMessage(uint8_t code) {
+  static const char *mess = "";
+  if(logText(code)) {mess = logText(code);}
+  return mess;
+}
+
+static int convert(const char *name) {
+  FILE *f = fopen(name, "rb");
+  if(!f) {
+    fprintf(stderr, "%s: cannot open\n", name);
+    return 1;
+  }
+  uint8_t hd[16];
+  if((fread(hd, 1, 16, f) != 16) || (memcmp(hd, "ETAG", 4) != 0)) {
+    fprintf(stderr, "%s: not an ETAG binary file\n", name);
+    fclose(f);
+    return 1;
+  }
+  if(hd[4] != 1) {
+    fprintf(stderr, "%s: unknown format version %u\n", name, hd[4]);
+    fclose(f);
+    return 1;
+  }
+  if(tagLen && (hd[5] != 'D')) {
+    fprintf(stderr, "%s: not an RFID data file (-t)\n", name);
+    fclose(f);
+    return 1;
+  }
+  uint32_t nHd = getTime(hd + 10);
+  uint32_t n = 0;
+  uint8_t b[12];
+  char text[64];
+  int cut = 0;                   /* file ends part way through a record */
+  while(fread(b, 1, 1, f) == 1) {
+    if(hd[5] == 'L') {
+      if(fread(b + 1, 1, 4, f) != 4) {cut = 1; break;}
+      if(logHasValue(b[0])) {    /* a figure of the power report in place of the time */
+        formatLogValue(logMessage(b[0]), getTime(b + 1), text);
+      } else {
+        calTime(getTime(b + 1), timeIn);
+        formatLogLine(logMessage(b[0]), timeIn, text);
+      }
+    } else if(b[0] & 0x80) {     /* ISO tag */
+      if(fread(b + 1, 1, 11, f) != 11) {cut = 1; break;}
+      calTime(getTime(b + 8), timeIn);
+      formatTagLine((const char*)b, timeIn, text);
+    } else {                     /* EM4100 tag */
+      if(fread(b + 1, 1, 9, f) != 9) {cut = 1; break;}
+      calTime(getTime(b + 6), timeIn);
+      formatTagLine((const char*)b, timeIn, text);
+    }
+    n++;
+    if(tagLen && ((memcmp(text, tag, tagLen) != 0) || (text[tagLen] != ','))) {continue;}
+    fputs(text, stdout);
+    fputs("\r\n", stdout);
+  }
+  if(cut) {fprintf(stderr, "%s: file ends part way through a record\n", name);}
+  if(n != nHd) {fprintf(stderr, "%s: %u records, header says %u\n", name, n, nHd);}
+  fclose(f);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int i = 1;
+  if((argc > 2) && (strcmp(argv[1], "-t") == 0)) {
+    if(!setTag(argv[2])) {
+      fprintf(stderr, "%s: tag ID must be 10 hex characters (EM4100) or 13 (ISO11784/5)\n", argv[2]);
+      return 2;
+    }
+    i = 3;
+  }
+  if(i >= argc) {
+    fprintf(stderr, "usage: %s [-t TAG] FILE.BIN ... > FILE.TXT\n", argv[0]);
+    return 2;
+  }
+  int err = 0;
+  for(; i < argc; i++) {err |= convert(argv[i]);}
+  return err;
+}
@@ -0,0 +1,167 @@
+/*
+ * Arduino.h (host)
+ *
+ * Stand-in for the Arduino core on the SAMD21, so ETAG_V10.ino can be compiled and run on a desktop computer (see
+ * build.sh). Time is simulated: host_us counts microseconds, and delays, SPI transfers, SD card writes and sleeps
+ * move it on. millis() stops while the board is in low power sleep with SysTick off, as on the board. Serial
+ * output goes to stdout; serial input is queued with SerialUSB.feed() ('|' in the input ends what available()
+ * reports, like a pause between two lines typed by the user). Only what the sketch uses is here.
+ */
+
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <deque>
+
+typedef uint8_t byte;
+typedef bool boolean;
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define DEC 10
+#define HEX 16
+#define BIN 2
+#define B00000111 7
+#define B00011111 31
+#define B10011011 155
+#define bitRead(v,b) (((v)>>(b))&1)
+#define bitSet(v,b) ((v) |= (1UL<<(b)))
+#define bitClear(v,b) ((v) &= ~(1UL<<(b)))
+#define digitalPinToInterrupt(p) (p)
+#define __WFI() host_wfi()
+#define __DSB()
+#define noInterrupts()
+#define interrupts()
+
+extern uint64_t host_us;              // simulated time (microseconds since startup)
+extern uint64_t host_sleep_us;        // time spent with SysTick off (millis() does not count it)
+void host_wfi();
+void host_advance_us(uint64_t us);
+inline unsigned long millis() { return (unsigned long)((host_us - host_sleep_us) / 1000); }
+inline unsigned long micros() { return (unsigned long)host_us; }
+inline void delay(unsigned long ms) { host_advance_us((uint64_t)ms * 1000); }
+inline void delayMicroseconds(unsigned int us) { host_advance_us(us); }
+void pinMode(int p, int m);
+void digitalWrite(int p, int v);
+int digitalRead(int p);
+void attachInterrupt(int p, void (*f)(), int mode);
+void detachInterrupt(int p);
+
+// Arduino String, counting the heap allocations the real one would make (one for each non-empty String built)
+extern uint64_t host_string_allocs;
+class String {
+ public:
+  std::string s;
+  void note() { if (!s.empty()) host_string_allocs++; }
+  String() {}
+  String(const String& o) : s(o.s) { note(); }
+  String& operator=(const String& o) { s = o.s; note(); return *this; }
+  String(const char* c) : s(c ? c : "") { note(); }
+  String(const std::string& x) : s(x) { note(); }
+  String(char c) : s(1, c) { note(); }
+  String(int v, int base = 10) { fmt((long)v, base); }
+  String(unsigned v, int base = 10) { fmt((long)v, base); }
+  String(long v, int base = 10) { fmt(v, base); }
+  String(unsigned long v, int base = 10) { fmt((long)v, base); }
+  String(unsigned char v, int base = 10) { fmt((long)v, base); }
+  void fmt(long v, int base) { char b[40]; snprintf(b, 40, base == 16 ? "%lx" : "%ld", v); s = b; note(); }
+  String operator+(const String& o) const { return String(s + o.s); }
+  String operator+(const char* o) const { return String(s + o); }
+  String operator+(char c) const { return String(s + c); }
+  friend String operator+(const char* a, const String& b) { return String(std::string(a) + b.s); }
+  String& operator+=(const String& o) { s += o.s; note(); return *this; }
+  const char* c_str() const { return s.c_str(); }
+  unsigned length() const { return s.size(); }
+  void toCharArray(char* buf, unsigned n) const { strncpy(buf, s.c_str(), n); buf[n - 1] = 0; }
+  bool operator==(const String& o) const { return s == o.s; }
+};
+
+class Print {
+ public:
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* b, size_t n) { for (size_t i = 0; i < n; i++) write(b[i]); return n; }
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t write(const char* s, size_t n) { return write((const uint8_t*)s, n); }
+  size_t out(const std::string& x) { return write((const uint8_t*)x.data(), x.size()); }
+  size_t print(const char* c) { return out(c); }
+  size_t print(const String& c) { return out(c.s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(long v, int base = DEC) {
+    char b[70];
+    if (base == BIN) { int n = 69; unsigned long u = v; b[n] = 0; do { b[--n] = '0' + (u & 1); u >>= 1; } while (u); return out(b + n); }
+    snprintf(b, 70, base == HEX ? "%lX" : "%ld", v); return out(b);
+  }
+  size_t print(unsigned long v, int base = DEC) { char b[40]; snprintf(b, 40, base == HEX ? "%lX" : "%lu", v); return out(b); }
+  size_t print(int v, int base = DEC) { return base == HEX ? print((unsigned long)(unsigned)v, base) : print((long)v, base); }
+  size_t print(unsigned v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(short v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned short v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(double v, int d = 2) { char b[40]; snprintf(b, 40, "%.*f", d, v); return out(b); }
+  size_t println() { return out("\r\n"); }
+  template <class T> size_t println(T v) { size_t n = print(v); return n + println(); }
+  template <class T> size_t println(T v, int b) { size_t n = print(v, b); return n + println(); }
+  int getWriteError() { return writeError; }
+  void clearWriteError() { writeError = 0; }
+ protected:
+  void setWriteError(int e = 1) { writeError = e; }
+ private:
+  int writeError = 0;
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+};
+
+class HostSerial : public Stream {
+ public:
+  std::deque<uint8_t> in;
+  bool quiet = false;                 // drop the output
+  void begin(long) {}
+  operator bool() { return true; }
+  size_t write(uint8_t c) override { if (!quiet) fputc(c, stdout); return 1; }
+  using Print::write;
+  int available() override {
+    if (!in.empty() && in.front() == '|') { in.pop_front(); return 0; }
+    int n = 0;
+    for (char c : in) { if (c == '|') break; n++; }
+    return n;
+  }
+  int read() override { if (in.empty()) return -1; int c = in.front(); in.pop_front(); return c; }
+  void feed(const char* s) { while (*s) in.push_back(*s++); }
+};
+extern HostSerial SerialUSB;
+
+// SAMD21 registers written by the sketch (lpSleep(), the sleep and USB set up). SysTick->CTRL bit 0 tells
+// host_wfi() whether a wait is an idle wait (woken by the 1 ms tick) or low power sleep (woken by the clock chip).
+struct HostGclk { struct { uint32_t reg; } CLKCTRL; struct { uint32_t reg; } STATUS; };
+extern HostGclk *GCLK;
+#define GCLK_CLKCTRL_ID(x) 0
+#define GCM_EIC 0
+#define GCLK_CLKCTRL_GEN_GCLK1 0
+#define GCLK_CLKCTRL_CLKEN 0
+struct HostUsb { struct { struct { uint32_t reg; } CTRLA; } DEVICE; };
+extern HostUsb *USB;
+#define USB_CTRLA_ENABLE 2
+struct HostSysTick { uint32_t CTRL; };
+extern HostSysTick *SysTick;
+#define SysTick_CTRL_ENABLE_Msk 1
+struct HostScb { uint32_t SCR; };
+extern HostScb *SCB;
+#define SCB_SCR_SLEEPDEEP_Msk 4
+struct HostPm { struct { uint32_t reg; } SLEEP; };
+extern HostPm *PM;
+#define PM_SLEEP_IDLE(x) (x)
+#define PM_SLEEP_IDLE_APB_Val 2
+#define PM_SLEEP_IDLE_CPU_Val 0
+#define PM_SLEEP_IDLE_CPU 0
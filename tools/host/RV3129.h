@@ -0,0 +1,42 @@
+/*
+ * RV3129.h (host)
+ *
+ * Stand-in for the RV-3129 clock chip library. The chip's time is host_rtc_epoch (unix time at startup) plus the
+ * simulated time. The 32 Hz timer and the daily alarm only set what host_wfi() sleeps until.
+ */
+
+#pragma once
+#include "Arduino.h"
+#include <ctime>
+extern int64_t host_rtc_epoch;        // unix time of the chip when host_us was 0
+extern uint16_t host_rtc_timer;       // 32 Hz timer count of the next sleep (0 = none)
+extern int32_t host_rtc_alarm;        // seconds of the day of the enabled alarm (-1 = none)
+
+class RV3129 {
+ public:
+  struct tm t{};
+  int32_t alarmSod = 0;
+  bool begin() { return true; }
+  bool is12Hour() { return false; }
+  void set24Hour() {}
+  bool updateTime() { time_t x = host_rtc_epoch + host_us / 1000000; gmtime_r(&x, &t); return true; }
+  uint8_t getSeconds() { return t.tm_sec; }
+  uint8_t getMinutes() { return t.tm_min; }
+  uint8_t getHours() { return t.tm_hour; }
+  uint8_t getDate() { return t.tm_mday; }
+  uint8_t getMonth() { return t.tm_mon + 1; }
+  uint8_t getYear() { return t.tm_year - 100; }
+  bool setTime(uint8_t s, uint8_t m, uint8_t h, uint8_t d, uint8_t mo, uint16_t y, uint8_t) {
+    struct tm q{};
+    q.tm_sec = s; q.tm_min = m; q.tm_hour = h; q.tm_mday = d; q.tm_mon = mo - 1; q.tm_year = y - 1900;
+    host_rtc_epoch = timegm(&q) - host_us / 1000000;
+    return true;
+  }
+  void setAlarm(uint8_t s, uint8_t m, uint8_t h, uint8_t, uint8_t, uint8_t, uint8_t) { alarmSod = h * 3600 + m * 60 + s; }
+  void enableDisableAlarm(uint8_t) {}
+  void enableAlarmINT(bool on) { host_rtc_alarm = on ? alarmSod : -1; }
+  void setTimer(uint16_t c) { host_rtc_timer = c; }
+  void enableTimerINT(bool) {}
+  void setCTRL1Register(uint8_t) {}
+  void writeRegister(uint8_t, uint8_t) {}
+};
@@ -0,0 +1,23 @@
+/*
+ * SPI.h (host) - transfers go to the flash chip emulator in host.cpp while its chip select (pin 44) is low.
+ */
+
+#pragma once
+#include "Arduino.h"
+#define SPI_CLOCK_DIV2 2
+#define SPI_CLOCK_DIV4 4
+#define SPI_CLOCK_DIV16 16
+#define MSBFIRST 1
+#define SPI_MODE0 0
+struct SPISettings { SPISettings(uint32_t, int, int) {} SPISettings() {} };
+class SPIClass {
+ public:
+  void begin() {}
+  void end() {}
+  void setClockDivider(int) {}
+  void beginTransaction(SPISettings) {}
+  void endTransaction() {}
+  uint8_t transfer(uint8_t b);
+  void transfer(void* buf, size_t n) { uint8_t* p = (uint8_t*)buf; for (size_t i = 0; i < n; i++) p[i] = transfer(p[i]); }
+};
+extern SPIClass SPI;
@@ -0,0 +1,103 @@
+/*
+ * SdFat.h (host)
+ *
+ * Stand-in for SdFat 2.x (SdFs and FsFile): the card is the directory host_sd_dir, and host_sd_present = false
+ * takes it out. Writes move the simulated clock on by about what they take on the board with a 12 MHz SPI bus:
+ * ~10 us a call and 0.1 us a byte into the block cache, ~0.8 ms for each cached block written, an aligned write
+ * of 2 or more blocks as one multi-block command (0.5 ms + 0.4 ms a block), 1.5 ms for a FAT update when the
+ * file grows into a new 32 KB cluster that was not preallocated, and 2 ms to flush the directory entry.
+ * host_sd_full = true makes the card take no more data: writes and preallocation fail, as on a full card.
+ */
+
+#pragma once
+#include "Arduino.h"
+#include <string>
+#include <unistd.h>
+#define O_RDONLY 0
+#define O_WRONLY 1
+#define O_RDWR 2
+#define O_CREAT 0x200
+#define O_AT_END 0x4000
+#define FILE_READ O_RDONLY
+#define FILE_WRITE (O_RDWR | O_CREAT | O_AT_END)
+#define SD_SCK_MHZ(x) (1000000UL * (x))
+#define SHARED_SPI 0
+#define DEDICATED_SPI 1
+#define FAT_TYPE_EXFAT 64
+#define SDFAT_FILE_TYPE 3
+typedef int oflag_t;
+extern std::string host_sd_dir;       // the card
+extern bool host_sd_present, host_sd_full;
+extern uint32_t host_sd_begins, host_sd_opens, host_sd_writes, host_sd_fats;
+extern uint64_t host_sd_prealloc;
+struct SdSpiConfig { SdSpiConfig(int, int, uint32_t) {} };
+
+class FsFile : public Stream {
+ public:
+  FILE* f = nullptr;
+  uint64_t prealloc = 0;
+  bool dirty = false;
+  long cachedBlk = -1;
+  operator bool() const { return f != nullptr; }
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* b, size_t n) override {
+    if (!f) return 0;
+    host_sd_writes++;
+    if (host_sd_full && n) { setWriteError(); return 0; }
+    long pos = ftell(f);
+    long oldClusters = (fsize() + 32767) / 32768, newClusters = (pos + (long)n + 32767) / 32768;
+    if (newClusters > oldClusters && (uint64_t)(pos + n) > prealloc) {
+      host_sd_fats += newClusters - oldClusters;
+      host_advance_us(1500 * (newClusters - oldClusters));
+    }
+    if (pos % 512 == 0 && n >= 1024) {
+      host_advance_us(510 + 400 * (n / 512) + (n % 512) / 10);
+    } else {
+      if (pos % 512 && pos / 512 != cachedBlk) host_advance_us(600);
+      host_advance_us(10 + n / 10 + 800 * ((pos + (long)n) / 512 - pos / 512));
+    }
+    cachedBlk = (pos + n) / 512;
+    dirty = true;
+    return fwrite(b, 1, n, f);
+  }
+  using Print::write;
+  long fsize() { long p = ftell(f); fseek(f, 0, SEEK_END); long e = ftell(f); fseek(f, p, SEEK_SET); return e; }
+  int available() override { return f ? fsize() - ftell(f) : 0; }
+  int read() override { return f ? fgetc(f) : -1; }
+  int read(void* buf, size_t n) { return f ? fread(buf, 1, n, f) : -1; }
+  uint64_t size() { return f ? fsize() : 0; }
+  bool seek(uint64_t p) { return f && fseek(f, p, SEEK_SET) == 0; }
+  uint64_t position() { return f ? ftell(f) : 0; }
+  // as on exFAT: the clusters are allocated, the file size stays 0
+  bool preAllocate(uint64_t n) { if (!f || fsize() != 0 || n == 0 || host_sd_full) return false; prealloc = n; host_sd_prealloc = n; host_advance_us(2000 + 800 * (n / 32768 / 128 + 1)); return true; }
+  bool truncate(uint64_t n) { if (!f) return false; fflush(f); host_advance_us(2000); return ftruncate(fileno(f), n) == 0; }
+  bool truncate() { return f && truncate(ftell(f)); }
+  void flush() { if (f) fflush(f); if (dirty) host_advance_us(2000); dirty = false; }
+  bool close() { if (f) { flush(); fclose(f); f = nullptr; host_advance_us(100); } return true; }
+};
+
+class SdFs {
+ public:
+  bool begin(SdSpiConfig) { host_sd_begins++; host_advance_us(30000); return host_sd_present; }
+  void end() {}
+  uint8_t fatType() { return FAT_TYPE_EXFAT; }
+  std::string path(const char* n) { return host_sd_dir + "/" + n; }
+  FsFile open(const char* n, oflag_t mode = O_RDONLY) {
+    FsFile r;
+    if (!host_sd_present) return r;
+    host_sd_opens++;
+    host_advance_us(3000);
+    if (mode & 3) {
+      r.f = fopen(path(n).c_str(), "r+");
+      if (!r.f && (mode & O_CREAT)) r.f = fopen(path(n).c_str(), "w+");
+      if (r.f && (mode & O_AT_END)) fseek(r.f, 0, SEEK_END);
+    } else {
+      r.f = fopen(path(n).c_str(), "r");
+    }
+    return r;
+  }
+  bool exists(const char* n) { FILE* f = fopen(path(n).c_str(), "r"); if (f) fclose(f); return f != nullptr; }
+  bool remove(const char* n) { return ::remove(path(n).c_str()) == 0; }
+};
+typedef SdFs SdFat;
+typedef FsFile File;
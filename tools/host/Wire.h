@@ -0,0 +1,8 @@
+/*
+ * Wire.h (host) - the clock chip stand-in (RV3129.h) does not go through I2C.
+ */
+
+#pragma once
+#include "Arduino.h"
+class TwoWire { public: void begin() {} };
+extern TwoWire Wire;
@@ -0,0 +1,25 @@
+#!/bin/sh
+# build.sh - compile ETAG_V10.ino with the host stand-ins of this directory (Arduino core, SPI, SdFat, clock chip,
+# flash chip emulator) and one test program, to run the sketch on a desktop computer.
+#
+# Use:  ./build.sh flashtest.cpp        (makes ./flashtest)
+#
+# As the Arduino IDE does, a prototype of each function of the sketch is put in front of its code (protos.py),
+# here at the //////SETUP line. Needs g++ (C++17) and python3. char is unsigned, as on the ARM compiler.
+set -e
+cd "$(dirname "$0")"
+test=${1:?"Use: ./build.sh <test>.cpp"}
+sketch=../../ETAG_V10.ino
+work=${TMPDIR:-/tmp}/etaghost.$$
+mkdir -p "$work"
+line=$(grep -n '^//////SETUP' $sketch | head -1 | cut -d: -f1)
+{
+  echo "#line 1 \"$sketch\""
+  head -n $((line - 1)) $sketch
+  python3 protos.py $sketch
+  echo "#line $line \"$sketch\""
+  tail -n +$line $sketch
+} > "$work/sketch.cpp"
+g++ -std=gnu++17 -O1 -g -funsigned-char -Wall -I. -I../.. -include Arduino.h \
+  -o "${test%.cpp}" "$work/sketch.cpp" host.cpp tagsim.cpp "$test"
+rm -rf "$work"
@@ -0,0 +1,84 @@
+/*
+  cadencebench - how evenly the read attempts are spaced in logging mode S while the SD card batches, the power
+  reports and the sleep schedule run in the gaps between them (the task list of loop(), runTasks()).
+
+  Build:  ./build.sh cadencebench.cpp
+  Use:    ./cadencebench [attempts]      (default 50000)
+
+  Low power mode with the wait held at pauseTime (pauseQuiet kept at 0, the same as pauseMax = pauseTime). A bird
+  arrives before 2% of the attempts and stays for 4 to 23 attempts, a new tag number each visit. The intervals
+  between the starts of read attempts are in simulated time. The shortest is checkTime + pauseTime; an attempt that
+  reads a tag takes longer, so intervals more than 60 ms over the shortest are counted. The sketch's task report (menu option P) follows.
+  Last, with USB kept working, 'm' opens the menu and nothing more is typed: the read attempts made while the menu
+  waits for input (15 s, then it closes) are counted.
+*/
+
+#include "Arduino.h"
+#include "host.h"
+#include "tagsim.h"
+#include <algorithm>
+#include <random>
+
+extern uint32_t evCount[];
+extern unsigned int cycleCount, stopCycleCount;
+extern char logMode;
+extern byte SDOK, pauseQuiet;
+void taskReport(Print &out);
+
+int main(int argc, char **argv) {
+  long n = argc > 1 ? atol(argv[1]) : 50000;
+  host_sd_clear();
+  host_run([=] {
+    tagsim_install();
+    host_boot();
+    logMode = 'S';
+    SDOK = 1;
+    std::mt19937 rng(50);
+    std::uniform_real_distribution<double> u(0, 1);
+    std::vector<double> iv;
+    uint64_t tPrev = 0;
+    uint32_t aPrev = evCount[1];
+    int visit = 0, left = 0;
+    for (long i = 0; i < n; i++) {
+      cycleCount = stopCycleCount;                       // (low power mode)
+      pauseQuiet = 0;
+      if (left == 0 && u(rng) < 0.02) {
+        left = 4 + (int)(u(rng) * 20);
+        visit++;
+        uint8_t id[5] = {0x3A, 1, (uint8_t)(visit >> 8), (uint8_t)visit, 7};
+        tagsim.setEM4100(id);
+      }
+      tagsim.present[1] = tagsim.present[2] = left > 0;
+      if (left) left--;
+      uint64_t t = host_us;
+      loop();
+      if (evCount[1] != aPrev) {
+        if (tPrev) iv.push_back((t - tPrev) / 1000.0);
+        tPrev = t;
+        aPrev = evCount[1];
+      }
+    }
+    std::sort(iv.begin(), iv.end());
+    double sum = 0;
+    long over = 0;
+    for (double x : iv) { sum += x; over += x > iv[0] + 60; }
+    printf("%zu intervals between read attempts: shortest %.1f ms, mean %.1f, median %.1f, p99 %.1f, max %.1f\n",
+           iv.size(), iv[0], sum / iv.size(), iv[iv.size() / 2], iv[iv.size() * 99 / 100], iv.back());
+    printf("intervals over %.0f ms: %ld\n\n", iv[0] + 60, over);
+    SerialUSB.quiet = false;
+    taskReport(SerialUSB);
+
+    tagsim.present[1] = tagsim.present[2] = false;
+    cycleCount = 0;                                      // (USB kept working)
+    loop();
+    uint32_t a0 = evCount[1];
+    uint64_t t0 = host_us;
+    SerialUSB.quiet = true;
+    SerialUSB.feed("m");
+    loop();
+    SerialUSB.quiet = false;
+    printf("\nmenu open %.1f s waiting for input: %u read attempts\n", (host_us - t0) / 1e6, (unsigned)(evCount[1] - a0));
+    return 0;
+  });
+  return 0;
+}
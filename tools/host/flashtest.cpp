@@ -0,0 +1,270 @@
+/*
+  flashtest - run the flash memory code of ETAG_V10.ino on the emulator of each supported flash chip.
+
+  Build:  ./build.sh flashtest.cpp
+  Use:    ./flashtest [chip ...]        (default: AT45DB321E AT45DB641E W25Q64 W25Q128)
+
+  For each chip, with power cycles in between (see host_run()):
+  - flashInit() finds the chip by its JEDEC ID and sets the page size and the end of the ring to fit it;
+  - bytes written with writeFlash() across a page boundary, near the start of the ring and at the very end of
+    the chip, land at the chip's own addresses for those pages (pageAddr());
+  - a sleep window written into page 0 and cleared again (on NOR flash the read-modify-erase path of writeNOR(),
+    since clearing needs bits set back to 1) leaves the pointer journal, the log and the other settings as they
+    were, and the next startup finds the same end of the data;
+  - RFID lines stored until the ring has wrapped round (more than the chip holds) read back as the newest lines
+    stored, with no damaged data, and a log line survives;
+  - after erasing the data (menu option E, eraseBackup()) new lines are stored from the start again;
+  - log lines written round the log ring several times, with restarts and SD card syncs in between, leave the
+    newest lines in the ring in order, and the SD card log file holds each line once, ending with the lines of
+    the ring (the last time round with no SD card, so lines are written over before they are synced); some of
+    the lines are power reports, whose figures (log codes 17-21) go to the card as lines of their own;
+  - a sync to a full SD card leaves expLoc and logExp where they were, and the next sync with room on the card
+    writes every RFID and log line once.
+  No program command may need to set a bit back to 1 (the emulator counts these: a missing erase). The exit
+  status is 0 if every chip passes.
+*/
+
+#include "Arduino.h"
+#include "host.h"
+#include <fstream>
+#include <set>
+
+extern uint32_t memLoc, logLoc, expLoc, logExp, datStart, logStart, logLast, cpyLoc;
+extern char logFile[13], dataFile[13];
+extern uint16_t pgSize, lastBlk;
+extern uint8_t blkPgs;
+uint32_t writeFlash(unsigned long fLoc, char *cArr, uint16_t nchar);
+void readFlash(uint32_t fLoc, char *carr, uint16_t nchar);
+uint32_t storeLine(char *line, uint8_t len);
+uint32_t firstDataLoc();
+uint32_t ringLoc(uint32_t loc);
+uint8_t readLine(uint32_t *loc, char *line);
+uint32_t resyncLine(uint32_t *loc);
+void logEvent(uint8_t code);
+void eraseBackup(char eMode);
+void eraseBlock(uint16_t blk);
+void syncSD();
+uint32_t logFirst();
+uint16_t logUnits();
+void energyLog();
+void logLineText(uint8_t code, uint32_t v, char *text);
+uint8_t logHasValue(uint8_t code);
+
+const uint16_t schStart = 16, schBytes = 48;           // the sleep schedule in page 0
+const uint32_t lineStep = 3;                           // seconds between the test lines (makeLine())
+
+// The lines of the ring, oldest first; damaged gets the number of times damaged data had to be skipped
+static std::vector<std::string> ringLines(int *damaged) {
+  std::vector<std::string> v;
+  char l[12];
+  uint32_t loc = ringLoc(firstDataLoc());
+  *damaged = 0;
+  while (loc != memLoc) {
+    uint8_t n = readLine(&loc, l);
+    if (!n) { (*damaged)++; resyncLine(&loc); continue; }
+    v.push_back(std::string(l, n));
+  }
+  return v;
+}
+
+// Write 40 bytes across the boundary before page pg and check where they are in the chip
+static bool crossPage(uint32_t pg) {
+  uint32_t loc = pg * pgSize - 20;
+  char b[40];
+  for (int i = 0; i < 40; i++) b[i] = 0xA0 + i;
+  writeFlash(loc, b, 40);
+  for (int i = 0; i < 40; i++) {
+    uint32_t p = (loc + i) / flash.pageSize, k = (loc + i) % flash.pageSize;
+    if (flash.mem[(size_t)p * flash.pageSize + k] != (uint8_t)b[i]) {
+      printf("  byte %d of a write at %u is not at page %u byte %u\n", i, loc, p, k);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Log lines round the log ring: three runs of two and a half times round each, the first two synced to the SD card
+// as they go, then a startup that syncs the lines the last run left. Returns the number of failures.
+static int logRing() {
+  host_sd_clear();
+  int fails = 0;
+  for (int run = 0; run < 3; run++) {
+    fails += host_run([run] {
+      host_sd_present = run < 2;
+      host_boot();
+      long ring = (logLast + 5 - logStart) / 5;
+      for (long i = 0; i < ring * 5 / 2; i++) {
+        delay(1000);
+        if (i % 40 == 0) energyLog(); else logEvent(12 + i % 2);
+        if (host_sd_present && i % (ring / 3) == 0) syncSD();
+      }
+      return 0;
+    });
+  }
+  fails += host_run([] {
+    host_sd_present = true;
+    host_boot();                                         // (syncs the SD card, then logs the start)
+    syncSD();
+    int bad = 0;
+    std::vector<std::string> ring;
+    uint32_t prev = 0;
+    for (uint32_t loc = logFirst(); loc != logLoc; loc += 5) {
+      if (loc > logLast) loc = logStart;
+      char lg[5], text[40];
+      readFlash(loc, lg, 5);
+      uint32_t t;
+      memcpy(&t, lg + 1, 4);
+      if (!logHasValue(lg[0])) {
+        if (t < prev) { printf("  log line at %u is older than the one before\n", loc); bad++; break; }
+        prev = t;
+      }
+      logLineText(lg[0], t, text);
+      ring.push_back(text);
+    }
+    long least = (long)(logUnits() - 2) * (cpyLoc - logStart) / logUnits() / 5;   // (one unit is kept erased, the newest one is partly written)
+    if ((long)ring.size() < least) { printf("  %zu log lines in the ring, not %ld or more\n", ring.size(), least); bad++; }
+    std::vector<std::string> card;
+    std::ifstream f(host_sd_dir + "/" + logFile);
+    for (std::string l; std::getline(f, l); ) card.push_back(l.substr(0, l.find('\r')));
+    std::set<std::string> once;                          // (the lines with a time; power report figures can repeat)
+    long dated = 0, figures = 0;
+    for (const std::string &l : card) {
+      if (l.find('/') == std::string::npos) { figures++; continue; }
+      once.insert(l);
+      dated++;
+    }
+    if ((long)once.size() != dated) { printf("  %ld lines with a time on the SD card log file, %zu different\n", dated, once.size()); bad++; }
+    if (figures == 0) { printf("  no power report figures on the SD card log file\n"); bad++; }
+    if (card.size() < ring.size() || !std::equal(ring.begin(), ring.end(), card.end() - ring.size())) {
+      printf("  the SD card log file does not end with the %zu lines of the log ring\n", ring.size()); bad++;
+    }
+    if (logExp != logLoc) { printf("  log not synced to the SD card\n"); bad++; }
+    printf("  %zu log lines on the SD card, the newest %zu in the log ring\n", card.size(), ring.size());
+    return bad;
+  });
+  return fails;
+}
+
+// Count the lines of an SD card text file
+static long cardLines(const char *name) {
+  std::ifstream f(host_sd_dir + "/" + name);
+  long n = 0;
+  for (std::string l; std::getline(f, l); ) n++;
+  return n;
+}
+
+// A sync to a full SD card, then one with room on the card. Returns the number of failures.
+static int fullCard() {
+  host_sd_clear();
+  return host_run([] {
+    host_sd_present = true;
+    host_boot();                                         // (syncs the SD card, then logs the start)
+    long data = cardLines(dataFile), logs = cardLines(logFile) + 2;
+    for (long i = 0; i < 50; i++) { char l[12]; uint8_t n = makeLine(i, l, lineStep); storeLine(l, n); }
+    logEvent(12);
+    uint32_t e = expLoc, x = logExp;
+    int bad = 0;
+    host_sd_full = true;
+    syncSD();
+    if (expLoc != e || logExp != x) { printf("  a sync to a full SD card moved the export locations\n"); bad++; }
+    host_sd_full = false;
+    syncSD();
+    if (expLoc != memLoc || logExp != logLoc) { printf("  not synced once the SD card has room\n"); bad++; }
+    if (cardLines(dataFile) != data + 50 || cardLines(logFile) != logs) {
+      printf("  %ld data and %ld log lines on the SD card, not %ld and %ld\n", cardLines(dataFile), cardLines(logFile), data + 50, logs);
+      bad++;
+    }
+    return bad;
+  });
+}
+
+static bool testChip(const char *name) {
+  if (!flash.chip(name)) { printf("%s: not emulated\n", name); return false; }
+  printf("%s: %u pages of %u bytes\n", name, flash.pages, flash.pageSize);
+  long capacity = (long)flash.size / 3;                  // more lines than the ring holds (records of 3 bytes or more)
+  long half = capacity / 2, total = capacity + capacity / 5;
+  int fails = 0;
+
+  fails += host_run([&] {
+    host_sd_present = false;
+    host_boot();
+    int bad = 0;
+    uint32_t blocks = flash.pages / blkPgs;
+    if (pgSize != flash.pageSize || lastBlk != blocks - 1 || datStart % (pgSize * blkPgs) != 0) {
+      printf("  layout: page %u bytes, data from %u, last block %u\n", pgSize, datStart, lastBlk);
+      bad++;
+    }
+    uint16_t blk = datStart / pgSize / blkPgs + 1;        // (the block after the first one of the ring is still blank)
+    if (!crossPage(blk * blkPgs + 1) || !crossPage(flash.pages - 1)) bad++;
+    eraseBlock(blk);
+    eraseBlock(lastBlk);
+    std::vector<uint8_t> before(flash.mem, flash.mem + cpyLoc);       // (page 0 and the log, not the settings copy)
+    char sch[schBytes], blank[schBytes];
+    memset(blank, 0xFF, schBytes);
+    for (int i = 0; i < schBytes; i++) sch[i] = (i % 8 < 4) ? 3 * i : 0xFF;
+    writeFlash(schStart, sch, schBytes);
+    readFlash(schStart, sch, schBytes);
+    if (sch[0] != 0 || sch[1] != 3) { printf("  sleep window not written\n"); bad++; }
+    writeFlash(schStart, blank, schBytes);
+    if (memcmp(before.data(), flash.mem, cpyLoc) != 0) { printf("  page 0 or the log changed\n"); bad++; }
+    logEvent(11);
+    for (long i = 0; i < half; i++) { char l[12]; uint8_t n = makeLine(i, l, lineStep); storeLine(l, n); }
+    return bad;
+  });
+
+  fails += host_run([&] {
+    host_sd_present = false;
+    host_boot();
+    for (long i = half; i < total; i++) { char l[12]; uint8_t n = makeLine(i, l, lineStep); storeLine(l, n); }
+    return 0;
+  });
+
+  fails += host_run([&] {
+    host_sd_present = false;
+    host_boot();
+    int bad = 0, damaged;
+    std::vector<std::string> v = ringLines(&damaged);
+    long kept = v.size();
+    if (damaged || kept < capacity / 8 || kept >= total) { printf("  %ld lines in the ring, %d damaged\n", kept, damaged); bad++; }
+    for (long j = 0; !bad && j < kept; j++) {
+      char l[12];
+      uint8_t n = makeLine(total - kept + j, l, lineStep);
+      if (v[j] != std::string(l, n)) { printf("  line %ld of the ring is not line %ld stored\n", j, total - kept + j); bad++; }
+    }
+    int starts = 0;                                      // "Logging_started" lines: one a startup and one more
+    for (uint32_t loc = logStart; loc < logLoc; loc += 5) { char lg[5]; readFlash(loc, lg, 5); starts += (lg[0] == 11); }
+    if (starts != 4) { printf("  %d log lines of code 11, not 4\n", starts); bad++; }
+    printf("  %ld lines stored, the newest %ld kept\n", total, kept);
+    eraseBackup('m');
+    for (long i = 0; i < 100; i++) { char l[12]; uint8_t n = makeLine(i, l, lineStep); storeLine(l, n); }
+    return bad;
+  });
+
+  fails += host_run([&] {
+    host_sd_present = false;
+    host_boot();
+    int damaged;
+    std::vector<std::string> v = ringLines(&damaged);
+    if (v.size() != 100 || damaged) { printf("  %zu lines after erasing and storing 100\n", v.size()); return 1; }
+    return 0;
+  });
+
+  fails += logRing();
+  fails += fullCard();
+
+  if (flash.overwrites) { printf("  %llu bytes programmed without an erase\n", (unsigned long long)flash.overwrites); fails++; }
+  printf("  %s\n", fails ? "FAIL" : "pass");
+  return fails == 0;
+}
+
+int main(int argc, char **argv) {
+  const char *all[] = {"AT45DB321E", "AT45DB641E", "W25Q64", "W25Q128"};
+  int bad = 0;
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) bad += !testChip(argv[i]);
+  } else {
+    for (const char *c : all) bad += !testChip(c);
+  }
+  printf(bad ? "FAIL\n" : "PASS\n");
+  return bad != 0;
+}
@@ -0,0 +1,266 @@
+/*
+ * host.cpp
+ *
+ * The simulated board: time, pins, the clock chip, the SD card directory and the flash chip emulator (see host.h).
+ */
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "SdFat.h"
+#include "Wire.h"
+#include "RV3129.h"
+#include "host.h"
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+uint64_t host_us = 0, host_sleep_us = 0, host_idle_us = 0;
+int64_t host_rtc_epoch = 1700000000;
+uint16_t host_rtc_timer = 0;
+int32_t host_rtc_alarm = -1;
+uint64_t host_string_allocs = 0;
+void (*host_tick)() = nullptr;
+void (*host_isr)() = nullptr;
+int host_pins[64];
+HostSerial SerialUSB;
+SPIClass SPI;
+TwoWire Wire;
+// The card: an empty directory in $TMPDIR for this run of the test program, removed when it ends
+static std::string tmpCard() {
+  const char *t = getenv("TMPDIR");
+  std::string d = std::string(t ? t : "/tmp") + "/etaghost-sd." + std::to_string(getpid());
+  std::filesystem::create_directories(d);
+  return d;
+}
+std::string host_sd_dir = tmpCard();
+static struct CardCleanup { ~CardCleanup() { std::filesystem::remove_all(host_sd_dir); } } cardCleanup;   // (not in the children, which _exit())
+bool host_sd_present = true;
+bool host_sd_full = false;
+uint32_t host_sd_begins = 0, host_sd_opens = 0, host_sd_writes = 0, host_sd_fats = 0;
+uint64_t host_sd_prealloc = 0;
+static HostGclk gclk; HostGclk *GCLK = &gclk;
+static HostUsb usb; HostUsb *USB = &usb;
+static HostSysTick sysTick{1}; HostSysTick *SysTick = &sysTick;
+static HostScb scb; HostScb *SCB = &scb;
+static HostPm pm; HostPm *PM = &pm;
+char __data_start__[1], __bss_end__[1];   // (showRAM() reports the static data of the board build)
+
+void host_advance_us(uint64_t us) {
+  host_us += us;
+  if (host_tick) host_tick();
+}
+
+// With SysTick running a wait for an interrupt is an idle wait, woken by the next 1 ms tick. Otherwise it is low
+// power sleep, woken by the clock chip: the 32 Hz timer if it is set, else the daily alarm.
+void host_wfi() {
+  uint64_t us;
+  if (SysTick->CTRL & SysTick_CTRL_ENABLE_Msk) {
+    us = 1000 - host_us % 1000;
+    host_idle_us += us;
+  } else {
+    us = host_rtc_timer ? host_rtc_timer * 31250ull : 1000;
+    if (!host_rtc_timer && host_rtc_alarm >= 0) {
+      int64_t sod = (host_rtc_epoch + host_us / 1000000) % 86400;
+      int64_t d = (host_rtc_alarm - sod + 86400) % 86400;
+      us = (d ? d : 86400) * 1000000ull - host_us % 1000000;
+      host_rtc_alarm = -1;
+    }
+    host_rtc_timer = 0;
+    host_sleep_us += us;
+  }
+  host_advance_us(us);
+}
+
+void halIdle() { host_wfi(); }
+
+void host_sd_clear() {
+  std::filesystem::remove_all(host_sd_dir);
+  std::filesystem::create_directories(host_sd_dir);
+}
+
+// What a child of host_run() hands back: the simulated time and the emulator's state besides the flash contents
+struct HostCarry { uint64_t us, sleepUs, idleUs, busyUntil, programs, erases, overwrites; int64_t epoch; };
+static HostCarry *carry = nullptr;
+uint32_t *host_shared = nullptr;
+
+int host_run(std::function<int()> f) {
+  if (!carry) carry = (HostCarry*)mmap(nullptr, sizeof(HostCarry), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (!host_shared) host_shared = (uint32_t*)mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    int r = f();
+    *carry = {host_us, host_sleep_us, host_idle_us, flash.busyUntil, flash.programs, flash.erases, flash.overwrites, host_rtc_epoch};
+    fflush(stdout);
+    _exit(r);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status)) { printf("host_run: the board crashed\n"); return 255; }
+  host_us = carry->us; host_sleep_us = carry->sleepUs; host_idle_us = carry->idleUs; host_rtc_epoch = carry->epoch;
+  flash.busyUntil = carry->busyUntil; flash.programs = carry->programs; flash.erases = carry->erases;
+  flash.overwrites = carry->overwrites;
+  return WEXITSTATUS(status);
+}
+
+void host_boot() {
+  SerialUSB.quiet = true;
+  SerialUSB.feed("X");
+  setup();
+}
+
+uint8_t makeLine(long i, char *l, uint32_t step) {
+  uint32_t t = 1700000000 + i * step;
+  if (i % 3 == 0) {
+    l[0] = 0x81;
+    for (int k = 1; k < 7; k++) l[k] = 0x10 + (i % 23) + k;
+    l[7] = 9;
+    memcpy(l + 8, &t, 4);
+    return 12;
+  }
+  l[0] = 1 + i % 2;
+  for (int k = 1; k < 6; k++) l[k] = (i % 37) * 3 + k;
+  memcpy(l + 6, &t, 4);
+  return 10;
+}
+
+void pinMode(int, int) {}
+void digitalWrite(int p, int v) {
+  if (p == 44) flash.select(v == LOW);     // FlashCS
+  if (p >= 0 && p < 64) host_pins[p] = v;
+}
+int digitalRead(int p) { return (p >= 0 && p < 64) ? host_pins[p] : 0; }
+void attachInterrupt(int, void (*f)(), int) { host_isr = f; }
+void detachInterrupt(int) { host_isr = nullptr; }
+
+/********************* Flash chip emulator *********************/
+
+HostFlash flash;
+
+bool HostFlash::chip(const char* partName) {
+  struct Part { const char* name; uint8_t id[3]; uint32_t pages; uint16_t pageSize; uint8_t shift; uint16_t secPages; };
+  static const Part parts[] = {
+    {"AT45DB321E", {0x1F, 0x27, 0x01}, 8192, 528, 10, 128},
+    {"AT45DB641E", {0x1F, 0x28, 0x00}, 32768, 264, 9, 256},
+    {"W25Q64", {0xEF, 0x40, 0x17}, 32768, 256, 0, 256},
+    {"W25Q128", {0xEF, 0x40, 0x18}, 65536, 256, 0, 256},
+  };
+  for (const Part& p : parts) {
+    if (name.assign(partName) != p.name) continue;
+    pages = p.pages; pageSize = p.pageSize; shift = p.shift; secPages = p.secPages;
+    memcpy(id, p.id, 3);
+    if (!mem) mem = (uint8_t*)mmap(nullptr, 65536 * 256, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    size = (size_t)pages * pageSize;
+    memset(mem, 0xFF, size);
+    programs = erases = overwrites = 0;
+    selected = wel = false; busyUntil = 0;
+    return true;
+  }
+  return false;
+}
+
+void HostFlash::select(bool on) {
+  if (on) {
+    if (!selected) { cmd.clear(); readPos = 0; }
+    selected = true;
+    return;
+  }
+  if (!selected) return;
+  selected = false;
+  if (cmd.empty()) return;
+  uint8_t op = cmd[0];
+  uint32_t addr = (cmd.size() >= 4) ? ((uint32_t)cmd[1] << 16) | ((uint32_t)cmd[2] << 8) | cmd[3] : 0;
+  if (host_us < busyUntil && op != 0x03 && op != 0x05 && op != 0xD7 && op != 0x9F) {
+    printf("flash: command %02X while busy\n", op);
+  }
+  bool write = (shift ? (op == 0x58 || op == 0x02 || op == 0x81 || op == 0x50 || op == 0x7C || op == 0xC7)
+                      : (wel && (op == 0x02 || op == 0x20 || op == 0xD8 || op == 0xC7)));
+  if (write && off) return;
+  if (write && tracing) { char t[24]; snprintf(t, 24, "%02X@%u", op, page(addr)); trace.push_back(t); }
+  if (!shift) {                                           // SPI NOR flash
+    if (op == 0x06) { wel = true; return; }
+    if (op == 0x03 || op == 0x05 || op == 0x9F) return;
+    if (!wel) { printf("flash: command %02X without write enable\n", op); return; }
+    wel = false;
+    if (op == 0x02 && cmd.size() > 4) program(addr, 4, false);
+    else if (op == 0x20 && cmd.size() >= 4) erase(page(addr) & ~15u, 16, 45000);
+    else if (op == 0xD8 && cmd.size() >= 4) erase(page(addr) & ~255u, 256, 150000);
+    else if (op == 0xC7) erase(0, pages, 20000000);
+    return;
+  }
+  if (op == 0x58 && cmd.size() > 4) program(addr, 4, true);          // read-modify-write (built-in erase)
+  else if (op == 0x02 && cmd.size() > 4) program(addr, 4, false);    // program without erase
+  else if (op == 0x81 && cmd.size() >= 4) erase(page(addr), 1, 12000);
+  else if (op == 0x50 && cmd.size() >= 4) erase(page(addr) & ~7u, 8, 30000);
+  else if (op == 0x7C && cmd.size() >= 4) {              // sector 0 is split into 0a (the first block) and 0b
+    uint32_t s = page(addr) / secPages, first = s * secPages, n = secPages;
+    if (s == 0) { first = (page(addr) < 8) ? 0 : 8; n = (page(addr) < 8) ? 8 : secPages - 8; }
+    erase(first, n, 700000);
+  } else if (op == 0xC7 && cmd.size() >= 4 && cmd[1] == 0x94 && cmd[2] == 0x80 && cmd[3] == 0x9A) {
+    erase(0, pages, 45000000);
+  }
+}
+
+// Program the bytes of the command from cmd[from] into the page at addr; the byte address wraps round inside the
+// page. A read-modify-write (erase) puts the new bytes over the old page contents; a plain program can only clear bits.
+void HostFlash::program(uint32_t addr, size_t from, bool erase) {
+  uint32_t p = page(addr), b = byte(addr);
+  if (p >= pages || b >= pageSize) { printf("flash: program at bad address %06X\n", addr); return; }
+  uint8_t* pg = &mem[(size_t)p * pageSize];
+  if (erase && cut(pageSize)) {                          // cut: the page is erased, and programmed up to cutBytes
+    std::vector<uint8_t> image(pg, pg + pageSize);
+    for (size_t i = from; i < cmd.size(); i++) image[(b + i - from) % pageSize] = cmd[i];
+    memset(pg, 0xFF, pageSize);
+    memcpy(pg, image.data(), cutBytes);
+    return;
+  }
+  size_t end = cut(cmd.size() - from) ? from + cutBytes : cmd.size();
+  for (size_t i = from; i < end; i++) {
+    uint8_t v = cmd[i];
+    if (erase) {
+      pg[b] = v;
+    } else {
+      if ((pg[b] & v) != v && overwrites++ < 5) printf("flash: page %u byte %u programmed over %02X without an erase\n", p, b, pg[b]);
+      pg[b] &= v;
+    }
+    b = (b + 1) % pageSize;
+  }
+  programs++;
+  busyUntil = host_us + (erase ? 17000 : (cmd.size() < 16 ? 100 : 3000));
+}
+
+// Should the power be cut during this command, which writes size bytes?
+bool HostFlash::cut(uint32_t size) {
+  if (cutAfter < 0) return false;
+  if (cutAfter-- > 0) return false;
+  cutSize = size;
+  off = true;
+  return true;
+}
+
+void HostFlash::erase(uint32_t firstPage, uint32_t n, uint64_t us) {
+  if (firstPage + n > pages) { printf("flash: erase past the end (page %u)\n", firstPage); return; }
+  if (cut(1) && cutBytes == 0) return;
+  memset(&mem[(size_t)firstPage * pageSize], 0xFF, (size_t)n * pageSize);
+  erases++;
+  busyUntil = host_us + us;
+}
+
+uint8_t HostFlash::transfer(uint8_t b) {
+  host_advance_us(3);                                     // 8 bits at 3 MHz (SPI_CLOCK_DIV16)
+  if (!selected) return 0xFF;
+  cmd.push_back(b);
+  uint8_t op = cmd[0];
+  if (op == 0x03 && cmd.size() > 4) {                     // continuous read, on into the next pages
+    uint32_t a = ((uint32_t)cmd[1] << 16) | ((uint32_t)cmd[2] << 8) | cmd[3];
+    size_t lin = (size_t)page(a) * pageSize + byte(a) + readPos++;
+    return mem[lin % size];
+  }
+  if (op == 0xD7 && cmd.size() > 1 && shift) return (host_us >= busyUntil ? 0x80 : 0x00) | 0x34;
+  if (op == 0x05 && cmd.size() > 1 && !shift) return (host_us >= busyUntil ? 0x00 : 0x01) | (wel ? 0x02 : 0x00);
+  if (op == 0x9F && cmd.size() > 1) return (cmd.size() - 2 < 3) ? id[cmd.size() - 2] : 0x00;
+  return 0xFF;
+}
+
+uint8_t SPIClass::transfer(uint8_t b) { return flash.transfer(b); }
@@ -0,0 +1,89 @@
+/*
+ * host.h
+ *
+ * What the host tests see of the simulated board besides the sketch itself: the flash chip emulator, the
+ * simulated time and the clock chip, the SD card directory and a hook called whenever time moves on (used by the
+ * tag simulator). The tests call setup() and loop() of the sketch and use its globals and functions directly.
+ */
+
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+ * Flash chip emulator. chip() picks one of the parts in chips[] of the sketch by name and erases it; the JEDEC ID
+ * it answers with is what flashInit() uses to find it. The emulator decodes addresses the way the part does
+ * (DataFlash: page number above a byte address of shift bits; NOR: linear), so a wrong pageAddr() shows up as
+ * data in the wrong place. Program commands can only clear bits, as in a real chip: a program that would need to
+ * set a bit back to 1 is counted in overwrites (and the bit stays 0), so a missing erase is caught. mem holds the
+ * contents, page after page. The chip is an AT45DB321E until chip() is called.
+ */
+struct HostFlash {
+  std::string name;
+  uint32_t pages = 0;                 // number of pages
+  uint16_t pageSize = 0;              // bytes per page
+  uint8_t shift = 0;                  // DataFlash: bits of the byte address (0 = NOR, linear addresses)
+  uint16_t secPages = 0;              // pages per sector
+  uint8_t id[3] = {0, 0, 0};          // JEDEC ID
+  uint8_t *mem = nullptr;             // (shared with the child processes of host_run())
+  size_t size = 0;
+  HostFlash() { chip("AT45DB321E"); }
+  uint64_t programs = 0, erases = 0, overwrites = 0;
+  // Power cut: after cutAfter more program or erase commands, the next one stops after cutBytes bytes (of the
+  // page image for a read-modify-write; an erase is either done (cutBytes > 0) or not) and the chip takes no
+  // more writes until the next power up. The bytes that command would have written are in cutSize.
+  int32_t cutAfter = -1;              // (-1 = no cut)
+  uint32_t cutBytes = 0, cutSize = 0;
+  bool off = false;                   // the power has been cut
+  std::vector<std::string> trace;     // when tracing: the program and erase commands (opcode and page)
+  bool tracing = false;
+  bool chip(const char* partName);    // false if the part is not known
+  uint32_t page(uint32_t addr) { return shift ? addr >> shift : addr / pageSize; }
+  uint32_t byte(uint32_t addr) { return shift ? addr & ((1u << shift) - 1) : addr % pageSize; }
+  // SPI side
+  std::vector<uint8_t> cmd;
+  bool selected = false, wel = false;
+  uint32_t readPos = 0;
+  uint64_t busyUntil = 0;
+  void select(bool on);
+  uint8_t transfer(uint8_t b);
+  void program(uint32_t addr, size_t from, bool erase);
+  void erase(uint32_t firstPage, uint32_t n, uint64_t us);
+  bool cut(uint32_t size);
+};
+extern HostFlash flash;
+
+extern uint64_t host_us;              // simulated time (microseconds since startup)
+extern uint64_t host_sleep_us;        // time spent in low power sleep
+extern uint64_t host_idle_us;         // time spent in idle waits (halIdle())
+extern int64_t host_rtc_epoch;        // unix time of the clock chip when host_us was 0
+extern std::string host_sd_dir;       // the SD card (a directory in $TMPDIR)
+extern bool host_sd_present;
+extern bool host_sd_full;             // the SD card takes no more data (writes fail)
+extern uint32_t host_sd_begins, host_sd_opens, host_sd_writes;  // SD card starts (SD.begin), file opens, write calls
+extern uint32_t host_sd_fats;         // FAT updates (a file grown into a cluster that was not preallocated)
+extern uint64_t host_sd_prealloc;     // bytes preallocated by the last preAllocate()
+extern void (*host_tick)();           // called after time moves on
+extern void (*host_isr)();            // interrupt handler attached by the sketch (RF demod pin)
+extern int host_pins[64];             // output pin levels (and input levels set by the tests)
+void host_sd_clear();                 // an empty SD card
+extern uint32_t *host_shared;         // 1024 words shared with the children of host_run(), for their results
+
+/*
+ * Power the board up, run f() and power it off again; returns what f() returns (0 to 255). f() runs in a child
+ * process forked from the test program, which must not run the sketch itself: each power up starts with the
+ * sketch's globals as they are at startup on the board, and only the flash contents, the SD card and the
+ * simulated time are kept from one to the next, as in a power cycle (a power cut of the flash emulator ends with
+ * the child). Output of f() goes to stdout.
+ */
+int host_run(std::function<int()> f);
+void host_boot();                     // setup(), leaving the menu at once (serial output off)
+
+// Line i of the test data in the old-style line format, stored by the tests with storeLine(): every third line
+// an ISO11784/5 tag, the others EM4100 tags on antenna 1 or 2, step seconds apart. Returns its length (10 or 12).
+uint8_t makeLine(long i, char *l, uint32_t step);
+
+void setup();
+void loop();
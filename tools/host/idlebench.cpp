@@ -0,0 +1,86 @@
+/*
+  idlebench - the charge used per read attempt with the CPU stopped in the idle waits (cpuIdle()), and what it would
+  be if those waits were busy loops, as delay() was.
+
+  Build:  ./build.sh idlebench.cpp
+  Use:    ./idlebench [attempts]         (default 20000 for each case)
+
+  Three cases: low power mode with a tag at the antennas on 5% and on 30% of the attempts, and USB mode (the menu's
+  delay between attempts, no sleep). The charge comes from the sketch's own power accounting: the time in each state
+  and the board currents of the power report (energyReport(), menu option P), less idleMicroAmps for the time in
+  idle waits. The host halIdle() waits for the next 1 ms SysTick, so the idle share is an upper bound, and the board
+  currents are datasheet figures rather than measurements.
+*/
+
+#include "Arduino.h"
+#include "host.h"
+#include "tagsim.h"
+#include <random>
+
+extern uint32_t evCount[];
+extern unsigned int cycleCount, stopCycleCount;
+void energyReport(Print &out);
+
+// The power report as text, to read the figures it is worked out from
+struct Report : public Print {
+  std::string s;
+  size_t write(uint8_t c) override { s += (char)c; return 1; }
+};
+
+// Charge (uC) of the time in each state in the power report (its first line), the time in idle waits (s) and the
+// current the report takes off for it (uA)
+static void charge(double *uC, double *idle, double *idleUA) {
+  Report r;
+  energyReport(r);
+  std::string states = r.s.substr(0, r.s.find('\n'));
+  *uC = 0;
+  const char *p = states.c_str();
+  double secs, uA;
+  int n = 0;
+  while ((p = strstr(p, ": ")) && sscanf(p, ": %lf s, %lf uA;%n", &secs, &uA, &n) == 2 && n > 0) {
+    *uC += secs * uA;
+    p += n;
+    n = 0;
+  }
+  sscanf(strstr(r.s.c_str(), "CPU idle: "), "CPU idle: %lf s, -%lf uA", idle, idleUA);
+}
+
+int main(int argc, char **argv) {
+  long n = argc > 1 ? atol(argv[1]) : 20000;
+  struct Case { bool usb; double tags; const char *name; } cases[] = {
+    {false, 0.05, "low power mode, tag on 5% of attempts"},
+    {false, 0.30, "low power mode, tag on 30% of attempts"},
+    {true, 0.05, "USB mode, tag on 5% of attempts"},
+  };
+  printf("case                                     attempts  reads  awake ms  idle  uC busy  uC idle\n");
+  for (auto &c : cases) {
+    host_run([=] {
+      tagsim_install();
+      host_boot();
+      std::mt19937 rng(49);
+      std::uniform_real_distribution<double> u(0, 1);
+      double uC0, idle0, idleUA;
+      charge(&uC0, &idle0, &idleUA);
+      uint32_t a0 = evCount[1], r0 = evCount[2];
+      uint64_t awake0 = host_us - host_sleep_us;
+      for (long i = 0; i < n; i++) {
+        cycleCount = c.usb ? 0 : stopCycleCount;
+        bool on = u(rng) < c.tags;
+        if (on) {
+          uint8_t id[5] = {0x3A, 1, 2, (uint8_t)(i >> 8), (uint8_t)i};
+          tagsim.setEM4100(id);
+        }
+        tagsim.present[1] = tagsim.present[2] = on;
+        loop();
+      }
+      double uC, idle;
+      charge(&uC, &idle, &idleUA);
+      double att = evCount[1] - a0, awake = (host_us - host_sleep_us - awake0) / 1e6;
+      double saved = (idle - idle0) * idleUA;
+      printf("%-40s %8.0f  %5u  %8.2f  %3.0f%%  %7.0f  %7.0f\n", c.name, att, evCount[2] - r0, awake * 1000 / att,
+             100 * (idle - idle0) / awake, (uC - uC0) / att, (uC - uC0 - saved) / att);
+      return 0;
+    });
+  }
+  return 0;
+}
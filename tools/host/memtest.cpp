@@ -0,0 +1,78 @@
+/*
+  memtest - run the reader for a simulated month in logging mode S and check that it uses no heap.
+
+  Build:  ./build.sh memtest.cpp
+  Use:    ./memtest [days]              (default 30)
+
+  The loop runs with the tag simulator (tagsim.h) putting a tag at both antennas on one read attempt in 30, a new
+  tag number each time, and the lines go to the SD card (host_sd_dir) as they are read. First 2000 attempts awake
+  with Debug output and one menu display, then sleep mode (low power pauses between attempts) for the given number
+  of days. The stand-in String (Arduino.h) counts the heap allocations the real one would make: there must be none,
+  and the heap in use by the whole program (mallinfo2()) must be the same at the end of the last day as at the end
+  of the first. The exit status is 0 if both hold.
+*/
+
+#include "Arduino.h"
+#include "host.h"
+#include "tagsim.h"
+#include <malloc.h>
+
+extern uint32_t memLoc;
+extern char logMode;
+extern byte SDOK;
+extern unsigned int cycleCount, stopCycleCount;
+extern bool Debug;
+extern uint64_t host_string_allocs;
+void doMenu();
+
+static long reads = 0;
+
+static void run(long loops, bool sleepMode) {
+  for (long i = 0; i < loops; i++) {
+    if (sleepMode) { cycleCount = stopCycleCount; } else { cycleCount = 0; Debug = 1; }
+    uint8_t id[5] = {0x01, 0x23, 0x45, (uint8_t)i, 0x89};
+    tagsim.setEM4100(id);
+    tagsim.present[1] = tagsim.present[2] = (i % 30) == 0;
+    uint32_t m = memLoc;
+    loop();
+    if (memLoc != m) reads++;
+  }
+}
+
+int main(int argc, char **argv) {
+  int days = argc > 1 ? atoi(argv[1]) : 30;
+  host_sd_clear();
+  int r = host_run([days] {
+    tagsim_install();
+    host_boot();
+    logMode = 'S';
+    SDOK = 1;
+    int bad = 0;
+    uint64_t a0 = host_string_allocs;
+    run(2000, false);
+    printf("awake, Debug on: 2000 attempts, %ld reads, %llu String allocations\n", reads, (unsigned long long)(host_string_allocs - a0));
+    bad += host_string_allocs != a0;
+    a0 = host_string_allocs;
+    SerialUSB.feed("X");
+    doMenu();
+    printf("one menu display: %llu String allocations\n", (unsigned long long)(host_string_allocs - a0));
+    bad += host_string_allocs != a0;
+
+    a0 = host_string_allocs;
+    reads = 0;
+    uint64_t u0 = host_us;
+    long n = 0;
+    size_t heap1 = 0, heap = 0;
+    for (int d = 0; d < days; d++) {
+      while (host_us - u0 < (d + 1) * 86400ull * 1000000) { run(1000, true); n += 1000; }
+      heap = mallinfo2().uordblks;
+      if (d == 0) heap1 = heap;
+    }
+    printf("%d days in sleep mode: %ld attempts, %ld reads, %llu String allocations\n", days, n, reads, (unsigned long long)(host_string_allocs - a0));
+    printf("heap in use: %zu bytes after day 1, %zu bytes after day %d\n", heap1, heap, days);
+    bad += (host_string_allocs != a0) || (heap != heap1) || (reads == 0);
+    return bad;
+  });
+  printf(r ? "FAIL\n" : "PASS\n");
+  return r != 0;
+}
@@ -0,0 +1,118 @@
+/*
+  pausebench - compare the growing wait between read attempts in low power mode (nextPause()) with the fixed
+  pauseTime wait: the chance of detecting a visit, the energy used, and the two together.
+
+  Build:  ./build.sh pausebench.cpp
+  Use:    ./pausebench [days] [median visit seconds ...]    (default: 3 days; 1.5, 4 and 10 s)
+
+  Birds visit from 06:00 to 20:00 with a morning and an evening peak (15 bouts an hour plus 45 at 07:30 and 30 at
+  18:00), a bout is one visit or more in a row (each further visit with a chance of one half, 20 s apart on
+  average), visit lengths are lognormal around the median, and each visit is at one antenna picked at random. The
+  tag simulator (tagsim.h) shows the bird's tag at that antenna during the visit. A visit counts as detected if at
+  least one read is stored while it lasts. The same visits are run with the sketch as it is and with the wait held
+  at pauseTime (pauseQuiet kept at 0, the same as pauseMax = pauseTime). The energy is counted from the awake and
+  sleep time of the simulated board at iAwake and iSleep below (the RF circuit dominates while awake).
+*/
+
+#include "Arduino.h"
+#include "host.h"
+#include "tagsim.h"
+#include <cmath>
+#include <random>
+
+extern uint32_t memLoc;
+extern char logMode;
+extern byte SDOK, pauseQuiet;
+extern unsigned int cycleCount, stopCycleCount;
+
+const double iAwake = 20.0, iSleep = 0.1, volts = 3.3;   // mA awake, mA asleep, supply
+
+struct Visit { double t0, t1; int ant; };
+
+// The visits of the given number of days from time t0 (seconds)
+static std::vector<Visit> visits(int days, double median, double t0) {
+  std::mt19937 rng(46);
+  std::exponential_distribution<double> ex(1.0);
+  std::lognormal_distribution<double> dur(std::log(median), 0.8);
+  std::uniform_real_distribution<double> u(0, 1);
+  std::vector<Visit> v;
+  for (int d = 0; d < days; d++) {
+    double t = t0 + d * 86400.0 + 6 * 3600;
+    while (t < t0 + d * 86400.0 + 20 * 3600) {
+      double h = fmod(t - t0, 86400.0) / 3600;
+      double rate = 15 + 45 * exp(-pow((h - 7.5) / 1.5, 2)) + 30 * exp(-pow((h - 18) / 1.5, 2));   // bouts an hour
+      t += ex(rng) * 3600 / rate;
+      double b = t;
+      do {
+        Visit x{b, b + dur(rng), 1 + (int)(u(rng) * 2)};
+        if (v.empty() || x.t0 > v.back().t1 + 0.5) v.push_back(x);   // (one bird at a time on the reader)
+        b = x.t1 + ex(rng) * 20;
+      } while (u(rng) < 0.5);
+      t = b;
+    }
+  }
+  return v;
+}
+
+// Run the visits; host_shared gets the visits, the visits detected, and the awake and sleep time (ms)
+static void run(int days, double median, bool fixed) {
+  host_run([=] {
+    tagsim_install();
+    host_sd_present = false;
+    host_boot();
+    logMode = 'F';
+    SDOK = 0;
+    double t0 = host_us / 1e6;
+    std::vector<Visit> v = visits(days, median, t0);
+    size_t vi = 0, nDet = 0;
+    bool det = false;
+    int cur = -1;
+    uint64_t awake0 = host_us - host_sleep_us, sleep0 = host_sleep_us;
+    while (host_us / 1e6 < t0 + days * 86400.0) {
+      cycleCount = stopCycleCount;                       // (low power mode)
+      if (fixed) pauseQuiet = 0;
+      double now = host_us / 1e6;
+      while (vi < v.size() && v[vi].t1 <= now) { nDet += det; det = false; vi++; }
+      bool on = vi < v.size() && v[vi].t0 <= now;
+      if (on && cur != (int)vi) {
+        uint8_t id[5] = {0x3A, (uint8_t)(vi >> 16), (uint8_t)(vi >> 8), (uint8_t)vi, 0x55};
+        tagsim.setEM4100(id);
+        cur = vi;
+      }
+      tagsim.present[1] = on && v[vi].ant == 1;
+      tagsim.present[2] = on && v[vi].ant == 2;
+      uint32_t m = memLoc;
+      loop();
+      if (on && memLoc != m) det = true;
+    }
+    nDet += det;
+    host_shared[0] = vi;
+    host_shared[1] = nDet;
+    host_shared[2] = (host_us - host_sleep_us - awake0) / 1000;
+    host_shared[3] = (host_sleep_us - sleep0) / 1000;
+    return 0;
+  });
+}
+
+int main(int argc, char **argv) {
+  int days = argc > 1 ? atoi(argv[1]) : 3;
+  std::vector<double> medians;
+  for (int i = 2; i < argc; i++) medians.push_back(atof(argv[i]));
+  if (medians.empty()) medians = {1.5, 4, 10};
+  printf("%d days; detected = a read stored during the visit; %.0f mA awake, %.1f mA asleep at %.1f V\n\n", days, iAwake, iSleep, volts);
+  printf("median visit  schedule  visits  detected      p  mAh/day  p per kJ\n");
+  for (double med : medians) {
+    double ppk[2];
+    for (int fixed = 1; fixed >= 0; fixed--) {
+      run(days, med, fixed);
+      double awake = host_shared[2] / 1000.0, slept = host_shared[3] / 1000.0;
+      double p = (double)host_shared[1] / host_shared[0];
+      double joules = volts * (iAwake * awake + iSleep * slept) / 1000;
+      ppk[fixed] = p / joules * 1000;
+      printf("%10.1f s  %-8s  %6u  %8u  %.3f  %7.1f  %8.4f\n", med, fixed ? "fixed" : "growing", host_shared[0], host_shared[1], p,
+             (iAwake * awake + iSleep * slept) / 3600 / days, ppk[fixed]);
+    }
+    printf("%10.1f s  growing / fixed detection probability per kJ: %.2f\n", med, ppk[0] / ppk[1]);
+  }
+  return 0;
+}
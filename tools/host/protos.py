@@ -0,0 +1,62 @@
+"""
+protos.py - print a prototype for each function defined in a sketch, as the Arduino IDE adds them before
+compiling, so functions can be called before they are defined.
+
+Use:  python3 protos.py ../../ETAG_V10.ino
+"""
+
+import re
+import sys
+
+
+def strip(src):
+    """The source without comments and with empty string and character literals (line numbers kept)."""
+    out = []
+    i, n = 0, len(src)
+    while i < n:
+        if src.startswith('//', i):
+            j = src.find('\n', i)
+            i = n if j < 0 else j
+        elif src.startswith('/*', i):
+            j = src.find('*/', i + 2)
+            out.append(' ' + '\n' * src[i:j].count('\n'))
+            i = j + 2
+        elif src[i] in '"\'':
+            q = src[i]
+            i += 1
+            while i < n and src[i] != q:
+                i += 2 if src[i] == '\\' else 1
+            out.append(q + q)
+            i += 1
+        else:
+            out.append(src[i])
+            i += 1
+    return ''.join(out)
+
+
+def prototypes(src):
+    """Function heads found at the outer level of the source, each followed by ';'."""
+    s = re.sub(r'^[ \t]*#.*$', '', strip(src), flags=re.M)
+    found = []
+    depth, last = 0, 0
+    for i, c in enumerate(s):
+        if c == '{':
+            if depth == 0:
+                head = s[last:i].strip()
+                m = re.match(r'^([\w\s\*&:<>,]+?[\s\*&])(\w+)\s*\(([^;{}]*)\)$', head, re.S)
+                if (m and not re.match(r'^(struct|union|class|enum|typedef|extern)\b', head)
+                        and m.group(2) not in ('if', 'while', 'for', 'switch')):
+                    found.append(' '.join((m.group(1) + m.group(2) + '(' + m.group(3) + ')').split()) + ';')
+            depth += 1
+        elif c == '}':
+            depth -= 1
+            if depth == 0:
+                last = i + 1
+        elif c == ';' and depth == 0:
+            last = i + 1
+    return found
+
+
+if __name__ == '__main__':
+    for p in prototypes(open(sys.argv[1]).read()):
+        print(re.sub(r'\s*=[^,)]*', '', p))     # default arguments stay in the definition only
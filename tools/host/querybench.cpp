@@ -0,0 +1,146 @@
+/*
+  querybench - time the filtered export (menu option Q, queryRFID()) against the full transfer (extractMemRFID()) on
+  a full chip, and check that each query finds exactly the reads it should. The last queries look up one tag over
+  all time (menu option T), where the Bloom filters of the page headers decide which pages are read. Last, the clock
+  is set back and more reads are stored: a query of their time range must still find them.
+
+  Build:  ./build.sh querybench.cpp
+  Use:    ./querybench [reads] [tags]    (default: 1,500,000 reads of 40 tags, enough to wrap the AT45DB321E)
+
+  The reads are stored with storeLine() as the reader would, one every 1 to 40 s, each of a random tag (the first
+  8 tags are ISO11784/5, the others EM4100) at a random antenna. Once the ring has wrapped, the oldest surviving read
+  sets which reads the queries can still find. Times are simulated time (flash and SD card transfers at the speeds
+  of host.cpp), so they are what a reader would take rather than what this program takes to run.
+*/
+
+#include "Arduino.h"
+#include "host.h"
+#include <fstream>
+#include <vector>
+
+extern uint32_t memLoc, qStart, qEnd;
+extern uint8_t qType, qAnt;
+extern bool qTagSet;
+extern char qTag[7];
+extern char dataFile[13], queryFile[13];
+uint32_t storeLine(char *line, uint8_t len);
+uint32_t firstDataLoc();
+uint32_t ringLoc(uint32_t loc);
+uint8_t readLine(uint32_t *loc, char *line);
+void extractMemRFID(uint8_t prntWrt, uint32_t flashStart);
+void queryRFID(uint8_t prntWrt);
+bool lineMatch(char *line, uint8_t len);
+
+struct Read { char l[12]; uint8_t n; };
+
+// Tag number k as the line bytes 0 to 6 (type and ID) it is stored with
+static void tagBytes(int k, uint8_t ant, char *l) {
+  if (k < 8) {
+    l[0] = 0x80 | ant;
+    for (int i = 1; i < 7; i++) l[i] = (k * 3 + i) ^ (k >> 5);
+  } else {
+    l[0] = ant;
+    for (int i = 1; i < 6; i++) l[i] = (k * 5 + i) ^ (k >> 5);
+  }
+}
+
+static long fileLines(const char *name) {
+  std::ifstream f(host_sd_dir + "/" + name);
+  long n = 0;
+  for (std::string s; std::getline(f, s);) n++;
+  return n;
+}
+
+static uint32_t timeOf(const char *l, uint8_t n) { uint32_t t; memcpy(&t, l + n - 4, 4); return t; }
+
+int main(int argc, char **argv) {
+  long nReads = argc > 1 ? atol(argv[1]) : 1500000;
+  int nTags = argc > 2 ? atoi(argv[2]) : 40;
+  host_sd_clear();
+  int r = host_run([=] {
+    host_boot();
+    std::vector<Read> all;
+    uint32_t T = 1700000000, rng = 7;
+    for (long i = 0; i < nReads; i++) {
+      rng = rng * 1103515245 + 12345;
+      uint32_t x = rng >> 8;
+      T += 1 + x % 40;
+      Read rd;
+      int k = (x >> 8) % nTags;
+      tagBytes(k, 1 + (x >> 14) % 2, rd.l);
+      rd.n = (k < 8) ? 12 : 10;
+      if (k < 8) rd.l[7] = 20;
+      memcpy(rd.l + rd.n - 4, &T, 4);
+      storeLine(rd.l, rd.n);
+      all.push_back(rd);
+    }
+    uint32_t loc = ringLoc(firstDataLoc());
+    char l[12];
+    uint8_t n = readLine(&loc, l);
+    uint32_t oldest = timeOf(l, n);
+    printf("%ld reads stored over %u days, reads since day %u still in flash\n", nReads, (T - 1700000000) / 86400, (oldest - 1700000000) / 86400);
+
+    uint64_t t0 = host_us;
+    extractMemRFID(2, firstDataLoc());
+    double full = (host_us - t0) / 1e6;
+    printf("full transfer: %ld lines, %.1f s\n\n", fileLines(dataFile), full);
+
+    struct Query { uint32_t start, end; uint8_t type, ant; int tag; const char *name; } qs[] = {
+      {T - 7 * 86400, 0xFFFFFFFF, 3, 0, -1, "last week"},
+      {0, 0xFFFFFFFF, 3, 2, -1, "antenna 2"},
+      {T - 30 * 86400, T - 23 * 86400, 2, 0, -1, "ISO tags, a week a month ago"},
+      {T - 3 * 86400, 0xFFFFFFFF, 3, 1, 12, "one EM4100 tag at antenna 1, last 3 days"},
+      {T - 2 * 86400, 0xFFFFFFFF, 3, 0, 3, "one ISO tag, last 2 days"},
+      {0, 0xFFFFFFFF, 3, 0, 12, "one EM4100 tag, all time"},       // (in every page: each page is read)
+      {0, 0xFFFFFFFF, 3, 0, 3, "one ISO tag, all time"},
+      {0, 0xFFFFFFFF, 3, 0, nTags + 59, "a tag that was never read"},  // (the Bloom filters skip the pages)
+    };
+    int bad = 0;
+    printf("query                                        found  expected  time (s)\n");
+    for (auto &q : qs) {
+      qStart = q.start; qEnd = q.end; qType = q.type; qAnt = q.ant;
+      qTagSet = q.tag >= 0;
+      memset(qTag, 0, 7);
+      if (qTagSet) { tagBytes(q.tag, 0, qTag); }
+      long expect = 0;
+      for (auto &rd : all) expect += timeOf(rd.l, rd.n) >= oldest && lineMatch(rd.l, rd.n);
+      remove((host_sd_dir + "/" + queryFile).c_str());
+      t0 = host_us;
+      queryRFID(2);
+      double qt = (host_us - t0) / 1e6;
+      long got = fileLines(queryFile);
+      printf("%-42s %7ld  %8ld  %8.2f\n", q.name, got, expect, qt);
+      bad += got != expect;
+    }
+
+    // The clock set back 10 days: reads stored after the newest ones with earlier times. A query of those days
+    // finds them in the last pages, after pages that start later than its end time.
+    uint32_t Tb = T - 10 * 86400;
+    for (long i = 0; i < 300; i++) {
+      rng = rng * 1103515245 + 12345;
+      uint32_t x = rng >> 8;
+      Tb += 1 + x % 40;
+      Read rd;
+      tagBytes(8 + (x >> 8) % (nTags - 8), 1, rd.l);
+      rd.n = 10;
+      memcpy(rd.l + 6, &Tb, 4);
+      storeLine(rd.l, rd.n);
+      all.push_back(rd);
+    }
+    loc = ringLoc(firstDataLoc());
+    n = readLine(&loc, l);
+    oldest = timeOf(l, n);
+    qStart = T - 10 * 86400; qEnd = T - 9 * 86400; qType = 3; qAnt = 0; qTagSet = false;
+    long expect = 0;
+    for (auto &rd : all) expect += timeOf(rd.l, rd.n) >= oldest && lineMatch(rd.l, rd.n);
+    remove((host_sd_dir + "/" + queryFile).c_str());
+    t0 = host_us;
+    queryRFID(2);
+    long got = fileLines(queryFile);
+    printf("%-42s %7ld  %8ld  %8.2f\n", "a day 10 days ago, after the clock set back", got, expect, (host_us - t0) / 1e6);
+    bad += got != expect;
+    return bad;
+  });
+  printf(r ? "FAIL\n" : "PASS\n");
+  return r != 0;
+}
@@ -0,0 +1,79 @@
+/*
+  sdqueuebench - run the reader in logging mode S with tag visits in bursts, and count how often the SD card is
+  started and how long the board is awake in a loop with and without a stored read, now that reads are queued in RAM
+  and written to the card in batches.
+
+  Build:  ./build.sh sdqueuebench.cpp
+  Use:    ./sdqueuebench [b]             (b: binary data file)
+
+  3000 loops; a tag is at both antennas in 4 loops of every 10, a new tag number each burst. The clock chip moves on
+  2 s a loop. The pauses between read attempts are low power sleeps; the rest of the time the board is awake. After
+  the loops a log event writes out the queue, and the card must then hold every read (expLoc at memLoc). A second
+  power up must add nothing to the card. Times are simulated time; each SD card start costs the board about 40 ms of
+  card power plus SD.begin.
+*/
+
+#include "Arduino.h"
+#include "host.h"
+#include "tagsim.h"
+#include <fstream>
+
+extern uint32_t memLoc, expLoc;
+extern char logMode;
+extern byte SDOK;
+extern bool binFmt;
+extern unsigned int cycleCount, stopCycleCount;
+extern char dataFile[13];
+void setFileNames();
+void logEvent(uint8_t code);
+
+static uint64_t cardBytes() {
+  std::ifstream f(host_sd_dir + "/" + dataFile, std::ios::binary | std::ios::ate);
+  return f ? (uint64_t)f.tellg() : 0;
+}
+
+int main(int argc, char **argv) {
+  bool bin = argc > 1 && argv[1][0] == 'b';
+  host_sd_clear();
+  int r = host_run([=] {
+    tagsim_install();
+    host_boot();
+    logMode = 'S';
+    SDOK = 1;
+    binFmt = bin;
+    setFileNames();
+    uint32_t b0 = host_sd_begins;
+    uint64_t readUs = 0, idleUs = 0;
+    int reads = 0, idles = 0;
+    for (int i = 0; i < 3000; i++) {
+      uint8_t id[5] = {0x01, 0x23, 0x45, (uint8_t)(i / 10), 0x89};
+      tagsim.setEM4100(id);
+      tagsim.present[1] = tagsim.present[2] = (i % 10) < 4;
+      host_rtc_epoch += 2;
+      cycleCount = stopCycleCount;                       // (low power mode)
+      uint64_t t = host_us - host_sleep_us;
+      uint32_t m = memLoc;
+      loop();
+      t = host_us - host_sleep_us - t;
+      if (memLoc != m) { readUs += t; reads++; } else { idleUs += t; idles++; }
+    }
+    logEvent(12);
+    printf("%d reads stored in 3000 loops (%s file)\n", reads, bin ? "binary" : "text");
+    printf("awake in a loop with a stored read: %.1f ms, without: %.1f ms\n", readUs / 1e3 / reads, idleUs / 1e3 / idles);
+    printf("SD card starts: %u\n", host_sd_begins - b0);
+    host_shared[0] = cardBytes();
+    return (expLoc != memLoc) || reads == 0;
+  });
+  uint64_t bytes = host_shared[0];
+  r += host_run([=] {
+    host_boot();
+    binFmt = bin;
+    setFileNames();
+    host_shared[0] = cardBytes();
+    return 0;
+  });
+  printf("card in sync: %s\n", (r == 0 && host_shared[0] == bytes) ? "yes, nothing added after a power up" : "no");
+  r += host_shared[0] != bytes;
+  printf(r ? "FAIL\n" : "PASS\n");
+  return r != 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * tagsim.cpp
+ *
+ * The RF tag simulator (see tagsim.h).
+ */
+
+#include "Arduino.h"
+#include "host.h"
+#include "tagsim.h"
+
+TagSim tagsim;
+
+void TagSim::setEM4100(const uint8_t id[5]) {
+  std::vector<int> bits(9, 1);
+  int col[4] = {0, 0, 0, 0};
+  for (int r = 0; r < 10; r++) {
+    int nib = (r & 1) ? (id[r / 2] & 0xF) : (id[r / 2] >> 4);
+    int p = 0;
+    for (int k = 3; k >= 0; k--) { int b = (nib >> k) & 1; bits.push_back(b); p ^= b; col[3 - k] ^= b; }
+    bits.push_back(p);
+  }
+  for (int k = 0; k < 4; k++) bits.push_back(col[k]);
+  bits.push_back(0);
+  halfbits.clear();
+  for (int b : bits) { int f = polarity ? b : !b; halfbits.push_back(f); halfbits.push_back(!f); }
+}
+
+// The edges between the last call and now, each at its own time (host_us is set back to it for the handler)
+static uint64_t lastTick = 0;
+static bool inTick = false;
+static void tick() {
+  if (inTick) return;
+  inTick = true;
+  int ant = host_pins[48] == 0 ? 1 : (host_pins[49] == 0 ? 2 : 0);
+  uint64_t now = host_us;
+  if (ant && tagsim.present[ant] && host_isr && !tagsim.halfbits.empty()) {
+    int pin = ant == 1 ? 41 : 42;
+    size_t n = tagsim.halfbits.size();
+    for (uint64_t h = lastTick / tagsim.halfUs + 1; h * tagsim.halfUs <= now; h++) {
+      int cur = tagsim.halfbits[h % n], prev = tagsim.halfbits[(h + n - 1) % n];
+      if (cur != prev) { host_us = h * tagsim.halfUs; host_pins[pin] = cur; if (host_isr) host_isr(); }
+    }
+    host_us = now;
+  }
+  lastTick = now;
+  inTick = false;
+}
+
+void tagsim_install() { host_tick = tick; }
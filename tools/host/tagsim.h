@@ -0,0 +1,21 @@
+/*
+ * tagsim.h
+ *
+ * RF tag simulator: while a tag is present at an antenna and that RFID circuit is on (SHD_PINA 48 or SHD_PINB 49
+ * low), the tag's EM4100 code is sent over and over as Manchester edges on the circuit's demod pin (41 or 42),
+ * calling the interrupt handler the sketch attached, as time moves on (host_tick).
+ */
+
+#pragma once
+#include <cstdint>
+#include <vector>
+
+struct TagSim {
+  bool present[3] = {false, false, false};  // tag at antenna 1 or 2
+  std::vector<uint8_t> halfbits;            // demod pin level for each half bit of the code
+  uint32_t halfUs = 256;                    // (64 cycles of 125 kHz a bit)
+  int polarity = 1;                         // 1: the first half of a bit is at the level of the bit
+  void setEM4100(const uint8_t id[5]);      // the tag's code: 9 header bits, 10 rows with parity, column parity, stop bit
+};
+extern TagSim tagsim;
+void tagsim_install();                  // send edges from now on (sets host_tick)
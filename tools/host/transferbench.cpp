@@ -0,0 +1,129 @@
+/*
+  transferbench - time the transfers of the RFID reads and the log lines from flash to the SD card (menu options that
+  call extractMemRFID() and extractMemLog()), as text and as binary files, and check the text file line by line.
+
+  Build:  ./build.sh transferbench.cpp
+  Use:    ./transferbench [reads]        (default 100,000 reads, plus 600 log lines)
+
+  The reads are stored with storeLine(), one every 1 to 20 s, of 12 tags (3 ISO11784/5, 9 EM4100). A transfer with
+  no SD card gives the time taken by reading flash and formatting; the SD part of a transfer is its time minus that.
+  Times are simulated time (SPI and card costs of host.cpp and SdFat.h). SD opens and writes are library calls; a
+  FAT update is a file growing into a cluster that was not preallocated. The transfer buffers come from the scratch
+  arena, whose high-water mark is shown (scratchTake() stops the board if it would overflow).
+
+  Then more reads are stored until the ring has wrapped (the oldest data is above memLoc), and each transfer into an
+  empty card must preallocate no more than the text or binary lines of the whole data area.
+*/
+
+#include "Arduino.h"
+#include "host.h"
+#include <fstream>
+#include <sstream>
+
+extern bool binFmt;
+extern char dataFile[13], logFile[13];
+extern uint32_t memLoc, datStart;
+extern uint16_t lastBlk, blkSize, scratchHigh;
+uint32_t storeLine(char *line, uint8_t len);
+uint32_t firstDataLoc();
+uint32_t logFirst();
+void formatLine(char *BA, char *text);
+void extractMemRFID(uint8_t prntWrt, uint32_t flashStart);
+void extractMemLog(uint8_t prntWrt, uint32_t flashStart);
+void setFileNames();
+void logEvent(uint8_t code);
+
+static std::string cardFile(const char *name) {
+  std::ifstream f(host_sd_dir + "/" + name, std::ios::binary);
+  std::stringstream s;
+  s << f.rdbuf();
+  return s.str();
+}
+
+int main(int argc, char **argv) {
+  long nReads = argc > 1 ? atol(argv[1]) : 100000;
+  host_sd_clear();
+  int r = host_run([=] {
+    host_boot();
+    host_sd_clear();
+    std::string ref;
+    uint32_t T = 1700000000, rng = 12345;
+    auto rnd = [&] { rng = rng * 1103515245 + 12345; return rng >> 8; };
+    for (long i = 0; i < nReads; i++) {
+      char l[12], text[64];
+      T += 1 + rnd() % 20;
+      int tag = rnd() % 12;
+      if (tag % 4 == 0) {
+        l[0] = 0x81;
+        for (int k = 1; k < 7; k++) l[k] = 0x10 * tag + k;
+        l[7] = 3;
+        memcpy(l + 8, &T, 4);
+        storeLine(l, 12);
+      } else {
+        l[0] = 1 + (rnd() & 1);
+        for (int k = 1; k < 6; k++) l[k] = 0x20 + k * tag;
+        memcpy(l + 6, &T, 4);
+        storeLine(l, 10);
+      }
+      formatLine(l, text);
+      ref += std::string(text) + "\r\n";
+    }
+    for (int i = 0; i < 600; i++) logEvent(12 + (i & 1));
+
+    host_sd_present = false;
+    uint64_t t0 = host_us;
+    extractMemRFID(2, firstDataLoc());
+    double flashOnly = (host_us - t0) / 1e6;
+    host_sd_present = true;
+    printf("%ld reads; reading flash without an SD card: %.2f s\n\n", nReads, flashOnly);
+    printf("file    transfer  time (s)  SD part (s)  SD opens  SD writes  FAT updates\n");
+    for (int b = 0; b < 2; b++) {
+      binFmt = b;
+      setFileNames();
+      uint32_t o = host_sd_opens, w = host_sd_writes, f = host_sd_fats;
+      t0 = host_us;
+      extractMemRFID(2, firstDataLoc());
+      double t = (host_us - t0) / 1e6;
+      printf("%-6s  RFID      %8.2f  %11.2f  %8u  %9u  %11u\n", b ? "binary" : "text", t, t - flashOnly, host_sd_opens - o,
+             host_sd_writes - w, host_sd_fats - f);
+      o = host_sd_opens; w = host_sd_writes; f = host_sd_fats;
+      t0 = host_us;
+      extractMemLog(2, logFirst());
+      t = (host_us - t0) / 1e6;
+      printf("%-6s  log       %8.2f  %11s  %8u  %9u  %11u\n", b ? "binary" : "text", t, "", host_sd_opens - o, host_sd_writes - w,
+             host_sd_fats - f);
+    }
+    binFmt = 0;
+    setFileNames();
+    bool same = cardFile(dataFile) == ref;
+    printf("\ntext file %s the reads stored\n", same ? "matches" : "does not match");
+    printf("scratch arena: most used %u bytes\n", scratchHigh);
+    return !same;
+  });
+
+  r += host_run([] {
+    host_boot();
+    uint32_t T = 1800000000;
+    for (long n = 0; firstDataLoc() < memLoc || n < 1000; n++) {
+      char l[10] = {1, 0x11, 0x22, (char)(n >> 8), (char)n, 0x55};
+      T += 3;
+      memcpy(l + 6, &T, 4);
+      storeLine(l, 10);
+    }
+    uint32_t ring = (uint32_t)(lastBlk + 1) * blkSize - datStart;
+    printf("\nring wrapped (oldest data at %u, memLoc %u), data area %u bytes\n", firstDataLoc(), memLoc, ring);
+    int bad = 0;
+    for (int b = 0; b < 2; b++) {
+      binFmt = b;
+      setFileNames();
+      host_sd_clear();
+      host_sd_prealloc = 0;
+      extractMemRFID(2, firstDataLoc());
+      printf("%-6s transfer: %llu bytes preallocated\n", b ? "binary" : "text", (unsigned long long)host_sd_prealloc);
+      bad += host_sd_prealloc == 0 || host_sd_prealloc > (uint64_t)ring * 14;
+    }
+    return bad;
+  });
+  printf(r ? "FAIL\n" : "PASS\n");
+  return r != 0;
+}